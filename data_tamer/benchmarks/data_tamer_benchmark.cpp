@@ -1,8 +1,13 @@
 #include <benchmark/benchmark.h>
 #include "data_tamer/data_sink.hpp"
 #include "data_tamer/data_tamer.hpp"
+#include "data_tamer/sinks/mcap_sink.hpp"
 #include "../examples/geometry_types.hpp"
 
+#include <atomic>
+#include <ctime>
+#include <thread>
+
 using namespace DataTamer;
 
 class NullSink : public DataSinkBase
@@ -46,7 +51,384 @@ static void DT_PoseType(benchmark::State& state)
   }
 }
 
+// Serialization of 1000 Poses alone, without the rest of takeSnapshot:
+// field by field (0) or with the memory runs of CustomSerializerT (1)
+static void DT_PoseSerializer(benchmark::State& state)
+{
+  std::vector<Pose> poses(1000);
+  CustomSerializerT<Pose> serializer;
+  std::vector<uint8_t> buffer(poses.size() * serializer.serializedSize(&poses.front()));
+
+  for (auto _ : state)
+  {
+    SerializeMe::SpanBytes span(buffer);
+    if (state.range(0) == 0)
+    {
+      for (const auto& pose : poses)
+      {
+        SerializeMe::SerializeIntoBuffer(span, pose);
+      }
+    }
+    else
+    {
+      serializer.serializeArray(poses.data(), poses.size(), sizeof(Pose), span);
+    }
+    benchmark::DoNotOptimize(buffer.data());
+  }
+}
+
+// Large vector of a custom type: serialized at once, not one point at the time
+static void DT_PointVector(benchmark::State& state)
+{
+  std::vector<Point3D> points(size_t(state.range(0)));
+
+  auto registry = ChannelsRegistry();
+  auto channel = registry.getChannel("channel");
+  channel->addDataSink(std::make_shared<NullSink>());
+
+  channel->registerValue("points", &points);
+
+  for (auto _ : state)
+  {
+    channel->takeSnapshot();
+  }
+}
+
+// Vector of 10K doubles, saved as they are (0), as int16 (1) or as FLOAT16 (2)
+static void DT_QuantizedVector(benchmark::State& state)
+{
+  std::vector<double> values(10000, 0.42);
+
+  auto registry = ChannelsRegistry();
+  auto channel = registry.getChannel("channel");
+  channel->addDataSink(std::make_shared<NullSink>());
+
+  if (state.range(0) == 0)
+  {
+    channel->registerValue("values", &values);
+  }
+  else if (state.range(0) == 1)
+  {
+    channel->registerValue("values", &values, Quantized<int16_t>{1e-4});
+  }
+  else
+  {
+    channel->registerValue("values", &values, BasicType::FLOAT16);
+  }
+
+  for (auto _ : state)
+  {
+    channel->takeSnapshot();
+  }
+}
+
+// Many scalar series, registered one by one. They are not adjacent in memory,
+// therefore they are copied individually
+static void DT_ScalarSeries(benchmark::State& state)
+{
+  std::vector<double> values(size_t(state.range(0)) * 2);
+
+  auto registry = ChannelsRegistry();
+  auto channel = registry.getChannel("channel");
+  channel->addDataSink(std::make_shared<NullSink>());
+
+  for (size_t i = 0; i < values.size(); i += 2)
+  {
+    channel->registerValue("value_" + std::to_string(i), &values[i]);
+  }
+
+  for (auto _ : state)
+  {
+    channel->takeSnapshot();
+  }
+}
+
+// Many custom type series, registered one by one
+static void DT_PoseSeries(benchmark::State& state)
+{
+  std::vector<Pose> poses(size_t(state.range(0)));
+
+  auto registry = ChannelsRegistry();
+  auto channel = registry.getChannel("channel");
+  channel->addDataSink(std::make_shared<NullSink>());
+
+  for (size_t i = 0; i < poses.size(); i++)
+  {
+    channel->registerValue("pose_" + std::to_string(i), &poses[i]);
+  }
+
+  for (auto _ : state)
+  {
+    channel->takeSnapshot();
+  }
+}
+
+// Time spent in takeSnapshot by the caller. Argument 1 enables
+// LogChannel::setDeferredSerialization
+static void DT_PoseArrayDeferred(benchmark::State& state)
+{
+  std::array<Pose, 100> poses = {};
+
+  auto registry = ChannelsRegistry();
+  auto channel = registry.getChannel("channel");
+  channel->addDataSink(std::make_shared<NullSink>());
+  channel->setDeferredSerialization(state.range(0) != 0);
+
+  channel->registerValue("values", &poses);
+
+  for (auto _ : state)
+  {
+    channel->takeSnapshot();
+  }
+}
+
+// 40 channels with 100 doubles each. Argument 0 calls LogChannel::takeSnapshot
+// on each channel, argument 1 calls ChannelsRegistry::takeSnapshotAll
+static void DT_ManyChannels(benchmark::State& state)
+{
+  std::vector<double> values(100);
+
+  auto registry = ChannelsRegistry();
+  registry.addDefaultSink(std::make_shared<NullSink>());
+
+  std::vector<std::shared_ptr<LogChannel>> channels;
+  for (int i = 0; i < 40; i++)
+  {
+    auto channel = registry.getChannel("channel_" + std::to_string(i));
+    channel->registerValue("values", &values);
+    channels.push_back(channel);
+  }
+
+  for (auto _ : state)
+  {
+    if (state.range(0) == 0)
+    {
+      for (auto& channel : channels)
+      {
+        channel->takeSnapshot();
+      }
+    }
+    else
+    {
+      registry.takeSnapshotAll();
+    }
+  }
+}
+
+// Cost of reading the clock. Argument: 0 SystemClock, 1 CoarseMonotonicClock, 2 TscClock
+static void DT_Clock(benchmark::State& state)
+{
+  std::unique_ptr<Clock> clock;
+  switch (state.range(0))
+  {
+    case 0:
+      clock = std::make_unique<SystemClock>();
+      break;
+    case 1:
+      clock = std::make_unique<CoarseMonotonicClock>();
+      break;
+    default:
+      clock = std::make_unique<TscClock>();
+      break;
+  }
+  for (auto _ : state)
+  {
+    benchmark::DoNotOptimize(clock->now());
+  }
+}
+
+// Latency of LoggedValue::set() while another thread is taking snapshots
+// of a large channel. Argument 0 is LoggedValueLock::MUTEX, 1 is LoggedValueLock::SEQLOCK
+static void DT_LoggedValueContention(benchmark::State& state)
+{
+  std::vector<double> values(10000);
+
+  auto registry = ChannelsRegistry();
+  auto channel = registry.getChannel("channel");
+  channel->addDataSink(std::make_shared<NullSink>());
+  channel->registerValue("values", &values);
+
+  const auto lock = static_cast<LoggedValueLock>(state.range(0));
+  auto logged_value = channel->createLoggedValue<double>("logged", 0, lock);
+
+  std::atomic_bool run = true;
+  std::thread snapshot_thread([&]() {
+    while (run)
+    {
+      channel->takeSnapshot();
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+  });
+
+  double value = 0;
+  int64_t max_latency = 0;
+  for (auto _ : state)
+  {
+    const auto t1 = std::chrono::steady_clock::now();
+    logged_value->set(value);
+    const auto t2 = std::chrono::steady_clock::now();
+    max_latency = std::max(max_latency, (t2 - t1).count());
+    value += 1.0;
+  }
+  state.counters["max_latency_ns"] = double(max_latency);
+
+  run = false;
+  snapshot_thread.join();
+}
+
+// Time between DataSinkBase::pushSnapshot and the call of storeSnapshot, when the
+// thread of the sink is idle. Argument: spin time of the sink, in microseconds
+class LatencySink : public DataSinkBase
+{
+public:
+  ~LatencySink() override {   stopThread(); }
+  void addChannel(std::string const&, Schema const& ) override {}
+  bool storeSnapshot(const Snapshot&) override
+  {
+    stored_time = std::chrono::steady_clock::now().time_since_epoch().count();
+    stored_count++;
+    return true;
+  }
+  std::atomic<int64_t> stored_time = 0;
+  std::atomic<int64_t> stored_count = 0;
+};
+
+static void DT_SinkLatency(benchmark::State& state)
+{
+  auto sink = std::make_shared<LatencySink>();
+  sink->setSpinTime(std::chrono::microseconds(state.range(0)));
+  const auto snapshot = std::make_shared<const Snapshot>();
+
+  int64_t total_latency = 0;
+  int64_t max_latency = 0;
+  int64_t count = 0;
+  for (auto _ : state)
+  {
+    // let the thread of the sink go to sleep (unless it spins)
+    std::this_thread::sleep_for(std::chrono::microseconds(200));
+    const auto pushed_count = sink->stored_count.load();
+    const auto pushed_time = std::chrono::steady_clock::now().time_since_epoch().count();
+    sink->pushSnapshot(snapshot);
+    while (sink->stored_count.load() == pushed_count)
+    {
+      std::this_thread::yield();
+    }
+    const int64_t latency = sink->stored_time.load() - pushed_time;
+    total_latency += latency;
+    max_latency = std::max(max_latency, latency);
+    count++;
+  }
+  state.counters["avg_latency_ns"] = double(total_latency) / double(std::max<int64_t>(count, 1));
+  state.counters["max_latency_ns"] = double(max_latency);
+}
+
+// CPU used by the threads of idle sinks. Argument: number of sinks
+static void DT_SinkIdleCpu(benchmark::State& state)
+{
+  std::vector<std::shared_ptr<NullSink>> sinks;
+  for (int64_t i = 0; i < state.range(0); i++)
+  {
+    sinks.push_back(std::make_shared<NullSink>());
+  }
+  double cpu_percent = 0;
+  for (auto _ : state)
+  {
+    const auto cpu_start = std::clock();
+    const auto wall_start = std::chrono::steady_clock::now();
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    const double cpu_sec = double(std::clock() - cpu_start) / CLOCKS_PER_SEC;
+    const std::chrono::duration<double> wall_sec = std::chrono::steady_clock::now() - wall_start;
+    cpu_percent = 100.0 * cpu_sec / wall_sec.count();
+  }
+  state.counters["cpu_percent"] = cpu_percent;
+}
+
+// Push a burst of snapshots and wait until the sink stored all of them
+static void DT_SinkBurst(benchmark::State& state)
+{
+  auto sink = std::make_shared<LatencySink>();
+  const auto snapshot = std::make_shared<const Snapshot>();
+  const auto lane = sink->createLane();
+  const int64_t burst = state.range(0);
+  for (auto _ : state)
+  {
+    const auto target = sink->stored_count.load() + burst;
+    for (int64_t i = 0; i < burst; i++)
+    {
+      sink->pushSnapshot(*lane, snapshot);
+    }
+    while (sink->stored_count.load() < target)
+    {
+      std::this_thread::yield();
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * burst);
+}
+
+// Many threads pushing into the same sink. Argument: 1 if each thread uses its own Lane
+static void DT_SinkLanes(benchmark::State& state)
+{
+  static auto sink = std::make_shared<NullSink>();
+  const auto lane = sink->createLane();
+  const auto snapshot = std::make_shared<const Snapshot>();
+  for (auto _ : state)
+  {
+    if (state.range(0) == 1)
+    {
+      sink->pushSnapshot(*lane, snapshot);
+    }
+    else
+    {
+      sink->pushSnapshot(snapshot);
+    }
+  }
+}
+
+// MCAPSink saving a vector of doubles. Argument: 1 if the message was prepared
+// by WriteMessageHeader (as LogChannel does), 0 if the payload must be copied
+static void DT_MCAPLargeVector(benchmark::State& state)
+{
+  std::vector<double> values(size_t(state.range(0)));
+  auto channel = LogChannel::create("channel");
+  channel->registerValue("values", &values);
+  const auto schema = channel->getSchema();
+
+  MCAPSink sink("/dev/null");
+  sink.addChannel("channel", schema);
+
+  Snapshot snapshot;
+  snapshot.channel_name = "channel";
+  snapshot.schema_hash = schema.hash;
+  snapshot.active_mask.resize(1, 0xFF);
+  snapshot.payload.resize(sizeof(uint32_t) + values.size() * sizeof(double));
+  if (state.range(1) == 1)
+  {
+    WriteMessageHeader(snapshot);
+  }
+  for (auto _ : state)
+  {
+    sink.storeSnapshot(snapshot);
+  }
+  state.SetBytesProcessed(state.iterations() * int64_t(snapshot.payload.size()));
+}
+
 BENCHMARK(DT_Doubles)->Arg(125)->Arg(250)->Arg(500)->Arg(1000)->Arg(2000);
 BENCHMARK(DT_PoseType)->Arg(125)->Arg(250)->Arg(500)->Arg(1000);
+BENCHMARK(DT_PoseSerializer)->ArgName("memory_runs")->Arg(0)->Arg(1);
+BENCHMARK(DT_PointVector)->Arg(1000)->Arg(10000);
+BENCHMARK(DT_QuantizedVector)->ArgName("saved_as")->Arg(0)->Arg(1)->Arg(2);
+BENCHMARK(DT_ScalarSeries)->Arg(100)->Arg(1000)->Arg(10000);
+BENCHMARK(DT_PoseSeries)->Arg(100)->Arg(1000);
+BENCHMARK(DT_PoseArrayDeferred)->ArgName("deferred")->Arg(0)->Arg(1);
+BENCHMARK(DT_ManyChannels)->ArgName("all")->Arg(0)->Arg(1);
+BENCHMARK(DT_Clock)->ArgName("clock")->Arg(0)->Arg(1)->Arg(2);
+BENCHMARK(DT_LoggedValueContention)->ArgName("seqlock")->Arg(0)->Arg(1)->UseRealTime();
+BENCHMARK(DT_SinkLatency)->ArgName("spin_us")->Arg(0)->Arg(500)->UseRealTime();
+BENCHMARK(DT_SinkBurst)->Arg(1000)->UseRealTime();
+BENCHMARK(DT_SinkLanes)->ArgName("lane")->Arg(0)->Arg(1)->Threads(1)->Threads(4);
+BENCHMARK(DT_MCAPLargeVector)
+    ->ArgNames({"size", "framed"})
+    ->ArgsProduct({{1000, 100000}, {0, 1}});
+BENCHMARK(DT_SinkIdleCpu)->ArgName("sinks")->Arg(10)->Iterations(5)->UseRealTime();
 
 BENCHMARK_MAIN();
@@ -1,9 +1,12 @@
 #pragma once
 
 #include "data_tamer/values.hpp"
+#include "data_tamer/clock.hpp"
+#include "data_tamer/quantization.hpp"
 #include "data_tamer/data_sink.hpp"
 #include "data_tamer/details/mutex.hpp"
 #include "data_tamer/details/locked_reference.hpp"
+#include "data_tamer/details/seqlock.hpp"
 
 #include <atomic>
 #include <chrono>
@@ -24,6 +27,16 @@ class DataSinkBase;
 class LogChannel;
 class ChannelsRegistry;
 
+/// Synchronization used by LoggedValue to protect its value.
+enum class LoggedValueLock
+{
+  /// set() and get() lock LogChannel::writeMutex()
+  MUTEX,
+  /// set() never waits for takeSnapshot(); only for trivially copyable types.
+  /// See SeqLock for details. getLockedReference() is not available.
+  SEQLOCK
+};
+
 /**
  * @brief The LoggedValue class is a container of a variable that
  * automatically register/unregister to a Channel when created/destroyed.
@@ -35,7 +48,7 @@ class LoggedValue
 {
 protected:
   LoggedValue(const std::shared_ptr<LogChannel>& channel, const std::string& name,
-              T initial_value);
+              T initial_value, LoggedValueLock lock = LoggedValueLock::MUTEX);
 
   friend LogChannel;
 
@@ -75,6 +88,8 @@ public:
 private:
   std::weak_ptr<LogChannel> channel_;
   T value_ = {};
+  // used instead of value_, with LoggedValueLock::SEQLOCK
+  std::unique_ptr<SeqLock<T>> seqlock_;
   RegistrationID id_;
   bool enabled_ = true;
 };
@@ -97,6 +112,9 @@ private:
  * to add a new value.
  * All you values must be registered before calling takeSnapshot for the first time.
  *
+ * Bools use a single bit of the payload: the enabled bool values are packed
+ * in a bitfield at the beginning of the payload and the elements of the
+ * arrays and vectors of bools are saved eight per byte (SCHEMA_VERSION >= 6).
  */
 class LogChannel : public std::enable_shared_from_this<LogChannel>
 {
@@ -158,6 +176,48 @@ public:
   template <typename T, size_t N>
   RegistrationID registerValue(const std::string& name, const std::array<T, N>* value);
 
+  /**
+   * @brief registerValue add a value protected by a SeqLock.
+   * Its writers never wait for takeSnapshot, since they don't need to lock writeMutex().
+   *
+   * @param name   name of the value
+   * @param value  pointer to the value
+   * @return       the ID to be used to unregister or enable/disable this value.
+   */
+  template <typename T>
+  RegistrationID registerValue(const std::string& name, const SeqLock<T>* value);
+
+  /**
+   * @brief registerValue add a floating point value, a vector or an array of them,
+   * saved as integers of type IntType to reduce the size of the snapshots.
+   * See Quantized for details. Example:
+   *
+   *    channel->registerValue("temperature", &temp, Quantized<int16_t>{0.01, 20.0});
+   *
+   * @param name       name of the value
+   * @param value      pointer to the value
+   * @param quantized  resolution and offset of the saved integers
+   * @return           the ID to be used to unregister or enable/disable this value.
+   */
+  template <typename T, typename IntType>
+  RegistrationID registerValue(const std::string& name, const T* value,
+                               Quantized<IntType> quantized);
+
+  /**
+   * @brief registerValue add a floating point value, a vector or an array of them,
+   * saved with reduced precision to halve (or quarter) the size of the snapshots.
+   *
+   *    channel->registerValue("currents", &currents, BasicType::FLOAT16);
+   *
+   * @param name        name of the value
+   * @param value       pointer to the value (float or double)
+   * @param saved_type  either BasicType::FLOAT16 or BasicType::BFLOAT16.
+   * @return            the ID to be used to unregister or enable/disable this value.
+   */
+  template <typename T>
+  RegistrationID registerValue(const std::string& name, const T* value,
+                               BasicType saved_type);
+
   /**
    * @brief registerCustomValue should be used when you want to "bypass" the serialization
    * provided by DataTamer and use your own.
@@ -182,12 +242,14 @@ public:
    *
    * @param name of the value
    * @param initial_value  initial value to give to the LoggedValue
+   * @param lock  how the value is protected. See LoggedValueLock.
    *
    * @return the instance of LoggedValue, wrapped in a shared_ptr
    */
   template <typename T = double>
-  [[nodiscard]] std::shared_ptr<LoggedValue<T>> createLoggedValue(std::string const& name,
-                                                                  T initial_value = T{});
+  [[nodiscard]] std::shared_ptr<LoggedValue<T>>
+  createLoggedValue(std::string const& name, T initial_value = T{},
+                    LoggedValueLock lock = LoggedValueLock::MUTEX);
 
   /// Name of this channel (passed to the constructor)
   [[nodiscard]] const std::string& channelName() const;
@@ -202,10 +264,45 @@ public:
   /// NOTE: the unregistered value will not be removed from the Schema
   void unregister(const RegistrationID& id);
 
+  /**
+   * @brief setDeltaEncoding enables the encoding PayloadEncoding::DELTA:
+   * each snapshot contains only the values that changed since the previous one,
+   * and a full snapshot (keyframe) is sent periodically.
+   * A keyframe is also sent when a sink is added, or when a sink calls
+   * DataSinkBase::requestKeyframe.
+   * DataTamerParser::ParseSnapshot decodes it transparently.
+   *
+   * It must be called before takeSnapshot is called the first time.
+   *
+   * @param keyframe_period  one snapshot every keyframe_period is a keyframe.
+   *                         Zero disables delta encoding (default).
+   */
+  void setDeltaEncoding(uint32_t keyframe_period);
+
+  /**
+   * @brief setDeferredSerialization moves the serialization out of takeSnapshot.
+   *
+   * When enabled, takeSnapshot only copies the memory of the registered values
+   * (while writeMutex() is locked); the CustomSerializers are invoked later
+   * by a thread owned by this channel, that also pushes the snapshots to the sinks.
+   *
+   * Only trivially copyable values with a fixed serialized size can be registered
+   * (numbers, std::array and their custom types). Vectors are not supported.
+   *
+   * It must be called before takeSnapshot is called the first time.
+   * Throws if a value that can not be captured was registered already.
+   */
+  void setDeferredSerialization(bool enable);
+
   /**
    * @brief addDataSink add a sink, i.e. a class collecting our snapshots.
+   *
+   * @param sink        the sink. If it was added already, only its decimation is updated.
+   *                    If the channel started recording, sink->addChannel is called here.
+   * @param decimation  which snapshots are pushed to this sink (default: all of them).
+   *                    Can not be used together with setDeltaEncoding.
    */
-  void addDataSink(std::shared_ptr<DataSinkBase> sink);
+  void addDataSink(std::shared_ptr<DataSinkBase> sink, SinkDecimation decimation = {});
 
   /**
    * @brief takeSnapshot copies the current value of all your registered values
@@ -215,7 +312,21 @@ public:
    *
    * @return true is succesfully pushed to all its sinks.
    */
-  bool takeSnapshot(std::chrono::nanoseconds timestamp = NsecSinceEpoch());
+  bool takeSnapshot(std::chrono::nanoseconds timestamp);
+
+  /// Same as above, the timestamp is provided by the Clock (see setClock).
+  bool takeSnapshot();
+
+  /**
+   * @brief setClock changes the source of the timestamps used by takeSnapshot().
+   * Its name is saved in the Schema. Default is SystemClock.
+   *
+   * It must be called before takeSnapshot is called the first time.
+   */
+  void setClock(Clock::Ptr clock);
+
+  /// A copy, since setClock may replace it in the meantime
+  [[nodiscard]] Clock::Ptr clock() const;
 
   /**
    * @brief getActiveFlags returns a serialized buffer, where
@@ -245,16 +356,50 @@ private:
   struct Pimpl;
   std::unique_ptr<Pimpl> _p;
 
+  friend ChannelsRegistry;
+
   TypesRegistry _type_registry;
 
+  /**
+   * @brief createSnapshot does everything takeSnapshot does, but pushing the
+   * snapshot to the sinks. writeMutex() must be locked.
+   *
+   * @param snapshot   the new snapshot. It is nullptr if the serialization is deferred,
+   *                   because it will be pushed later by this channel, or if no sink
+   *                   wants it.
+   * @param targets    bit N is set if the snapshot must be pushed to dataSinks()[N].
+   * @param has_sinks  false if the channel has no sinks.
+   * @return false if there are no sinks or the deferred snapshot was not queued.
+   */
+  bool createSnapshot(std::chrono::nanoseconds timestamp, SnapshotPtr& snapshot,
+                      uint64_t& targets, bool& has_sinks);
+
+  // takeSnapshot, with writeMutex() locked
+  bool takeSnapshotUnlocked(std::chrono::nanoseconds timestamp);
+
+  // writeMutex() must be locked
+  [[nodiscard]] const std::vector<std::shared_ptr<DataSinkBase>>& dataSinks() const;
+
+  // Push into DataSinkBase::sharedLane, instead of a dedicated Lane. Used by
+  // ChannelsRegistry, to push the snapshots of all its channels at once.
+  // Called before addDataSink
+  void useSharedLanes();
+
+  // used by ChannelsRegistry::setClock, with writeMutex() locked
+  [[nodiscard]] bool loggingStarted() const;
+  void setClockUnlocked(Clock::Ptr clock);
+
   template <typename T>
   void updateTypeRegistry();
 
   void addCustomType(const std::string& custom_type_name, const FieldsVector& fields);
 
-  [[nodiscard]] RegistrationID registerValueImpl(const std::string& name,
-                                                 ValuePtr&& value_ptr,
-                                                 CustomSerializer::Ptr type_info);
+  // saved_type, if not BasicType::OTHER, replaces the type of value_ptr in the Schema
+  [[nodiscard]] RegistrationID
+  registerValueImpl(const std::string& name, ValuePtr&& value_ptr,
+                    CustomSerializer::Ptr type_info,
+                    BasicType saved_type = BasicType::OTHER,
+                    std::optional<Quantization> quantization = std::nullopt);
 };
 
 //----------------------------------------------------------------------
@@ -320,6 +465,55 @@ inline RegistrationID LogChannel::registerValue(const std::string& name,
   }
 }
 
+template <typename T>
+inline RegistrationID LogChannel::registerValue(const std::string& name,
+                                                const SeqLock<T>* value_ptr)
+{
+  if constexpr (IsNumericType<T>())
+  {
+    return registerValueImpl(name, ValuePtr(value_ptr), {});
+  }
+  else
+  {
+    updateTypeRegistry<T>();
+    auto def = _type_registry.getSerializer<T>();
+    return registerValueImpl(name, ValuePtr(value_ptr, def), def);
+  }
+}
+
+template <typename T, typename IntType>
+inline RegistrationID LogChannel::registerValue(const std::string& name,
+                                                const T* value_ptr,
+                                                Quantized<IntType> quantized)
+{
+  using Float = typename details::ElementType<T>::type;
+  auto serializer = std::make_shared<QuantizedSerializer<Float, IntType>>(
+      Quantization{quantized.scale, quantized.offset});
+  return registerValueImpl(name, ValuePtr(value_ptr, serializer), serializer,
+                           GetBasicType<IntType>(), serializer->quantization());
+}
+
+template <typename T>
+inline RegistrationID LogChannel::registerValue(const std::string& name,
+                                                const T* value_ptr, BasicType saved_type)
+{
+  using Float = typename details::ElementType<T>::type;
+  CustomSerializer::Ptr serializer;
+  if (saved_type == BasicType::FLOAT16)
+  {
+    serializer = std::make_shared<HalfFloatSerializer<Float, BasicType::FLOAT16>>();
+  }
+  else if (saved_type == BasicType::BFLOAT16)
+  {
+    serializer = std::make_shared<HalfFloatSerializer<Float, BasicType::BFLOAT16>>();
+  }
+  else
+  {
+    throw std::runtime_error("registerValue: saved_type must be FLOAT16 or BFLOAT16");
+  }
+  return registerValueImpl(name, ValuePtr(value_ptr, serializer), serializer, saved_type);
+}
+
 template <typename T>
 inline RegistrationID LogChannel::registerCustomValue(const std::string& name,
                                                       const T* value_ptr,
@@ -342,7 +536,7 @@ inline RegistrationID LogChannel::registerValue(const std::string& prefix,
   {
     updateTypeRegistry<T>();
     auto def = _type_registry.getSerializer<T>();
-    return registerValueImpl(prefix, ValuePtr(vect), def);
+    return registerValueImpl(prefix, ValuePtr(vect, def), def);
   }
 }
 
@@ -364,17 +558,35 @@ inline RegistrationID LogChannel::registerValue(const std::string& prefix,
 
 template <typename T>
 inline std::shared_ptr<LoggedValue<T>>
-LogChannel::createLoggedValue(std::string const& name, T initial_value)
+LogChannel::createLoggedValue(std::string const& name, T initial_value,
+                              LoggedValueLock lock)
 {
-  auto val = new LoggedValue<T>(shared_from_this(), name, initial_value);
+  auto val = new LoggedValue<T>(shared_from_this(), name, initial_value, lock);
   return std::shared_ptr<LoggedValue<T>>(val);
 }
 
 template <typename T>
 inline LoggedValue<T>::LoggedValue(const std::shared_ptr<LogChannel>& channel,
-                                   const std::string& name, T initial_value) :
-  channel_(channel), value_(initial_value), id_(channel->registerValue(name, &value_))
-{}
+                                   const std::string& name, T initial_value,
+                                   LoggedValueLock lock) :
+  channel_(channel), value_(initial_value)
+{
+  if (lock == LoggedValueLock::MUTEX)
+  {
+    id_ = channel->registerValue(name, &value_);
+    return;
+  }
+  if constexpr (std::is_trivially_copyable_v<T>)
+  {
+    seqlock_ = std::make_unique<SeqLock<T>>(initial_value);
+    id_ = channel->registerValue(name, seqlock_.get());
+  }
+  else
+  {
+    throw std::runtime_error("LoggedValueLock::SEQLOCK requires a trivially "
+                             "copyable type");
+  }
+}
 
 template <typename T>
 inline LoggedValue<T>::~LoggedValue()
@@ -398,6 +610,15 @@ inline void LoggedValue<T>::setEnabled(bool enabled)
 template <typename T>
 inline void LoggedValue<T>::set(const T& val, bool auto_enable)
 {
+  if (seqlock_)
+  {
+    seqlock_->store(val);
+    if (!enabled_ && auto_enable)
+    {
+      setEnabled(true);
+    }
+    return;
+  }
   if (auto channel = channel_.lock())
   {
     std::lock_guard const lock(channel->writeMutex());
@@ -421,6 +642,10 @@ inline void LoggedValue<T>::set(const T& val, bool auto_enable)
 template <typename T>
 inline T LoggedValue<T>::get()
 {
+  if (seqlock_)
+  {
+    return seqlock_->load();
+  }
   if (auto channel = channel_.lock())
   {
     std::lock_guard const lock(channel->writeMutex());
@@ -432,6 +657,11 @@ inline T LoggedValue<T>::get()
 template <typename T>
 inline LockedRef<T, Mutex> LoggedValue<T>::getLockedReference()
 {
+  if (seqlock_)
+  {
+    throw std::runtime_error("getLockedReference() can not be used with "
+                             "LoggedValueLock::SEQLOCK");
+  }
   Mutex* mutex_ptr = nullptr;
   if (auto chan = channel_.lock())
   {
@@ -0,0 +1,162 @@
+#pragma once
+
+#include "data_tamer/details/seqlock.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace DataTamer
+{
+
+/**
+ * @brief The Clock class is the source of the timestamps used by
+ * LogChannel::takeSnapshot() and ChannelsRegistry::takeSnapshotAll().
+ *
+ * All the clocks return the time since epoch; their name is saved in the
+ * Schema, to let the readers know how the timestamps were obtained.
+ */
+class Clock
+{
+public:
+  using Ptr = std::shared_ptr<Clock>;
+
+  virtual ~Clock() = default;
+
+  /// Nanoseconds since epoch
+  [[nodiscard]] virtual std::chrono::nanoseconds now() const = 0;
+
+  /// Name saved in the Schema (see Schema::clock)
+  [[nodiscard]] virtual const char* name() const = 0;
+};
+
+/// Default clock, based on std::chrono::system_clock
+class SystemClock : public Clock
+{
+public:
+  [[nodiscard]] std::chrono::nanoseconds now() const override
+  {
+    auto since_epoch = std::chrono::system_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(since_epoch);
+  }
+
+  [[nodiscard]] const char* name() const override
+  {
+    return "system_clock";
+  }
+};
+
+/**
+ * @brief CoarseMonotonicClock uses CLOCK_MONOTONIC_COARSE (Linux only), that is
+ * much cheaper than the system_clock, but has a resolution of a few milliseconds.
+ *
+ * The offset to epoch is computed in the constructor.
+ */
+class CoarseMonotonicClock : public Clock
+{
+public:
+  CoarseMonotonicClock();
+
+  [[nodiscard]] std::chrono::nanoseconds now() const override;
+
+  [[nodiscard]] const char* name() const override
+  {
+    return "monotonic_coarse";
+  }
+
+private:
+  std::chrono::nanoseconds offset_;
+};
+
+/**
+ * @brief TscClock reads the Time Stamp Counter of the CPU (x86 only).
+ *
+ * The frequency of the counter is calibrated in the constructor against the
+ * system_clock, that takes `calibration_time`. It assumes an invariant TSC,
+ * available in any modern x86 CPU.
+ *
+ * The error of the frequency is about (jitter of the system_clock) / calibration_time:
+ * some ppm with the default 20 ms, that is, tens of milliseconds of drift per hour.
+ * Therefore, every `recalibration_period`, now() compares the counter with the
+ * system_clock again, over the whole time since the constructor, and corrects the
+ * frequency. The accumulated error is slewed away during the next period, without
+ * jumps backward. Only an error larger than 1 ms, or than 10% of the period
+ * (e.g. the system_clock was changed), is corrected with a jump.
+ * A zero `recalibration_period` disables the recalibration.
+ */
+class TscClock : public Clock
+{
+public:
+  explicit TscClock(
+      std::chrono::milliseconds calibration_time = std::chrono::milliseconds(20),
+      std::chrono::milliseconds recalibration_period = std::chrono::milliseconds(1000));
+
+  [[nodiscard]] std::chrono::nanoseconds now() const override;
+
+  [[nodiscard]] const char* name() const override
+  {
+    return "tsc";
+  }
+
+  /// Nanoseconds per tick, estimated by the last calibration
+  [[nodiscard]] double nsecPerTick() const
+  {
+    return calibration_.load().nsec_per_tick;
+  }
+
+private:
+  struct Calibration
+  {
+    // now() returns nsec_origin + (tsc - tsc_origin) * nsec_per_tick
+    uint64_t tsc_origin = 0;
+    int64_t nsec_origin = 0;
+    double nsec_per_tick = 1.0;
+    // first sample of the calibration, used to measure the frequency
+    uint64_t tsc_start = 0;
+    int64_t nsec_start = 0;
+  };
+  mutable SeqLock<Calibration> calibration_;
+  uint64_t recalibration_ticks_ = 0;
+  // the thread that moves it forward does the recalibration
+  mutable std::atomic<uint64_t> next_recalibration_ = 0;
+
+  void recalibrate(uint64_t tsc) const;
+};
+
+/**
+ * @brief SimulatedClock returns the time set by the user, for instance
+ * when replaying data or in a simulation.
+ */
+class SimulatedClock : public Clock
+{
+public:
+  explicit SimulatedClock(std::chrono::nanoseconds start_time = {}) : time_(start_time.count())
+  {}
+
+  [[nodiscard]] std::chrono::nanoseconds now() const override
+  {
+    return std::chrono::nanoseconds(time_.load(std::memory_order_relaxed));
+  }
+
+  [[nodiscard]] const char* name() const override
+  {
+    return "simulated";
+  }
+
+  void setTime(std::chrono::nanoseconds time)
+  {
+    time_.store(time.count(), std::memory_order_relaxed);
+  }
+
+  void advance(std::chrono::nanoseconds delta)
+  {
+    time_.fetch_add(delta.count(), std::memory_order_relaxed);
+  }
+
+private:
+  std::atomic<int64_t> time_;
+};
+
+}   // namespace DataTamer
@@ -3,6 +3,9 @@
 #include <map>
 #include <mutex>
 #include <optional>
+#include <type_traits>
+#include <cstring>
+#include <vector>
 
 #include "data_tamer/types.hpp"
 #include "data_tamer/contrib/SerializeMe.hpp"
@@ -54,10 +57,29 @@ public:
 
   // serialize an object into a buffer.
   virtual void serialize(const void* instance, SerializeMe::SpanBytes&) const = 0;
+
+  // serialize `count` objects, stored contiguously in memory (std::array or std::vector).
+  // The default implementation calls serialize() for each one of them.
+  virtual void serializeArray(const void* first_instance, size_t count, size_t stride,
+                              SerializeMe::SpanBytes& buffer) const
+  {
+    const auto* ptr = static_cast<const uint8_t*>(first_instance);
+    for (size_t i = 0; i < count; i++)
+    {
+      serialize(ptr + i * stride, buffer);
+    }
+  }
 };
 
 //------------------------------------------------------------------
 
+/// Contiguous block of memory, in a object, that can be serialized with a single memcpy
+struct MemoryRun
+{
+  size_t offset = 0;
+  size_t size = 0;
+};
+
 // This derived class is used automatically by all the types
 // that have a template specialization of TypeDefinition<T>
 template <typename T>
@@ -76,9 +98,16 @@ public:
   void serialize(const void* src_instance,
                  SerializeMe::SpanBytes& dst_buffer) const override;
 
+  void serializeArray(const void* first_instance, size_t count, size_t stride,
+                      SerializeMe::SpanBytes& dst_buffer) const override;
+
 private:
   std::string _name;
   size_t _fixed_size = 0;
+  // if not empty, the object is serialized copying these blocks of memory
+  std::vector<MemoryRun> _runs;
+  // true if _runs is a single block, as large as the entire object
+  bool _contiguous = false;
 };
 
 
@@ -140,7 +169,7 @@ inline void GetFixedSize(bool& is_fixed_size, size_t &fixed_size)
     else if constexpr(info.is_container && info.size >= 0)
     {
       // array
-      size_t obj_size;
+      size_t obj_size = 0;
       using Type = typename SerializeMe::container_info<T>::value_type;
       GetFixedSize<Type>(is_fixed_size, obj_size);
       fixed_size += info.size * obj_size;
@@ -160,6 +189,76 @@ inline void GetFixedSize(bool& is_fixed_size, size_t &fixed_size)
   }
 }
 
+// Recursive function to compute the position in memory of the numeric fields of T,
+// in the same order used by SerializeMe::SerializeIntoBuffer. Adjacent fields are merged.
+// Returns false if T contains a field that can not be serialized with memcpy,
+// or if T is not a standard-layout type.
+// Used mainly by the CustomSerializerT constructor.
+template <typename T>
+inline bool GetMemoryRuns(size_t offset, std::vector<MemoryRun>& runs)
+{
+  if constexpr (IsNumericType<T>())
+  {
+    if (!runs.empty() && runs.back().offset + runs.back().size == offset)
+    {
+      runs.back().size += sizeof(T);
+    }
+    else
+    {
+      runs.push_back({offset, sizeof(T)});
+    }
+    return true;
+  }
+  else if constexpr (std::is_same_v<T, std::string>)
+  {
+    return false;
+  }
+  else
+  {
+    constexpr auto info = SerializeMe::container_info<T>();
+    if constexpr (info.is_container && info.size == 0)
+    {
+      // vector
+      return false;
+    }
+    else if constexpr (info.is_container && info.size >= 0)
+    {
+      // array
+      using Type = typename SerializeMe::container_info<T>::value_type;
+      for (size_t i = 0; i < size_t(info.size); i++)
+      {
+        if (!GetMemoryRuns<Type>(offset + i * sizeof(Type), runs))
+        {
+          return false;
+        }
+      }
+      return true;
+    }
+    else if constexpr (!std::is_standard_layout_v<T> || !std::is_default_constructible_v<T>)
+    {
+      // the offset of the members may not be the same in every object
+      return false;
+    }
+    else
+    {
+      // type recursion. The offset of each member is measured in a real object,
+      // the same for all the objects of a standard-layout type
+      const T obj{};
+      const auto* base = reinterpret_cast<const unsigned char*>(&obj);   // NOLINT
+      bool valid = true;
+      auto func = [&](const char*, auto const& member) {
+        using MemberType = decltype(getPointerType(member));
+        const auto* member_ptr =
+            reinterpret_cast<const unsigned char*>(&(obj.*member));   // NOLINT
+        const auto member_offset = size_t(member_ptr - base);
+        valid = valid && GetMemoryRuns<MemberType>(offset + member_offset, runs);
+      };
+      TypeDefinition<T>().typeDef(func);
+      return valid;
+    }
+  }
+}
+
 template<typename T> inline
     CustomSerializerT<T>::CustomSerializerT(const std::string &type_name) : _name(type_name)
 {
@@ -172,6 +271,15 @@ template<typename T> inline
   {
     _fixed_size = 0;
   }
+#if SERIALIZE_LITTLEENDIAN == 1
+  // the numbers are serialized as they are stored in memory: use memcpy
+  if (is_fixed_size && !GetMemoryRuns<T>(0, _runs))
+  {
+    _runs.clear();
+  }
+  _contiguous = (_runs.size() == 1 && _runs.front().offset == 0 &&
+                 _runs.front().size == sizeof(T));
+#endif
 }
 
 template<typename T> inline
@@ -200,10 +308,61 @@ bool CustomSerializerT<T>::isFixedSize() const
 template<typename T> inline
 void CustomSerializerT<T>::serialize(const void *src_instance, SerializeMe::SpanBytes &dst_buffer) const
 {
+  if (!_runs.empty())
+  {
+    if (_fixed_size > dst_buffer.size())
+    {
+      throw std::runtime_error("SerializeIntoBuffer: buffer overflow");
+    }
+    const auto* src = static_cast<const uint8_t*>(src_instance);
+    if (_contiguous)
+    {
+      // size known at compile time: the memcpy is inlined
+      std::memcpy(dst_buffer.data(), src, sizeof(T));
+      dst_buffer.trimFront(sizeof(T));
+      return;
+    }
+    for (const auto& run : _runs)
+    {
+      std::memcpy(dst_buffer.data(), src + run.offset, run.size);
+      dst_buffer.trimFront(run.size);
+    }
+    return;
+  }
   const auto* obj = static_cast<const T*>(src_instance);
   SerializeMe::SerializeIntoBuffer(dst_buffer, *obj);
 }
 
+template<typename T> inline
+void CustomSerializerT<T>::serializeArray(const void *first_instance, size_t count,
+                                          size_t stride,
+                                          SerializeMe::SpanBytes &dst_buffer) const
+{
+  if (stride != sizeof(T))
+  {
+    CustomSerializer::serializeArray(first_instance, count, stride, dst_buffer);
+    return;
+  }
+  if (_contiguous)
+  {
+    // the serialized objects are identical to the memory: a single memcpy
+    const size_t size = count * sizeof(T);
+    if (size > dst_buffer.size())
+    {
+      throw std::runtime_error("SerializeIntoBuffer: buffer overflow");
+    }
+    std::memcpy(dst_buffer.data(), first_instance, size);
+    dst_buffer.trimFront(size);
+    return;
+  }
+  // at least, avoid a virtual call for each object
+  const auto* objects = static_cast<const T*>(first_instance);
+  for (size_t i = 0; i < count; i++)
+  {
+    CustomSerializerT<T>::serialize(&objects[i], dst_buffer);
+  }
+}
+
 template <typename T>
 inline CustomSerializer::Ptr TypesRegistry::getSerializer()
 {
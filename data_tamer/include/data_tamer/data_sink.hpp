@@ -1,24 +1,51 @@
 #pragma once
 
 #include "data_tamer/types.hpp"
+#include "data_tamer/details/headroom_allocator.hpp"
 
+#include <array>
 #include <chrono>
 #include <condition_variable>
 #include <cstdint>
 #include <memory>
 #include <string>
 #include <string_view>
+#include <unordered_map>
 #include <vector>
 
 namespace DataTamer
 {
 
+class SinkExecutor;
+
 using ActiveMask = std::vector<uint8_t>;
-using PayloadVector = std::vector<uint8_t>;
+using PayloadVector = std::vector<uint8_t, HeadroomAllocator<uint8_t>>;
 
 bool GetBit(const ActiveMask& mask, size_t index);
 void SetBit(ActiveMask& mask, size_t index, bool val);
 
+struct Snapshot;
+
+/**
+ * @brief WriteMessageHeader writes, in the headroom of snapshot.payload (see
+ * HeadroomAllocator), the header of the message saved by MCAPSink:
+ *
+ *     [uint32 mask size][active_mask][uint32 payload size][payload]
+ *
+ * Called by LogChannel, once the snapshot is complete. It does nothing if
+ * the active mask is too large.
+ */
+void WriteMessageHeader(Snapshot& snapshot);
+
+/**
+ * @brief GetFramedMessage returns the message described in WriteMessageHeader,
+ * without copies, if its header is in front of the payload. Otherwise it
+ * returns nullptr (for instance, if the snapshot was modified afterwards).
+ *
+ * @param size   size of the message, i.e. header and payload
+ */
+const uint8_t* GetFramedMessage(const Snapshot& snapshot, size_t& size);
+
 struct Snapshot
 {
   std::string_view channel_name;
@@ -38,6 +65,138 @@ struct Snapshot
   PayloadVector payload;
 };
 
+/**
+ * @brief SnapshotPtr is the immutable, reference-counted handle to a Snapshot
+ * passed to all the sinks of a channel. The payload is never copied
+ * when the same snapshot is pushed to multiple sinks.
+ */
+using SnapshotPtr = std::shared_ptr<const Snapshot>;
+
+/**
+ * @brief SinkDecimation selects the snapshots of a channel that are pushed
+ * to a sink (see LogChannel::addDataSink). The other snapshots are never
+ * enqueued for that sink.
+ *
+ * If both the fields are used, a snapshot must satisfy both.
+ */
+struct SinkDecimation
+{
+  /// push one snapshot every `every_nth` (1 means all of them)
+  uint32_t every_nth = 1;
+
+  /// minimum time between the timestamps of two snapshots pushed (zero means no limit)
+  std::chrono::nanoseconds min_period = std::chrono::nanoseconds(0);
+};
+
+/**
+ * @brief OverflowPolicy tells DataSinkBase::pushSnapshot what to do when the
+ * queue of the sink is full (see QueueLimits).
+ */
+enum class OverflowPolicy
+{
+  /// the new snapshot is discarded
+  DROP_NEWEST,
+  /// the oldest snapshots in the queue are discarded, to make space for the new one.
+  /// The queue is FIFO only within each producer (see Lane): "oldest" means the
+  /// oldest of one producer, not necessarily of the whole queue.
+  /// They may belong to any channel pushing into the sink, not only the one of
+  /// the new snapshot (see SinkStatistics::channels_dropped)
+  DROP_OLDEST,
+  /// wait until there is space in the queue, for at most QueueLimits::block_timeout.
+  /// The snapshot is discarded if the timeout expires.
+  /// LogChannel waits with its mutex locked, i.e. registerValue, setEnabled etc. wait too;
+  /// the channels of a ChannelsRegistry wait also for each other (see sharedLane)
+  BLOCK,
+  /// push only one snapshot every N. N doubles every time the queue is full and it
+  /// is halved when the queue is less than half full
+  DECIMATE
+};
+
+/**
+ * @brief QueueLimits limits the memory used by the queue of a sink
+ * (see DataSinkBase::setQueueLimits).
+ * A queue is full when either of the limits is reached; zero means no limit.
+ */
+struct QueueLimits
+{
+  /// maximum number of snapshots in the queue
+  size_t max_snapshots = 0;
+
+  /// maximum size of the snapshots in the queue (payload and active mask)
+  size_t max_bytes = 0;
+
+  OverflowPolicy policy = OverflowPolicy::DROP_NEWEST;
+
+  /// used only by OverflowPolicy::BLOCK
+  std::chrono::microseconds block_timeout = std::chrono::milliseconds(1);
+};
+
+/**
+ * @brief DropCounters counts the snapshots pushed to a sink that were never stored,
+ * because its queue was full.
+ *
+ * Each discarded snapshot makes the sink call requestKeyframe(). With
+ * PayloadEncoding::DELTA, the delta frames following a discarded one, that were
+ * already in the queue, can't be decoded: DataTamerParser detects the gap and
+ * skips them, until the next keyframe.
+ */
+struct DropCounters
+{
+  /// discarded by pushSnapshot (DROP_NEWEST, or BLOCK after the timeout)
+  uint64_t rejected = 0;
+
+  /// removed from the queue (DROP_OLDEST)
+  uint64_t evicted = 0;
+
+  /// skipped by DECIMATE
+  uint64_t decimated = 0;
+
+  [[nodiscard]] uint64_t total() const
+  {
+    return rejected + evicted + decimated;
+  }
+};
+
+/**
+ * @brief SinkStatistics is a snapshot of the counters of a sink
+ * (see DataSinkBase::statistics). Counters are cumulative, since the sink was created.
+ */
+struct SinkStatistics
+{
+  /// snapshots currently in the queue
+  size_t queue_depth = 0;
+
+  /// maximum value of queue_depth
+  size_t queue_high_water = 0;
+
+  /// snapshots accepted by pushSnapshot
+  uint64_t enqueued = 0;
+
+  /// snapshots passed to storeSnapshot. The sink released their buffers already
+  uint64_t stored = 0;
+
+  DropCounters dropped;
+
+  /// size of the snapshots accepted by pushSnapshot (payload and active mask)
+  uint64_t bytes_in = 0;
+
+  /// size of the snapshots passed to storeSnapshot
+  uint64_t bytes_out = 0;
+
+  /// Histogram of the duration of the calls of storeSnapshots (each call stores
+  /// a batch of snapshots). Element 0 counts the calls shorter than 1 microsecond,
+  /// element N the ones in the interval [2^(N-1), 2^N) microseconds;
+  /// the last element also includes the longer ones.
+  std::array<uint64_t, 24> store_latency = {};
+
+  /// number of snapshots stored, for each channel
+  std::unordered_map<std::string, uint64_t> channels;
+
+  /// number of snapshots discarded, for each channel (see DropCounters).
+  /// Only the first 256 channels that discarded a snapshot are listed
+  std::unordered_map<std::string, uint64_t> channels_dropped;
+};
+
 /**
  * @brief The DataSnapshot contains all the information passed by
  * LogChannel::takeSnapshot to a DataSink.
@@ -77,13 +236,113 @@ public:
 
   /**
    * @brief pushSnapshot will push the data into a concurrent queue,
-   * that a different thread will consume, using storeSnapshot()
+   * that a different thread will consume, using storeSnapshot().
+   *
+   * Only the handle is copied; the buffer is released once storeSnapshot()
+   * was called.
    *
    * @param snapshot see type Snapshot for details
    *
    * @return false if the queue is full and snapshot was not pushed
    */
-  virtual bool pushSnapshot(const Snapshot& snapshot);
+  virtual bool pushSnapshot(const SnapshotPtr& snapshot);
+
+  /// Same as above, but the snapshot is copied into a new buffer.
+  bool pushSnapshot(const Snapshot& snapshot);
+
+  /**
+   * @brief A Lane is a dedicated entry point to the queue of the sink, owned by a
+   * single producer. LogChannel creates one for each of its sinks.
+   *
+   * The snapshots pushed into a lane are kept in order, in a sub-queue that
+   * the producer does not share with the other lanes; the thread of the sink
+   * merges all of them.
+   * A Lane returned by createLane is not thread-safe: two threads must not push
+   * into the same lane at the same time (LogChannel pushes with its writeMutex()
+   * locked). See also sharedLane.
+   * A Lane must be destroyed before its sink.
+   */
+  struct Lane;
+
+  [[nodiscard]] std::shared_ptr<Lane> createLane();
+
+  /**
+   * @brief sharedLane is a Lane that many producers can use: pushSnapshot and
+   * pushSnapshots lock its mutex. ChannelsRegistry makes all its channels push
+   * into it, therefore takeSnapshotAll can push the snapshots of all the channels
+   * with a single pushSnapshots, still in order with those pushed by
+   * LogChannel::takeSnapshot.
+   */
+  [[nodiscard]] std::shared_ptr<Lane> sharedLane();
+
+  /**
+   * @brief Same as pushSnapshot, but using a lane created by this sink.
+   * The snapshots of a lane are stored in the order they were pushed.
+   */
+  virtual bool pushSnapshot(Lane& lane, const SnapshotPtr& snapshot);
+
+  /**
+   * @brief pushSnapshots pushes multiple snapshots into a lane. If the queue has no
+   * QueueLimits, they are pushed with a single operation on the queue; otherwise
+   * one by one, as pushSnapshot does.
+   *
+   * @return false if any snapshot was not pushed
+   */
+  virtual bool pushSnapshots(Lane& lane, const std::vector<SnapshotPtr>& snapshots);
+
+  /**
+   * @brief setSpinTime changes how the thread calling storeSnapshot() waits
+   * for new snapshots. When the queue is empty, it keeps checking it for
+   * `spin_time`, before going to sleep.
+   *
+   * A sleeping thread is woken up by pushSnapshot (a system call, in the thread
+   * of the producer). Spinning reduces the latency of the following snapshots,
+   * at the cost of CPU usage. Default: zero, i.e. sleep immediately.
+   */
+  void setSpinTime(std::chrono::microseconds spin_time);
+
+  /**
+   * @brief setExecutor makes the sink use the threads of a SinkExecutor, shared
+   * with other sinks, instead of its own thread. nullptr goes back to a
+   * dedicated thread.
+   *
+   * Call it before the sink is added to a channel: snapshots must not be
+   * pushed concurrently. setSpinTime has no effect on an executor.
+   */
+  void setExecutor(std::shared_ptr<SinkExecutor> executor);
+
+  /**
+   * @brief SetDefaultExecutor sets the executor used by all the sinks created
+   * afterwards (see setExecutor). Default: nullptr, each sink has its own thread.
+   * Not thread-safe: call it at startup.
+   */
+  static void SetDefaultExecutor(std::shared_ptr<SinkExecutor> executor);
+
+  /**
+   * @brief setQueueLimits bounds the queue between pushSnapshot and storeSnapshot,
+   * that would otherwise grow without limit if storeSnapshot is slower than the
+   * producers (for instance, when the disk stalls).
+   * By default, there is no limit.
+   */
+  void setQueueLimits(const QueueLimits& limits);
+
+  /// Number of snapshots discarded, since the sink was created
+  [[nodiscard]] DropCounters dropCounters() const;
+
+  /**
+   * @brief requestKeyframe asks the channels using PayloadEncoding::DELTA to
+   * encode their next snapshot as a keyframe, for instance when the sink
+   * starts a new file. Thread-safe, it can be called by storeSnapshot.
+   */
+  void requestKeyframe();
+
+  /// Number of times requestKeyframe was called. LogChannel compares it with
+  /// the value it saw at the previous snapshot
+  [[nodiscard]] uint64_t keyframeRequests() const;
+
+  /// Counters that tell if the sink is keeping up with the producers.
+  /// Reading them doesn't block the sink or the producers
+  [[nodiscard]] SinkStatistics statistics() const;
 
 protected:
   /**
@@ -95,6 +354,16 @@ protected:
    */
   virtual bool storeSnapshot(const Snapshot& snapshot) = 0;
 
+  /**
+   * @brief storeSnapshots is called with all the snapshots popped from the queue
+   * at once (up to 64), in order. The default implementation calls storeSnapshot
+   * for each of them; override it to pay for locks, clock checks or system
+   * calls once per batch.
+   *
+   * @return true if all of them were processed successfully
+   */
+  virtual bool storeSnapshots(const std::vector<SnapshotPtr>& snapshots);
+
   void stopThread();
 
 private:
@@ -18,8 +18,8 @@ public:
   static ChannelsRegistry& Global();
 
   /// Once added here, this sink will be automatically connected to
-  /// any new channel created with getChannel()
-  void addDefaultSink(std::shared_ptr<DataSinkBase> sink);
+  /// any new channel created with getChannel(). See LogChannel::addDataSink
+  void addDefaultSink(std::shared_ptr<DataSinkBase> sink, SinkDecimation decimation = {});
 
   /// Create a new channel or get a previously create one.
   [[nodiscard]] std::shared_ptr<LogChannel> getChannel(std::string const& channel_name);
@@ -27,6 +27,35 @@ public:
   /// remove all channels and stored sinks
   void clear();
 
+  /**
+   * @brief takeSnapshotAll takes a snapshot of all the channels, using the same timestamp.
+   *
+   * The channels are serialized in parallel by the threads created with
+   * setSnapshotThreads() and the calling thread. Then all the snapshots of a sink
+   * are pushed at once (see DataSinkBase::pushSnapshots).
+   *
+   * All the channels are locked for the duration of the call: a concurrent
+   * LogChannel::takeSnapshot waits until the batch is pushed.
+   *
+   * @return false if any snapshot was not pushed.
+   */
+  bool takeSnapshotAll(std::chrono::nanoseconds timestamp);
+
+  /// Same as above, the timestamp is provided by the Clock (see setClock).
+  bool takeSnapshotAll();
+
+  /**
+   * @brief setClock changes the Clock used by takeSnapshotAll() and by all the channels,
+   * including those created later (see LogChannel::setClock).
+   *
+   * It throws if any channel started recording already; in that case, no clock is changed.
+   */
+  void setClock(Clock::Ptr clock);
+
+  /// Number of additional threads used by takeSnapshotAll (default 0, i.e.
+  /// only the calling thread serializes the channels).
+  void setSnapshotThreads(size_t threads_count);
+
 private:
   struct Pimpl;
   std::unique_ptr<Pimpl> _p;
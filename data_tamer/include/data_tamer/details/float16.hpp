@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace DataTamer
+{
+
+// Conversions between float and the 16 bits formats BasicType::FLOAT16 (IEEE 754
+// binary16) and BasicType::BFLOAT16 (the 16 most significant bits of a float).
+// Rounding is to nearest even. There are no branches: loops using these functions
+// can be vectorized by the compiler.
+// Based on the public domain code of Fabian Giesen (https://gist.github.com/rygorous).
+
+inline uint16_t FloatToHalf(float value)
+{
+  uint32_t x;
+  std::memcpy(&x, &value, sizeof(x));
+  const uint32_t sign = (x >> 16) & 0x8000u;
+  x &= 0x7FFFFFFFu;
+
+  // normal numbers: adjust the exponent bias (127 -> 15) and round the mantissa
+  const uint32_t normal = (x + 0xC8000FFFu + ((x >> 13) & 1u)) >> 13;
+
+  // subnormal numbers: adding 0.5f, the FPU shifts and rounds the mantissa for us
+  float denormal_f;
+  std::memcpy(&denormal_f, &x, sizeof(x));
+  denormal_f += 0.5f;
+  uint32_t denormal;
+  std::memcpy(&denormal, &denormal_f, sizeof(denormal));
+  denormal -= 0x3F000000u;
+
+  // select with bit masks: the compiler does not always remove the branches of "?:".
+  // The sign bit is cleared, therefore signed comparisons can be used (faster in SSE2)
+  const auto abs_value = static_cast<int32_t>(x);
+  const uint32_t is_denormal = 0u - uint32_t(abs_value < 0x38800000);
+  const uint32_t is_inf = 0u - uint32_t(abs_value >= 0x47800000);   // too large for a half
+  const uint32_t is_nan = 0u - uint32_t(abs_value > 0x7F800000);
+  uint32_t result = (denormal & is_denormal) | (normal & ~is_denormal);
+  result = (0x7C00u & is_inf) | (result & ~is_inf);
+  result = (0x7E00u & is_nan) | (result & ~is_nan);
+  return static_cast<uint16_t>(result | sign);
+}
+
+/// Convert many values at once with FloatToHalf. The result, written in dst, has
+/// the size count * 2 bytes. The F16C instructions are used, if the CPU has them.
+void FloatToHalfArray(const float* values, size_t count, uint8_t* dst);
+
+/// Same as above. Each value is converted to float first.
+void FloatToHalfArray(const double* values, size_t count, uint8_t* dst);
+
+inline float HalfToFloat(uint16_t value)
+{
+  uint32_t x = uint32_t(value & 0x7FFFu) << 13;
+  const uint32_t exponent = x & 0x0F800000u;
+  // adjust the exponent bias (15 -> 127)
+  x += 0x38000000u;
+
+  if (exponent == 0x0F800000u)
+  {
+    // infinity or NaN
+    x += 0x38000000u;
+  }
+  else if (exponent == 0)
+  {
+    // zero or subnormal: renormalize
+    x += 0x00800000u;
+    float f;
+    std::memcpy(&f, &x, sizeof(f));
+    f -= 6.103515625e-05f;   // 2^-14
+    std::memcpy(&x, &f, sizeof(x));
+  }
+  x |= uint32_t(value & 0x8000u) << 16;
+  float result;
+  std::memcpy(&result, &x, sizeof(result));
+  return result;
+}
+
+inline uint16_t FloatToBFloat16(float value)
+{
+  uint32_t x;
+  std::memcpy(&x, &value, sizeof(x));
+  const uint32_t rounded = (x + 0x7FFFu + ((x >> 16) & 1u)) >> 16;
+  // NaN must not become infinity, when rounded
+  const uint32_t nan = (x >> 16) | 0x0040u;
+  const uint32_t is_nan = 0u - uint32_t(static_cast<int32_t>(x & 0x7FFFFFFFu) > 0x7F800000);
+  return static_cast<uint16_t>((nan & is_nan) | (rounded & ~is_nan));
+}
+
+inline float BFloat16ToFloat(uint16_t value)
+{
+  const uint32_t x = uint32_t(value) << 16;
+  float result;
+  std::memcpy(&result, &x, sizeof(result));
+  return result;
+}
+
+}   // namespace DataTamer
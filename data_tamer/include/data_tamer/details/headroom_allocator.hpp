@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+
+namespace DataTamer
+{
+
+/// Bytes available before the buffer of a PayloadVector (see HeadroomAllocator)
+static constexpr size_t kPayloadHeadroom = 128;
+
+/**
+ * @brief HeadroomAllocator is the allocator of PayloadVector: each buffer is
+ * preceded by kPayloadHeadroom bytes that the vector does not use.
+ *
+ * LogChannel writes there the header of the message saved by MCAPSink
+ * (see WriteMessageHeader), to save the complete message without copying
+ * the payload.
+ */
+template <typename T>
+struct HeadroomAllocator
+{
+  static_assert(kPayloadHeadroom % alignof(T) == 0, "Wrong alignment");
+
+  using value_type = T;
+
+  HeadroomAllocator() = default;
+
+  template <typename U>
+  HeadroomAllocator(const HeadroomAllocator<U>&)
+  {}
+
+  T* allocate(size_t n)
+  {
+    auto* ptr = static_cast<uint8_t*>(::operator new(n * sizeof(T) + kPayloadHeadroom));
+    // never read uninitialized memory in GetFramedMessage
+    std::memset(ptr, 0, kPayloadHeadroom);
+    return reinterpret_cast<T*>(ptr + kPayloadHeadroom);   // NOLINT
+  }
+
+  void deallocate(T* ptr, size_t)
+  {
+    ::operator delete(reinterpret_cast<uint8_t*>(ptr) - kPayloadHeadroom);   // NOLINT
+  }
+
+  template <typename U>
+  bool operator==(const HeadroomAllocator<U>&) const
+  {
+    return true;
+  }
+
+  template <typename U>
+  bool operator!=(const HeadroomAllocator<U>&) const
+  {
+    return false;
+  }
+};
+
+}   // namespace DataTamer
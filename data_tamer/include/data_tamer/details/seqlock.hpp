@@ -0,0 +1,90 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <type_traits>
+
+namespace DataTamer
+{
+/**
+ * @brief The SeqLock class stores a trivially copyable value that can be
+ * written without ever waiting for the readers (i.e. LogChannel::takeSnapshot).
+ *
+ * Readers copy the value and retry if a write happened in the meantime.
+ * Concurrent writers are serialized with a spin-lock on the sequence counter.
+ *
+ * It can be registered directly with LogChannel::registerValue or used
+ * through LoggedValue (see LoggedValueLock::SEQLOCK).
+ */
+template <typename T>
+class SeqLock
+{
+  static_assert(std::is_trivially_copyable_v<T>, "SeqLock requires a trivially "
+                                                 "copyable type");
+
+public:
+  SeqLock() = default;
+
+  explicit SeqLock(const T& value) : value_(value)
+  {}
+
+  SeqLock(const SeqLock&) = delete;
+  SeqLock& operator=(const SeqLock&) = delete;
+
+  /// Write a new value. Never waits for the readers.
+  void store(const T& value);
+
+  /// Read the last value stored.
+  [[nodiscard]] T load() const;
+
+private:
+  // odd while a writer is modifying value_
+  std::atomic<uint32_t> seq_ = 0;
+  T value_ = {};
+};
+
+//---------------------------------------------------------
+
+template <typename T>
+inline void SeqLock<T>::store(const T& value)
+{
+  uint32_t seq = seq_.load(std::memory_order_relaxed);
+  while (true)
+  {
+    if ((seq & 1) == 0 &&
+        seq_.compare_exchange_weak(seq, seq + 1, std::memory_order_acquire,
+                                   std::memory_order_relaxed))
+    {
+      break;
+    }
+    seq = seq_.load(std::memory_order_relaxed);
+  }
+  std::atomic_thread_fence(std::memory_order_release);
+  std::memcpy(&value_, &value, sizeof(T));
+  seq_.store(seq + 2, std::memory_order_release);
+}
+
+template <typename T>
+inline T SeqLock<T>::load() const
+{
+  T out;
+  while (true)
+  {
+    const uint32_t seq_before = seq_.load(std::memory_order_acquire);
+    if ((seq_before & 1) == 0)
+    {
+      std::memcpy(&out, &value_, sizeof(T));
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (seq_.load(std::memory_order_relaxed) == seq_before)
+      {
+        return out;
+      }
+    }
+    // a writer is active. It might have been preempted
+    std::this_thread::yield();
+  }
+}
+
+}   // namespace DataTamer
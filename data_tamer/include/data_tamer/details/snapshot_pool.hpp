@@ -0,0 +1,198 @@
+#pragma once
+
+#include "data_tamer/data_sink.hpp"
+#include "data_tamer/details/mutex.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace DataTamer
+{
+/**
+ * @brief The SnapshotPool class owns the buffers used by LogChannel::takeSnapshot.
+ *
+ * A buffer is shared by all the sinks of a channel and it is given back to the pool
+ * automatically when the last sink releases it. The memory allocated by the vectors
+ * inside Snapshot is therefore reused by the following snapshots.
+ *
+ * Also the control block of the std::shared_ptr is recycled: once the pool
+ * contains enough buffers, acquire() does not allocate any memory on the heap.
+ *
+ * The pool itself is kept alive by the buffers that are still in use.
+ */
+class SnapshotPool : public std::enable_shared_from_this<SnapshotPool>
+{
+protected:
+  SnapshotPool() = default;
+
+public:
+  static std::shared_ptr<SnapshotPool> create()
+  {
+    return std::shared_ptr<SnapshotPool>(new SnapshotPool());
+  }
+
+  ~SnapshotPool();
+
+  SnapshotPool(const SnapshotPool&) = delete;
+  SnapshotPool& operator=(const SnapshotPool&) = delete;
+
+  /// Get a buffer not used by anybody else. Note that it may contain
+  /// the data of a previous snapshot.
+  [[nodiscard]] std::shared_ptr<Snapshot> acquire();
+
+  /**
+   * @brief reserve makes sure that at least `count` buffers are available
+   * and that their vectors can store the given number of bytes without
+   * further allocations.
+   */
+  void reserve(size_t count, size_t mask_size, size_t payload_size);
+
+  /// Number of buffers that are currently not in use
+  [[nodiscard]] size_t availableCount();
+
+private:
+  // Used by std::shared_ptr to allocate its control block.
+  // It keeps the pool alive until the control block is deallocated.
+  template <typename T>
+  struct ControlBlockAllocator
+  {
+    using value_type = T;
+
+    std::shared_ptr<SnapshotPool> pool;
+
+    explicit ControlBlockAllocator(std::shared_ptr<SnapshotPool> p) : pool(std::move(p))
+    {}
+
+    template <typename U>
+    ControlBlockAllocator(const ControlBlockAllocator<U>& other) : pool(other.pool)
+    {}
+
+    T* allocate(size_t n)
+    {
+      static_assert(sizeof(T) <= kControlBlockSize, "increase kControlBlockSize");
+      return static_cast<T*>(pool->allocateBlock(n * sizeof(T)));
+    }
+
+    void deallocate(T* ptr, size_t n)
+    {
+      pool->deallocateBlock(ptr, n * sizeof(T));
+    }
+
+    template <typename U>
+    bool operator==(const ControlBlockAllocator<U>& other) const
+    {
+      return pool == other.pool;
+    }
+    template <typename U>
+    bool operator!=(const ControlBlockAllocator<U>& other) const
+    {
+      return pool != other.pool;
+    }
+  };
+
+  static constexpr size_t kControlBlockSize = 128;
+
+  Mutex mutex_;
+  std::vector<std::unique_ptr<Snapshot>> free_buffers_;
+  std::vector<void*> free_blocks_;
+  size_t buffers_count_ = 0;
+
+  void release(Snapshot* snapshot);
+  void* allocateBlock(size_t size);
+  void deallocateBlock(void* block, size_t size);
+};
+
+//---------------------------------------------------------
+
+inline SnapshotPool::~SnapshotPool()
+{
+  for (void* block : free_blocks_)
+  {
+    ::operator delete(block);
+  }
+}
+
+inline std::shared_ptr<Snapshot> SnapshotPool::acquire()
+{
+  std::unique_ptr<Snapshot> buffer;
+  {
+    std::scoped_lock lk(mutex_);
+    if (!free_buffers_.empty())
+    {
+      buffer = std::move(free_buffers_.back());
+      free_buffers_.pop_back();
+    }
+    else
+    {
+      buffers_count_++;
+    }
+  }
+  if (!buffer)
+  {
+    buffer = std::make_unique<Snapshot>();
+  }
+  auto deleter = [this](Snapshot* ptr) { release(ptr); };
+  return std::shared_ptr<Snapshot>(buffer.release(), deleter,
+                                   ControlBlockAllocator<Snapshot>(shared_from_this()));
+}
+
+inline void SnapshotPool::reserve(size_t count, size_t mask_size, size_t payload_size)
+{
+  std::scoped_lock lk(mutex_);
+  while (buffers_count_ < count)
+  {
+    free_buffers_.push_back(std::make_unique<Snapshot>());
+    buffers_count_++;
+  }
+  for (auto& buffer : free_buffers_)
+  {
+    buffer->active_mask.reserve(mask_size);
+    buffer->payload.reserve(payload_size);
+  }
+  // make sure that release() will not need to allocate memory
+  free_buffers_.reserve(buffers_count_);
+  free_blocks_.reserve(buffers_count_);
+}
+
+inline size_t SnapshotPool::availableCount()
+{
+  std::scoped_lock lk(mutex_);
+  return free_buffers_.size();
+}
+
+inline void SnapshotPool::release(Snapshot* snapshot)
+{
+  std::scoped_lock lk(mutex_);
+  free_buffers_.emplace_back(snapshot);
+}
+
+inline void* SnapshotPool::allocateBlock(size_t size)
+{
+  {
+    std::scoped_lock lk(mutex_);
+    if (size <= kControlBlockSize && !free_blocks_.empty())
+    {
+      void* block = free_blocks_.back();
+      free_blocks_.pop_back();
+      return block;
+    }
+  }
+  return ::operator new(std::max(size, kControlBlockSize));
+}
+
+inline void SnapshotPool::deallocateBlock(void* block, size_t size)
+{
+  if (size > kControlBlockSize)
+  {
+    ::operator delete(block);
+    return;
+  }
+  std::scoped_lock lk(mutex_);
+  free_blocks_.push_back(block);
+}
+
+}   // namespace DataTamer
@@ -0,0 +1,257 @@
+#pragma once
+
+#include <cmath>
+#include <array>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <type_traits>
+
+#include "data_tamer/custom_types.hpp"
+#include "data_tamer/types.hpp"
+#include "data_tamer/details/float16.hpp"
+
+namespace DataTamer
+{
+
+/**
+ * @brief Option of LogChannel::registerValue: a floating point value (or a vector/array
+ * of them) is saved as an integer of type IntType:
+ *
+ *     saved = round((value - offset) / scale)
+ *
+ * Values outside the range of IntType are saturated. NaN is saved as zero.
+ * The scale and the offset are written in the Schema (see TypeField::quantization),
+ * DataTamerParser returns the decoded value `offset + scale * saved`.
+ */
+template <typename IntType>
+struct Quantized
+{
+  /// resolution of the saved value
+  double scale = 1.0;
+  double offset = 0.0;
+};
+
+namespace details
+{
+// T itself or, if T is a container, the type of its elements
+template <typename T>
+struct ElementType
+{
+  using type = T;
+};
+
+template <template <class, class> class Container, class T, class... TArgs>
+struct ElementType<Container<T, TArgs...>>
+{
+  using type = T;
+};
+
+template <typename T, size_t N>
+struct ElementType<std::array<T, N>>
+{
+  using type = T;
+};
+}   // namespace details
+
+/**
+ * @brief QuantizedSerializer converts Float to IntType, as described in Quantized.
+ * Used by LogChannel::registerValue.
+ */
+template <typename Float, typename IntType>
+class QuantizedSerializer : public CustomSerializer
+{
+public:
+  static_assert(std::is_floating_point_v<Float>, "Only floating point values can be "
+                                                 "quantized");
+  static_assert(std::is_integral_v<IntType> && !std::is_same_v<IntType, bool> &&
+                    !std::is_same_v<IntType, char>,
+                "Quantized values are saved as integers");
+
+  explicit QuantizedSerializer(Quantization quantization);
+
+  const std::string& typeName() const override
+  {
+    return ToStr(GetBasicType<IntType>());
+  }
+
+  size_t serializedSize(const void*) const override
+  {
+    return sizeof(IntType);
+  }
+
+  bool isFixedSize() const override
+  {
+    return true;
+  }
+
+  void serialize(const void* instance, SerializeMe::SpanBytes& buffer) const override;
+
+  void serializeArray(const void* first_instance, size_t count, size_t stride,
+                      SerializeMe::SpanBytes& buffer) const override;
+
+  [[nodiscard]] const Quantization& quantization() const
+  {
+    return _quantization;
+  }
+
+  [[nodiscard]] IntType quantize(Float value) const;
+
+private:
+  Quantization _quantization;
+  // computed in double precision, whatever Float is
+  double _inv_scale = 1.0;
+  double _min_value = 0;
+  double _max_value = 0;
+};
+
+/**
+ * @brief HalfFloatSerializer saves float or double as BasicType::FLOAT16 or
+ * BasicType::BFLOAT16. Used by LogChannel::registerValue.
+ *
+ * A double is converted to float first.
+ */
+template <typename Float, BasicType Type>
+class HalfFloatSerializer : public CustomSerializer
+{
+public:
+  static_assert(std::is_floating_point_v<Float>, "Only floating point values can be "
+                                                 "saved as FLOAT16 or BFLOAT16");
+  static_assert(Type == BasicType::FLOAT16 || Type == BasicType::BFLOAT16,
+                "Wrong BasicType");
+
+  const std::string& typeName() const override
+  {
+    return ToStr(Type);
+  }
+
+  size_t serializedSize(const void*) const override
+  {
+    return sizeof(uint16_t);
+  }
+
+  bool isFixedSize() const override
+  {
+    return true;
+  }
+
+  void serialize(const void* instance, SerializeMe::SpanBytes& buffer) const override
+  {
+    const uint16_t saved = convert(*static_cast<const Float*>(instance));
+    SerializeMe::SerializeIntoBuffer(buffer, saved);
+  }
+
+  void serializeArray(const void* first_instance, size_t count, size_t stride,
+                      SerializeMe::SpanBytes& buffer) const override;
+
+  [[nodiscard]] static uint16_t convert(Float value)
+  {
+    if constexpr (Type == BasicType::FLOAT16)
+    {
+      return FloatToHalf(static_cast<float>(value));
+    }
+    else
+    {
+      return FloatToBFloat16(static_cast<float>(value));
+    }
+  }
+};
+
+//------------------------------------------------------------------
+//------------------------------------------------------------------
+//------------------------------------------------------------------
+
+template <typename Float, typename IntType>
+inline QuantizedSerializer<Float, IntType>::QuantizedSerializer(Quantization quantization) :
+  _quantization(quantization)
+{
+  if (!(quantization.scale > 0) || !std::isfinite(quantization.scale) ||
+      !std::isfinite(quantization.offset))
+  {
+    throw std::runtime_error("Quantization: scale must be positive and finite");
+  }
+  _inv_scale = 1.0 / quantization.scale;
+  _min_value = double(std::numeric_limits<IntType>::min());
+  // the largest double not greater than max() (64 bits integers are not exact)
+  _max_value = std::nextafter(double(std::numeric_limits<IntType>::max()), 0.0);
+}
+
+template <typename Float, typename IntType>
+inline IntType QuantizedSerializer<Float, IntType>::quantize(Float value) const
+{
+  // branchless, to let the compiler vectorize serializeArray()
+  double scaled = (double(value) - _quantization.offset) * _inv_scale;
+  scaled = (scaled != scaled) ? 0.0 : scaled;   // NaN
+  scaled = std::min(std::max(scaled, _min_value), _max_value);
+  scaled += (scaled >= 0.0) ? 0.5 : -0.5;
+  return static_cast<IntType>(scaled);
+}
+
+template <typename Float, typename IntType>
+inline void QuantizedSerializer<Float, IntType>::serialize(const void* instance,
+                                                           SerializeMe::SpanBytes& buffer) const
+{
+  const IntType saved = quantize(*static_cast<const Float*>(instance));
+  SerializeMe::SerializeIntoBuffer(buffer, saved);
+}
+
+template <typename Float, typename IntType>
+inline void QuantizedSerializer<Float, IntType>::serializeArray(
+    const void* first_instance, size_t count, size_t stride,
+    SerializeMe::SpanBytes& buffer) const
+{
+  if (stride != sizeof(Float))
+  {
+    CustomSerializer::serializeArray(first_instance, count, stride, buffer);
+    return;
+  }
+  const size_t size = count * sizeof(IntType);
+  if (size > buffer.size())
+  {
+    throw std::runtime_error("SerializeIntoBuffer: buffer overflow");
+  }
+  const auto* values = static_cast<const Float*>(first_instance);
+  uint8_t* dst = buffer.data();
+  // simple loop, auto-vectorized by the compiler
+  for (size_t i = 0; i < count; i++)
+  {
+    const IntType saved = quantize(values[i]);
+    std::memcpy(dst + i * sizeof(IntType), &saved, sizeof(IntType));
+  }
+  buffer.trimFront(size);
+}
+
+template <typename Float, BasicType Type>
+inline void HalfFloatSerializer<Float, Type>::serializeArray(
+    const void* first_instance, size_t count, size_t stride,
+    SerializeMe::SpanBytes& buffer) const
+{
+  if (stride != sizeof(Float))
+  {
+    CustomSerializer::serializeArray(first_instance, count, stride, buffer);
+    return;
+  }
+  const size_t size = count * sizeof(uint16_t);
+  if (size > buffer.size())
+  {
+    throw std::runtime_error("SerializeIntoBuffer: buffer overflow");
+  }
+  const auto* values = static_cast<const Float*>(first_instance);
+  uint8_t* dst = buffer.data();
+  if constexpr (Type == BasicType::FLOAT16)
+  {
+    FloatToHalfArray(values, count, dst);
+  }
+  else
+  {
+    // simple loop, auto-vectorized by the compiler
+    for (size_t i = 0; i < count; i++)
+    {
+      const uint16_t saved = convert(values[i]);
+      std::memcpy(dst + i * sizeof(uint16_t), &saved, sizeof(uint16_t));
+    }
+  }
+  buffer.trimFront(size);
+}
+
+}   // namespace DataTamer
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace DataTamer
+{
+
+/// Scheduling policy of the threads of a SinkExecutor (see sched(7))
+enum class SchedPolicy
+{
+  OTHER,
+  BATCH,
+  IDLE,
+  FIFO,
+  RR
+};
+
+struct SinkExecutorOptions
+{
+  size_t threads_count = 1;
+
+  /// CPUs where the threads can run. Empty means all of them
+  std::vector<int> cpu_affinity;
+
+  SchedPolicy policy = SchedPolicy::OTHER;
+
+  /// used only by SchedPolicy::FIFO and SchedPolicy::RR
+  int priority = 0;
+
+  /// niceness, used only by SchedPolicy::OTHER and SchedPolicy::BATCH
+  int nice = 0;
+};
+
+/**
+ * @brief SinkExecutor is a pool of threads that can be shared by many sinks
+ * (see DataSinkBase::setExecutor), instead of having a thread for each of them.
+ *
+ * The threads can be pinned to some CPUs and use a given scheduling policy,
+ * to keep the recording away from the real-time threads of the application.
+ * The snapshots of a sink are stored by a single thread at a time.
+ *
+ * CPU affinity, policy and niceness are supported only on Linux.
+ */
+class SinkExecutor
+{
+public:
+  /// Throws if the options can not be applied (for instance, if the process
+  /// doesn't have the permission to use SchedPolicy::FIFO)
+  explicit SinkExecutor(const SinkExecutorOptions& options = {});
+
+  ~SinkExecutor();
+
+  SinkExecutor(const SinkExecutor&) = delete;
+  SinkExecutor& operator=(const SinkExecutor&) = delete;
+
+  SinkExecutor(SinkExecutor&&) = delete;
+  SinkExecutor& operator=(SinkExecutor&&) = delete;
+
+  [[nodiscard]] const SinkExecutorOptions& options() const;
+
+  /// Work executed by the threads of the executor
+  class Task
+  {
+  public:
+    virtual ~Task() = default;
+
+    /// @return true if the task must be scheduled again
+    virtual bool run() = 0;
+  };
+
+  /// The task will be executed by one of the threads. Lock-free.
+  void schedule(const std::shared_ptr<Task>& task);
+
+private:
+  struct Pimpl;
+  std::unique_ptr<Pimpl> _p;
+};
+
+}   // namespace DataTamer
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "data_tamer/data_sink.hpp"
+
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace DataTamer
+{
+
+/**
+ * @brief The ColumnarSink saves the snapshots in a compact file format, where
+ * the values of each series are stored together (columns) and compressed:
+ *
+ * - timestamps: delta-of-delta, saved as zig-zag varints;
+ * - float and double: XOR with the previous value (as in Facebook's Gorilla);
+ * - integers: delta with the previous value, saved as zig-zag varints;
+ * - bools: one bit each.
+ *
+ * The snapshots of each channel are transposed into blocks of `block_rows`
+ * snapshots. Since a block is written only when it is full (or when the
+ * recording is stopped), the last snapshots may be lost if the application crashes.
+ *
+ * The layout of the payload is computed once per channel, in addChannel; custom types
+ * defined with TypeDefinition are split into one series per field. Custom types with
+ * their own encoding (see CustomSerializer::typeSchema) can't be split: addChannel
+ * prints an error and the snapshots of that channel are ignored.
+ *
+ * The compression depends on the data. Timestamps at a regular rate, counters, bools
+ * and slowly changing values take a byte or less each, but a double that changes at
+ * every snapshot keeps most of its 8 bytes. In the ColumnarSink test, with a mix of
+ * both, the file is 2.7 times smaller than the raw payloads, far from a 10x
+ * reduction.
+ *
+ * Use DataTamerParser::ColumnarReader to read the file.
+ * The format is described in data_tamer_parser/columnar_reader.hpp.
+ */
+class ColumnarSink : public DataSinkBase
+{
+public:
+  /**
+   * @param filepath    path of the file to be saved. Should have extension ".dtc"
+   * @param block_rows  number of snapshots of a channel saved in a single block.
+   */
+  explicit ColumnarSink(std::string const& filepath, size_t block_rows = 1024);
+
+  ~ColumnarSink() override;
+
+  void addChannel(std::string const& channel_name, Schema const& schema) override;
+
+  bool storeSnapshot(const Snapshot& snapshot) override;
+
+  bool storeSnapshots(const std::vector<SnapshotPtr>& snapshots) override;
+
+  /// Write the blocks that are not complete yet, the DropCounters of the sink,
+  /// and close the file
+  void stopRecording();
+
+private:
+  struct ChannelBuffer;
+
+  std::string filepath_;
+  size_t block_rows_;
+  std::ofstream file_;
+  std::unordered_map<uint64_t, std::unique_ptr<ChannelBuffer>> channels_;
+  std::mutex mutex_;
+
+  void writeRecord(const std::vector<uint8_t>& record);
+  void flushBlock(ChannelBuffer& channel);
+  // mutex_ must be locked
+  bool appendSnapshot(const Snapshot& snapshot);
+};
+
+}   // namespace DataTamer
@@ -0,0 +1,137 @@
+#pragma once
+
+#include "data_tamer/clock.hpp"
+#include "data_tamer/data_sink.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace DataTamer
+{
+
+/**
+ * @brief The FlightRecorderSink keeps the most recent snapshots in memory
+ * and saves them into an MCAP file only when trigger() is called.
+ *
+ * The memory is allocated once in the constructor; the oldest snapshots
+ * are discarded when it is full.
+ *
+ * With PayloadEncoding::DELTA, discarding a keyframe makes the following delta
+ * frames of that channel useless: the sink calls requestKeyframe(), and the file
+ * starts from the oldest keyframe of each channel.
+ *
+ * The file contains the snapshots received before the trigger (as many as the
+ * memory allows) and those received in the following `post_trigger_window`.
+ * It is written by a separate thread, therefore neither the producers nor
+ * this sink need to wait. The records are written straight from memory, without
+ * copies: until they are saved, they are not overwritten. If the memory is full
+ * in the meantime, the new snapshots are discarded (and a keyframe is requested).
+ */
+class FlightRecorderSink : public DataSinkBase
+{
+public:
+  /**
+   * @param max_bytes            memory used to store the snapshots.
+   * @param post_trigger_window  snapshots received after trigger() that are
+   *                             also saved into the file.
+   * @param clock                clock used by the channels (see LogChannel::setClock).
+   *                             If null, SystemClock.
+   */
+  explicit FlightRecorderSink(
+      size_t max_bytes,
+      std::chrono::nanoseconds post_trigger_window = std::chrono::nanoseconds(0),
+      Clock::Ptr clock = {});
+
+  ~FlightRecorderSink() override;
+
+  void addChannel(std::string const& channel_name, Schema const& schema) override;
+
+  bool storeSnapshot(const Snapshot& snapshot) override;
+
+  bool storeSnapshots(const std::vector<SnapshotPtr>& snapshots) override;
+
+  /**
+   * @brief trigger saves the snapshots into an MCAP file, once the post-trigger window
+   * is over, i.e. when we receive a snapshot with timestamp greater than
+   * (trigger_time + post_trigger_window) or when the clock passed to the constructor
+   * reaches that time.
+   *
+   * @param filepath        path of the file to be saved. Should have extension ".mcap"
+   * @param do_compression  if true, compress the data.
+   * @param trigger_time    time of the trigger, in the same clock used by the snapshots.
+   *
+   * @return false if the file of the previous trigger was not saved yet.
+   */
+  bool trigger(std::string const& filepath, bool do_compression,
+               std::chrono::nanoseconds trigger_time);
+
+  /// Same as above, the time of the trigger is the current time of the clock.
+  bool trigger(std::string const& filepath, bool do_compression = false);
+
+  /// True if the file requested with trigger() was not saved yet.
+  [[nodiscard]] bool isDumping();
+
+  /// Block until the file requested with trigger() is saved.
+  void waitDump();
+
+  /// Number of snapshots currently in memory.
+  [[nodiscard]] size_t bufferedSnapshots();
+
+  /// Bytes currently used, never larger than max_bytes.
+  [[nodiscard]] size_t bufferedBytes();
+
+private:
+  // followed by the message saved into the MCAP file (see WriteMessageHeader)
+  struct RecordHeader
+  {
+    uint64_t schema_hash;
+    int64_t timestamp;
+    uint32_t mask_size;
+    uint32_t payload_size;
+  };
+
+  std::vector<uint8_t> ring_;
+  // position of the oldest record and of the next one
+  size_t head_ = 0;
+  size_t tail_ = 0;
+  size_t used_bytes_ = 0;
+  size_t records_count_ = 0;
+
+  std::unordered_map<uint64_t, std::pair<std::string, Schema>> schemas_;
+
+  std::chrono::nanoseconds post_trigger_window_;
+  Clock::Ptr clock_;
+  bool triggered_ = false;
+  std::chrono::nanoseconds dump_end_time_ = {};
+  // true when a snapshot with timestamp >= dump_end_time_ was received
+  bool window_complete_ = false;
+
+  // The records being saved by dumpToFile, starting from the oldest one, can't
+  // be dropped until dump_read_ (bytes written into the file) covers them
+  bool dumping_ = false;
+  size_t dump_size_ = 0;
+  size_t dump_read_ = 0;
+  // bytes dropped since the beginning of the dump
+  size_t dump_dropped_ = 0;
+
+  std::mutex mutex_;
+  std::condition_variable window_cv_;
+  // serializes trigger() and waitDump()
+  std::mutex trigger_mutex_;
+  std::thread dump_thread_;
+
+  void writeRing(const void* src, size_t size);
+  void readRing(size_t offset, void* dst, size_t size) const;
+  // mutex_ must be locked. False if the oldest record is still to be saved
+  bool dropOldestRecord();
+  // mutex_ must be locked
+  bool appendRecord(const Snapshot& snapshot);
+  void dumpToFile(std::string const& filepath, bool do_compression);
+};
+
+}   // namespace DataTamer
@@ -8,6 +8,7 @@
 #include <mutex>
 #include <thread>
 #include <unordered_map>
+#include <unordered_set>
 
 // Forward declaration
 namespace mcap
@@ -18,6 +19,15 @@ class McapWriter;
 namespace DataTamer
 {
 
+/// Open an MCAP file with the options used by MCAPSink. It throws on failure
+std::unique_ptr<mcap::McapWriter> OpenMCAPWriter(std::string const& filepath,
+                                                 bool do_compression);
+
+/// Register the schema and the channel into the file, as MCAPSink does.
+/// Returns the id of the channel
+uint16_t AddMCAPChannel(mcap::McapWriter& writer, std::string const& channel_name,
+                        Schema const& schema);
+
 /**
  * @brief The MCAPSink is an implementation of DataSinkBase that
  * will save the data as MCAP file (https://mcap.dev/)
@@ -42,11 +52,51 @@ public:
 
   bool storeSnapshot(const Snapshot& snapshot) override;
 
+  /// Same as storeSnapshot, but the mutex is locked and the reset time is checked
+  /// once per batch
+  bool storeSnapshots(const std::vector<SnapshotPtr>& snapshots) override;
+
   /// After a certain amount of time, the MCAP file will be reset
-  /// and overwritten. Default value is 600 seconds (10 minutes)
+  /// and overwritten. Default value is 600 seconds (10 minutes).
+  /// Same as changing RotationOptions::max_duration
   void setMaxTimeBeforeReset(std::chrono::seconds reset_time);
 
-  /// Stop recording and save the file
+  struct RotationOptions
+  {
+    /// start a new file after this time. Zero means never
+    std::chrono::seconds max_duration = std::chrono::seconds(60 * 10);
+
+    /// start a new file once the messages written in the current one are
+    /// larger than this (size before compression). Zero means no limit
+    uint64_t max_file_size = 0;
+
+    /// path of the new files, where "{index}" is replaced by the number of
+    /// the file (1 for the first rotation); setRotation throws if it is missing.
+    /// If empty, the current file
+    /// is overwritten: the new one is written as "<filepath>.part" and it
+    /// replaces the previous one once that is closed (on Windows, where an open
+    /// file can't be renamed, the previous file is closed synchronously instead)
+    std::string file_pattern;
+
+    /// maximum number of files kept on disk: the oldest ones are deleted.
+    /// Zero means no limit
+    size_t max_files = 0;
+  };
+
+  /**
+   * @brief setRotation changes when and how the sink starts a new file.
+   *
+   * The previous file is closed by a background thread (see restartRecording),
+   * therefore the sink keeps storing the snapshots in the meantime.
+   *
+   * Each file can be parsed on its own: the sink asks the channels for a keyframe
+   * (see DataSinkBase::requestKeyframe) and doesn't write the delta frames of a
+   * channel into the new file until its keyframe arrives.
+   */
+  void setRotation(const RotationOptions& options);
+
+  /// Stop recording and save the file.
+  /// The DropCounters of the sink are saved in the file as the metadata "data_tamer_dropped".
   void stopRecording();
 
   /**
@@ -54,11 +104,40 @@ public:
    * calling stopRecording) and start recording into a new one.
    * Note that all the registered channels and their schemas will be copied into the new file.
    *
+   * The current file is finalized (last chunk, summary and index) by a
+   * background thread, unless the new file has the same path.
+   * As in setRotation, the new file starts with a keyframe of each channel.
+   *
    * @param filepath   file path of the new file (should be ".mcap" extension)
    * @param do_compression if true, compress the data on the fly.
    */
   void restartRecording(std::string const& filepath, bool do_compression = false);
 
+  /// Wait until the background thread finished saving the previous files.
+  /// Called by stopRecording and by the destructor.
+  void waitPendingFiles();
+
+  struct WriterStatistics
+  {
+    /// time spent writing messages into the MCAP writer. When compression
+    /// is enabled, it includes the compression of the chunks
+    std::chrono::nanoseconds write_time = {};
+
+    /// messages written, in all the files
+    uint64_t messages = 0;
+
+    /// size of the current file
+    uint64_t file_size = 0;
+
+    /// delta frames not written at the beginning of a new file, before the
+    /// keyframe of their channel (see setRotation)
+    uint64_t skipped_frames = 0;
+  };
+
+  /// Statistics of the MCAP writer, in addition to DataSinkBase::statistics().
+  /// Reading them doesn't block the sink
+  [[nodiscard]] WriterStatistics writerStatistics() const;
+
 private:
   std::string filepath_;
   bool compression_ = false;
@@ -67,13 +146,62 @@ private:
   std::unordered_map<uint64_t, uint16_t> hash_to_channel_id_;
   std::unordered_map<std::string, Schema> schemas_;
 
-  std::chrono::seconds reset_time_ = std::chrono::seconds(60 * 10);
+  RotationOptions rotation_;
   std::chrono::system_clock::time_point start_time_;
+  uint64_t file_bytes_ = 0;
+  size_t file_index_ = 0;
+  // files opened by the sink, the oldest first
+  std::deque<std::string> files_;
 
   bool forced_stop_recording_ = false;
   std::recursive_mutex mutex_;
 
+  std::atomic<int64_t> write_time_ns_ = 0;
+  std::atomic<uint64_t> messages_ = 0;
+  std::atomic<uint64_t> file_size_ = 0;
+  std::atomic<uint64_t> skipped_frames_ = 0;
+
+  // channels using PayloadEncoding::DELTA that didn't write a keyframe
+  // into the current file yet (key: schema hash)
+  std::unordered_set<uint64_t> awaiting_keyframe_;
+
+  // writers closed by the finalizer thread, files to delete or to rename
+  struct PendingFile
+  {
+    std::unique_ptr<mcap::McapWriter> writer;
+    std::string filepath;
+    // if not empty and writer is nullptr, filepath is renamed to this
+    std::string rename_to;
+  };
+  std::deque<PendingFile> pending_files_;
+  bool stop_finalizer_ = false;
+  std::mutex finalizer_mutex_;
+  std::condition_variable finalizer_cv_;
+  std::thread finalizer_thread_;
+
   void openFile(std::string const& filepath);
+
+  // add the file to files_, deleting the oldest ones beyond RotationOptions::max_files
+  void trackFile(std::string const& filepath);
+
+  // add the channels to the new file, and wait for their keyframes
+  void rebuildChannels();
+
+  // rotation with an empty RotationOptions::file_pattern
+  void overwriteFile();
+
+  // wait, if the file is still to be closed, renamed or deleted by the finalizer
+  void waitPendingFile(std::string const& filepath);
+
+  void writeDropCounters();
+
+  void writeSnapshot(const Snapshot& snapshot);
+
+  void checkRotation();
+
+  void addPendingFile(PendingFile&& file);
+
+  void stopFinalizer();
 };
 
 }   // namespace DataTamer
@@ -3,6 +3,7 @@
 #include <cstdint>
 #include <memory>
 
+#include <optional>
 #include <ostream>
 #include <string>
 #include <unordered_map>
@@ -12,7 +13,9 @@
 namespace DataTamer
 {
 
-constexpr int SCHEMA_VERSION = 4;
+// Since version 6, the bools are bit-packed in the payload (see LogChannel).
+// Since version 7, the delta frames are numbered (see PayloadEncoding)
+constexpr int SCHEMA_VERSION = 7;
 
 // clang-format off
 enum class BasicType
@@ -33,10 +36,16 @@ enum class BasicType
 
   FLOAT32,
   FLOAT64,
-  OTHER
+  OTHER,
+
+  // added in SCHEMA_VERSION 5, after OTHER to keep the hash of the older schemas.
+  // Saved using LogChannel::registerValue(name, value, saved_type), they are
+  // deserialized as float.
+  FLOAT16,
+  BFLOAT16
 };
 
-constexpr size_t TypesCount = 13;
+constexpr size_t TypesCount = 15;
 
 
 using VarNumber = std::variant<
@@ -102,6 +111,13 @@ struct RegistrationID
   }
 };
 
+/// A floating point value saved as an integer: value = offset + scale * saved_integer
+struct Quantization
+{
+  double scale = 1.0;
+  double offset = 0.0;
+};
+
 //---------------------------------------------------------
 struct TypeField
 {
@@ -110,6 +126,8 @@ struct TypeField
   std::string type_name;
   bool is_vector = 0;
   uint32_t array_size = 0;
+  /// if set, the field is an integer encoding a floating point value
+  std::optional<Quantization> quantization;
 
   bool operator==(const TypeField& other) const;
   bool operator!=(const TypeField& other) const;
@@ -120,6 +138,27 @@ struct TypeField
 using FieldsVector = std::vector<TypeField>;
 class CustomSerializer;
 
+/// How the payload of the snapshots of a channel is encoded
+enum class PayloadEncoding
+{
+  /// all the enabled values are serialized in each snapshot
+  PLAIN,
+  /// the first byte of the payload is either kKeyframe or kDeltaFrame, followed
+  /// by the index of the frame (uint32_t, incremented by each snapshot of the channel).
+  /// A keyframe is followed by all the enabled values, as in PLAIN.
+  /// A delta frame contains a bitmask (same size as the ActiveMask), flagging
+  /// the values changed since the previous snapshot, followed by those values only.
+  /// A delta frame can not be decoded if the previous one is missing (the index
+  /// is not consecutive): the following keyframe is needed.
+  DELTA
+};
+
+constexpr uint8_t kKeyframe = 0;
+constexpr uint8_t kDeltaFrame = 1;
+
+/// Clock used when Schema::clock is not specified
+constexpr const char* kDefaultClock = "system_clock";
+
 struct CustomSchema
 {
   std::string encoding;
@@ -134,6 +173,9 @@ struct Schema
   uint64_t hash = 0;
   FieldsVector fields;
   std::string channel_name;
+  PayloadEncoding encoding = PayloadEncoding::PLAIN;
+  /// name of the Clock used for the timestamps (see Clock::name)
+  std::string clock = kDefaultClock;
 
   std::unordered_map<std::string, FieldsVector> custom_types;
   std::unordered_map<std::string, CustomSchema> custom_schemas;
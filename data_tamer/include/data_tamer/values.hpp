@@ -1,15 +1,28 @@
 #pragma once
 
-#include <functional>
 #include <atomic>
 #include <cstring>
 #include <iostream>
 #include "data_tamer/custom_types.hpp"
+#include "data_tamer/details/seqlock.hpp"
 #include "data_tamer/contrib/SerializeMe.hpp"
 
 namespace DataTamer
 {
 
+/**
+ * @brief ValueOps is the table of functions used by ValuePtr to serialize
+ * types that can not be simply copied with memcpy.
+ * There is a single static instance for each type.
+ */
+struct ValueOps
+{
+  void (*serialize)(const void* ptr, const CustomSerializer* type_info,
+                    SerializeMe::SpanBytes& buffer);
+  // nullptr if the serialized size is known at construction time
+  size_t (*serialized_size)(const void* ptr, const CustomSerializer* type_info);
+};
+
 /**
  * @brief The ValuePtr is a non-owning pointer to
  * a variable.
@@ -22,6 +35,10 @@ public:
   template <typename T>
   ValuePtr(const T* pointer, CustomSerializer::Ptr type_info = {});
 
+  // the value is read using SeqLock::load()
+  template <typename T>
+  ValuePtr(const SeqLock<T>* pointer, CustomSerializer::Ptr type_info = {});
+
   template <template <class, class> class Container, class T, class... TArgs>
   ValuePtr(const Container<T, TArgs...>* vect);
 
@@ -67,120 +84,378 @@ public:
     return array_size_;
   }
 
+  /// Pointer to the variable (not owned)
+  [[nodiscard]] const void* data() const
+  {
+    return v_ptr_;
+  }
+
+  /// True if serialize() is a plain memcpy of getSerializedSize() bytes,
+  /// starting from data().
+  [[nodiscard]] bool isRawCopy() const
+  {
+    return ops_ == nullptr;
+  }
+
+  /// True if getSerializedSize() will ALWAYS return the same value
+  [[nodiscard]] bool isFixedSize() const
+  {
+    return fixed_size_ != 0;
+  }
+
+  /// If the variable is trivially copyable, the size of its memory,
+  /// starting from data(). Zero otherwise.
+  [[nodiscard]] size_t captureSize() const
+  {
+    return capture_size_;
+  }
+
 private:
   const void* v_ptr_ = nullptr;
+  // nullptr if the variable is serialized with a memcpy of fixed_size_ bytes
+  const ValueOps* ops_ = nullptr;
+  CustomSerializer::Ptr type_info_;
+  // serialized size, if known at construction time. 0 otherwise
+  size_t fixed_size_ = 0;
+  size_t capture_size_ = 0;
   BasicType type_ = BasicType::OTHER;
   std::uint8_t memory_size_ = 0;
-  std::function<void(SerializeMe::SpanBytes&)> serialize_impl_;
-  std::function<size_t()> get_size_impl_;
   bool is_vector_ = false;
   uint16_t array_size_ = 0;
 };
 
-//------------------------------------------------------------
-//------------------------------------------------------------
-//------------------------------------------------------------
+namespace details
+{
+// Bools are saved as bits, eight per byte. The first bool is the least
+// significant bit of the first byte.
+constexpr size_t PackedBoolsSize(size_t count)
+{
+  return (count + 7) / 8;
+}
 
-template <typename T>
-inline ValuePtr::ValuePtr(const T* pointer, CustomSerializer::Ptr type_info) :
-  v_ptr_(pointer), type_(GetBasicType<T>()), memory_size_(sizeof(T)), is_vector_(false)
+// Write PackedBoolsSize(count) bytes into dst
+inline void PackBools(const bool* values, size_t count, uint8_t* dst)
 {
-  if (type_info)
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8)
   {
-    serialize_impl_ = [type_info, pointer](SerializeMe::SpanBytes& buffer) -> void
-    {
-      type_info->serialize(pointer, buffer);
-    };
-    get_size_impl_ = [type_info, pointer]() -> size_t
+    // each byte is 0 or 1: the multiplication moves the bit 8*k to the bit 56+k
+    uint64_t bytes = 0;
+    std::memcpy(&bytes, values + i, 8);
+    dst[i / 8] = uint8_t((bytes * 0x0102040810204080ull) >> 56);
+  }
+  if (i < count)
+  {
+    uint8_t last = 0;
+    for (size_t k = 0; i + k < count; k++)
     {
-      return type_info->serializedSize(pointer);
-    };
+      last = uint8_t(last | (uint32_t(values[i + k]) << k));
+    }
+    dst[i / 8] = last;
   }
 }
 
-template <template <class, class> class Container, class T, class... TArgs>
-inline ValuePtr::ValuePtr(const Container<T, TArgs...>* vect) :
-  v_ptr_(vect), type_(GetBasicType<T>()), memory_size_(sizeof(T)), is_vector_(true)
-{
-  serialize_impl_ = [vect](SerializeMe::SpanBytes& buffer) -> void {
-    SerializeMe::SerializeIntoBuffer(buffer, *vect);
-  };
-  get_size_impl_ = [vect]() -> size_t {
-    return SerializeMe::BufferSize(*vect);
-  };
+// Same as above, for containers that are not contiguous (i.e. std::vector<bool>)
+template <typename Container>
+inline void PackBools(const Container& values, uint8_t* dst)
+{
+  uint8_t byte = 0;
+  size_t count = 0;
+  for (const bool value : values)
+  {
+    byte = uint8_t(byte | (uint32_t(value) << (count % 8)));
+    if (++count % 8 == 0)
+    {
+      *dst++ = byte;
+      byte = 0;
+    }
+  }
+  if (count % 8 != 0)
+  {
+    *dst = byte;
+  }
 }
 
-template <template <class, class> class Container, class T, class... TArgs>
-inline ValuePtr::ValuePtr(const Container<T, TArgs...>* vect,
-                          CustomSerializer::Ptr type_info) :
-  v_ptr_(vect), type_(GetBasicType<T>()), memory_size_(sizeof(T)), is_vector_(true)
+// a single static table for each type, i.e. no allocations and no std::function
+
+template <typename T>
+struct CustomScalarOps
 {
-  serialize_impl_ = [type_info, vect](SerializeMe::SpanBytes& buffer) -> void
+  static void serialize(const void* ptr, const CustomSerializer* type_info,
+                        SerializeMe::SpanBytes& buffer)
+  {
+    type_info->serialize(ptr, buffer);
+  }
+  static size_t size(const void* ptr, const CustomSerializer* type_info)
   {
-    SerializeMe::SerializeIntoBuffer(buffer, uint32_t(vect->size()));
-    for(const auto& value: (*vect))
+    return type_info->serializedSize(ptr);
+  }
+  static constexpr ValueOps table = {&serialize, &size};
+};
+
+template <typename T>
+struct SeqLockOps
+{
+  static void serialize(const void* ptr, const CustomSerializer* type_info,
+                        SerializeMe::SpanBytes& buffer)
+  {
+    const T value = static_cast<const SeqLock<T>*>(ptr)->load();
+    if (type_info)
     {
       type_info->serialize(&value, buffer);
+      return;
     }
-  };
-  get_size_impl_ = [type_info, vect]() -> size_t {
-    if(vect->empty())
+    std::memcpy(buffer.data(), &value, sizeof(T));
+    buffer.trimFront(sizeof(T));
+  }
+  static size_t size(const void* ptr, const CustomSerializer* type_info)
+  {
+    const T value = static_cast<const SeqLock<T>*>(ptr)->load();
+    return type_info->serializedSize(&value);
+  }
+  static constexpr ValueOps numeric_table = {&serialize, nullptr};
+  static constexpr ValueOps custom_table = {&serialize, &size};
+};
+
+template <typename Container>
+struct ContainerOps
+{
+  static void serialize(const void* ptr, const CustomSerializer*,
+                        SerializeMe::SpanBytes& buffer)
+  {
+    SerializeMe::SerializeIntoBuffer(buffer, *static_cast<const Container*>(ptr));
+  }
+  static size_t size(const void* ptr, const CustomSerializer*)
+  {
+    return SerializeMe::BufferSize(*static_cast<const Container*>(ptr));
+  }
+  static constexpr ValueOps table = {&serialize, &size};
+};
+
+template <typename Container>
+struct BoolContainerOps
+{
+  static void serialize(const void* ptr, const CustomSerializer*,
+                        SerializeMe::SpanBytes& buffer)
+  {
+    const auto& vect = *static_cast<const Container*>(ptr);
+    SerializeMe::SerializeIntoBuffer(buffer, uint32_t(vect.size()));
+    const size_t size = PackedBoolsSize(vect.size());
+    if (size > buffer.size())
+    {
+      throw std::runtime_error("SerializeIntoBuffer: buffer overflow");
+    }
+    PackBools(vect, buffer.data());
+    buffer.trimFront(size);
+  }
+  static size_t size(const void* ptr, const CustomSerializer*)
+  {
+    const auto& vect = *static_cast<const Container*>(ptr);
+    return sizeof(uint32_t) + PackedBoolsSize(vect.size());
+  }
+  static constexpr ValueOps table = {&serialize, &size};
+};
+
+template <size_t N>
+struct BoolArrayOps
+{
+  static void serialize(const void* ptr, const CustomSerializer*,
+                        SerializeMe::SpanBytes& buffer)
+  {
+    PackBools(static_cast<const std::array<bool, N>*>(ptr)->data(), N, buffer.data());
+    buffer.trimFront(PackedBoolsSize(N));
+  }
+  static constexpr ValueOps table = {&serialize, nullptr};
+};
+
+template <typename Container>
+struct CustomContainerOps
+{
+  static void serialize(const void* ptr, const CustomSerializer* type_info,
+                        SerializeMe::SpanBytes& buffer)
+  {
+    const auto& vect = *static_cast<const Container*>(ptr);
+    SerializeMe::SerializeIntoBuffer(buffer, uint32_t(vect.size()));
+    using T = typename Container::value_type;
+    if constexpr (std::is_same_v<Container,
+                                 std::vector<T, typename Container::allocator_type>>)
+    {
+      // contiguous memory: serialize all the elements at once
+      if (!vect.empty())
+      {
+        type_info->serializeArray(vect.data(), vect.size(), sizeof(T), buffer);
+      }
+    }
+    else
+    {
+      for (const auto& value : vect)
+      {
+        type_info->serialize(&value, buffer);
+      }
+    }
+  }
+  static size_t size(const void* ptr, const CustomSerializer* type_info)
+  {
+    const auto& vect = *static_cast<const Container*>(ptr);
+    if (vect.empty())
     {
       return sizeof(uint32_t);
     }
-    if(type_info->isFixedSize())
+    if (type_info->isFixedSize())
     {
-      return sizeof(uint32_t) + vect->size() * type_info->serializedSize(&vect->front());
+      return sizeof(uint32_t) + vect.size() * type_info->serializedSize(&vect.front());
     }
     size_t tot_size = sizeof(uint32_t);
-    for(const auto& value: (*vect))
+    for (const auto& value : vect)
     {
       tot_size += type_info->serializedSize(&value);
     }
     return tot_size;
-  };
+  }
+  static constexpr ValueOps table = {&serialize, &size};
+};
+
+template <typename T, size_t N>
+struct CustomArrayOps
+{
+  static void serialize(const void* ptr, const CustomSerializer* type_info,
+                        SerializeMe::SpanBytes& buffer)
+  {
+    if constexpr (N > 0)
+    {
+      type_info->serializeArray(static_cast<const std::array<T, N>*>(ptr)->data(), N,
+                                sizeof(T), buffer);
+    }
+  }
+  static size_t size(const void* ptr, const CustomSerializer* type_info)
+  {
+    if constexpr (N == 0)
+    {
+      // front() can not be called
+      return 0;
+    }
+    else
+    {
+      const auto& array = *static_cast<const std::array<T, N>*>(ptr);
+      if (type_info->isFixedSize())
+      {
+        return N * type_info->serializedSize(&array.front());
+      }
+      size_t tot_size = 0;
+      for (const auto& value : array)
+      {
+        tot_size += type_info->serializedSize(&value);
+      }
+      return tot_size;
+    }
+  }
+  static constexpr ValueOps table = {&serialize, &size};
+};
+
+}   // namespace details
+
+
+//------------------------------------------------------------
+//------------------------------------------------------------
+//------------------------------------------------------------
+
+template <typename T>
+inline ValuePtr::ValuePtr(const T* pointer, CustomSerializer::Ptr type_info) :
+  v_ptr_(pointer),
+  fixed_size_(sizeof(T)),
+  capture_size_(std::is_trivially_copyable_v<T> ? sizeof(T) : 0),
+  type_(GetBasicType<T>()),
+  memory_size_(sizeof(T)),
+  is_vector_(false)
+{
+  if (type_info)
+  {
+    fixed_size_ = type_info->isFixedSize() ? type_info->serializedSize(pointer) : 0;
+    ops_ = &details::CustomScalarOps<T>::table;
+    type_info_ = std::move(type_info);
+  }
 }
 
+template <typename T>
+inline ValuePtr::ValuePtr(const SeqLock<T>* pointer, CustomSerializer::Ptr type_info) :
+  v_ptr_(pointer),
+  ops_(&details::SeqLockOps<T>::numeric_table),
+  fixed_size_(sizeof(T)),
+  type_(GetBasicType<T>()),
+  memory_size_(sizeof(T)),
+  is_vector_(false)
+{
+  if (type_info)
+  {
+    if (type_info->isFixedSize())
+    {
+      const T value = pointer->load();
+      fixed_size_ = type_info->serializedSize(&value);
+    }
+    else
+    {
+      fixed_size_ = 0;
+    }
+    ops_ = &details::SeqLockOps<T>::custom_table;
+    type_info_ = std::move(type_info);
+  }
+}
+
+template <template <class, class> class Container, class T, class... TArgs>
+inline ValuePtr::ValuePtr(const Container<T, TArgs...>* vect) :
+  v_ptr_(vect),
+  ops_(&std::conditional_t<std::is_same_v<T, bool>,
+                            details::BoolContainerOps<Container<T, TArgs...>>,
+                            details::ContainerOps<Container<T, TArgs...>>>::table),
+  type_(GetBasicType<T>()),
+  memory_size_(sizeof(T)),
+  is_vector_(true)
+{}
+
+template <template <class, class> class Container, class T, class... TArgs>
+inline ValuePtr::ValuePtr(const Container<T, TArgs...>* vect,
+                          CustomSerializer::Ptr type_info) :
+  v_ptr_(vect),
+  ops_(&details::CustomContainerOps<Container<T, TArgs...>>::table),
+  type_info_(std::move(type_info)),
+  type_(GetBasicType<T>()),
+  memory_size_(sizeof(T)),
+  is_vector_(true)
+{}
+
 template <typename T, size_t N>
 inline ValuePtr::ValuePtr(const std::array<T, N>* array) :
   v_ptr_(array),
+  fixed_size_(sizeof(T) * N),
+  capture_size_(sizeof(T) * N),
   type_(GetBasicType<T>()),
+  memory_size_(sizeof(T)),
   is_vector_(true),
   array_size_(N)
 {
-  serialize_impl_ = [array](SerializeMe::SpanBytes& buffer) -> void {
-    SerializeMe::SerializeIntoBuffer(buffer, *array);
-  };
-  get_size_impl_ = [array]() { return SerializeMe::BufferSize(*array); };
+  // numeric arrays are contiguous: they are serialized with a single memcpy
+  if constexpr (std::is_same_v<T, bool>)
+  {
+    ops_ = &details::BoolArrayOps<N>::table;
+    fixed_size_ = details::PackedBoolsSize(N);
+  }
 }
 
 template <typename T, size_t N>
 inline ValuePtr::ValuePtr(const std::array<T, N>* array,
                           CustomSerializer::Ptr type_info) :
   v_ptr_(array),
+  ops_(&details::CustomArrayOps<T, N>::table),
+  capture_size_(std::is_trivially_copyable_v<T> ? sizeof(T) * N : 0),
   type_(GetBasicType<T>()),
   is_vector_(true),
   array_size_(N)
 {
-  serialize_impl_ = [type_info, array](SerializeMe::SpanBytes& buffer) -> void
+  if (N > 0 && type_info->isFixedSize())
   {
-    for(const auto& value: (*array))
-    {
-      type_info->serialize(&value, buffer);
-    }
-  };
-  get_size_impl_ = [type_info, array]() {
-    size_t tot_size = 0;
-    if(type_info->isFixedSize())
-    {
-      return N * type_info->serializedSize(&array->front());
-    }
-    for(const auto& value: (*array))
-    {
-      tot_size += type_info->serializedSize(&value);
-    }
-    return tot_size;
-  };
+    fixed_size_ = N * type_info->serializedSize(&array->front());
+  }
+  type_info_ = std::move(type_info);
 }
 
 inline bool ValuePtr::operator==(const ValuePtr& other) const
@@ -191,23 +466,23 @@ inline bool ValuePtr::operator==(const ValuePtr& other) const
 
 inline void ValuePtr::serialize(SerializeMe::SpanBytes& dest) const
 {
-  if (serialize_impl_)
+  if (ops_)
   {
-    serialize_impl_(dest);
+    ops_->serialize(v_ptr_, type_info_.get(), dest);
     return;
   }
 
-  std::memcpy(dest.data(), v_ptr_, memory_size_);
-  dest.trimFront(memory_size_);
+  std::memcpy(dest.data(), v_ptr_, fixed_size_);
+  dest.trimFront(fixed_size_);
 }
 
 inline size_t ValuePtr::getSerializedSize() const
 {
-  if (!get_size_impl_)
+  if (fixed_size_ != 0 || !ops_ || !ops_->serialized_size)
   {
-    return memory_size_;
+    return fixed_size_;
   }
-  return get_size_impl_();
+  return ops_->serialized_size(v_ptr_, type_info_.get());
 }
 
 }   // namespace DataTamer
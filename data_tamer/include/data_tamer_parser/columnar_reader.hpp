@@ -0,0 +1,484 @@
+#pragma once
+
+#include "data_tamer_parser/data_tamer_parser.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <unordered_map>
+
+namespace DataTamerParser
+{
+
+/*
+ * File format written by DataTamer::ColumnarSink. All the integers are
+ * little-endian; "varint" is an unsigned LEB128 and "zigzag" maps signed
+ * integers to unsigned ones (0, -1, 1, -2 ... become 0, 1, 2, 3 ...).
+ *
+ * File:    "DTCOLUMN" (8 bytes), uint32 format version, then a sequence of records.
+ *
+ * Record:  uint8 kind, varint size, content of the record.
+ *
+ * kColumnarSchema:  uint64 schema hash,
+ *                   varint size + channel name,
+ *                   varint size + schema (the same text saved in MCAP).
+ *
+ * kColumnarBlock:   uint64 schema hash,
+ *                   varint rows (number of snapshots),
+ *                   varint size + timestamps,
+ *                   varint number of columns,
+ *                   the columns.
+ *
+ * kColumnarDropped: varint rejected, varint evicted, varint decimated: the
+ *                   DataTamer::DropCounters of the sink, written when the recording
+ *                   is stopped.
+ *
+ * Timestamps:  zigzag varints of the delta-of-delta of the timestamps.
+ *
+ * Column:  varint size + name of the series (as passed to the ParseSnapshot callback),
+ *          uint8 BasicType,
+ *          uint8 flags: if kColumnSparse is set, the series is not present in
+ *                all the rows, and a bitmask of (rows + 7) / 8 bytes follows,
+ *          varint size + values.
+ *
+ * Values, depending on the type:
+ *  - BOOL: one bit each (the first value is the most significant bit);
+ *  - FLOAT32 and FLOAT64: the first value (64 bits, floats in the most significant
+ *    half), then the XOR with the previous value, encoded as in Gorilla
+ *    (http://www.vldb.org/pvldb/vol8/p1816-teller.pdf);
+ *  - integers: zigzag varints of the difference with the previous value
+ *    (as 64 bits integers, the first value is compared to zero).
+ *
+ * Quantized series (see TypeField::quantization) are saved as integers.
+ */
+
+constexpr char kColumnarMagic[8] = {'D', 'T', 'C', 'O', 'L', 'U', 'M', 'N'};
+constexpr uint32_t kColumnarVersion = 1;
+
+constexpr uint8_t kColumnarSchema = 1;
+constexpr uint8_t kColumnarBlock = 2;
+constexpr uint8_t kColumnarDropped = 3;
+
+constexpr uint8_t kColumnSparse = 1;
+
+/// Timestamps and values of a single series
+struct ColumnSeries
+{
+  BasicType type = BasicType::OTHER;
+  /// nanoseconds since epoch
+  std::vector<int64_t> timestamps;
+  /// all the types are converted to double. Quantized values are decoded
+  std::vector<double> values;
+};
+
+/**
+ * @brief ColumnarReader reads the files written by DataTamer::ColumnarSink.
+ *
+ * The file is loaded in memory and indexed in the constructor; readSeries
+ * decodes only the blocks of the requested series.
+ */
+class ColumnarReader
+{
+public:
+  /// Throws if the file can not be read or if its format is not valid
+  explicit ColumnarReader(const std::string& filepath);
+
+  /// Same as above, using the content of the file
+  explicit ColumnarReader(std::vector<uint8_t> data);
+
+  [[nodiscard]] std::vector<std::string> channelNames() const;
+
+  /// Throws if the channel does not exist
+  [[nodiscard]] const Schema& schema(const std::string& channel_name) const;
+
+  /// Names of the series saved in a channel, in order of appearance
+  [[nodiscard]] const std::vector<std::string>& seriesNames(
+      const std::string& channel_name) const;
+
+  /// Decode all the values of a series. Throws if the series does not exist
+  [[nodiscard]] ColumnSeries readSeries(const std::string& channel_name,
+                                        const std::string& series_name) const;
+
+  /// Snapshots discarded by the sink (rejected + evicted + decimated, see
+  /// DataTamer::DropCounters). Zero if the file does not contain this information
+  [[nodiscard]] uint64_t droppedSnapshots() const
+  {
+    return dropped_snapshots_;
+  }
+
+private:
+  struct Column
+  {
+    BasicType type = BasicType::OTHER;
+    // empty if the series is present in all the rows
+    BufferSpan present;
+    BufferSpan values;
+  };
+
+  struct Block
+  {
+    uint32_t rows = 0;
+    BufferSpan timestamps;
+    std::unordered_map<std::string, Column> columns;
+  };
+
+  struct Channel
+  {
+    Schema schema;
+    std::vector<std::string> series_names;
+    std::vector<Block> blocks;
+  };
+
+  std::vector<uint8_t> data_;
+  std::map<std::string, Channel> channels_;
+  uint64_t dropped_snapshots_ = 0;
+
+  void buildIndex();
+
+  const Channel& getChannel(const std::string& channel_name) const;
+};
+
+//---------------------------------------------------------
+//---------------------------------------------------------
+//---------------------------------------------------------
+
+inline uint64_t DeserializeVarint(BufferSpan& buffer)
+{
+  uint64_t value = 0;
+  for (unsigned shift = 0; shift < 64; shift += 7)
+  {
+    const auto byte = Deserialize<uint8_t>(buffer);
+    value |= uint64_t(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0)
+    {
+      return value;
+    }
+  }
+  throw std::runtime_error("Invalid varint");
+}
+
+inline int64_t DecodeZigZag(uint64_t value)
+{
+  return int64_t((value >> 1) ^ (0 - (value & 1)));
+}
+
+// read a varint size, followed by the corresponding bytes
+inline BufferSpan DeserializeSpan(BufferSpan& buffer)
+{
+  const uint64_t size = DeserializeVarint(buffer);
+  if (size > buffer.size)
+  {
+    throw std::runtime_error("Buffer overflow");
+  }
+  const BufferSpan span = {buffer.data, size_t(size)};
+  buffer.trimFront(size_t(size));
+  return span;
+}
+
+// the bits are read starting from the most significant bit of each byte
+class BitReader
+{
+public:
+  explicit BitReader(BufferSpan buffer) : buffer_(buffer)
+  {}
+
+  uint64_t read(unsigned bits)
+  {
+    uint64_t value = 0;
+    while (bits > 0)
+    {
+      if (byte_index_ >= buffer_.size)
+      {
+        throw std::runtime_error("Buffer overflow");
+      }
+      const unsigned available = 8 - bit_pos_;
+      const unsigned take = std::min(available, bits);
+      const unsigned byte = buffer_.data[byte_index_];
+      const unsigned chunk = (byte >> (available - take)) & ((1u << take) - 1);
+      value = (value << take) | chunk;
+      bits -= take;
+      bit_pos_ += take;
+      if (bit_pos_ == 8)
+      {
+        bit_pos_ = 0;
+        byte_index_++;
+      }
+    }
+    return value;
+  }
+
+private:
+  BufferSpan buffer_;
+  size_t byte_index_ = 0;
+  unsigned bit_pos_ = 0;
+};
+
+inline ColumnarReader::ColumnarReader(const std::string& filepath)
+{
+  std::ifstream file(filepath, std::ios::binary | std::ios::ate);
+  if (!file)
+  {
+    throw std::runtime_error("ColumnarReader: can't open file " + filepath);
+  }
+  data_.resize(size_t(file.tellg()));
+  file.seekg(0);
+  file.read(reinterpret_cast<char*>(data_.data()), std::streamsize(data_.size()));
+  buildIndex();
+}
+
+inline ColumnarReader::ColumnarReader(std::vector<uint8_t> data) : data_(std::move(data))
+{
+  buildIndex();
+}
+
+inline void ColumnarReader::buildIndex()
+{
+  BufferSpan buffer = {data_.data(), data_.size()};
+  if (buffer.size < sizeof(kColumnarMagic) + sizeof(uint32_t) ||
+      std::memcmp(buffer.data, kColumnarMagic, sizeof(kColumnarMagic)) != 0)
+  {
+    throw std::runtime_error("ColumnarReader: not a columnar file");
+  }
+  buffer.trimFront(sizeof(kColumnarMagic));
+  if (Deserialize<uint32_t>(buffer) > kColumnarVersion)
+  {
+    throw std::runtime_error("ColumnarReader: unsupported version");
+  }
+
+  std::unordered_map<uint64_t, Channel*> channel_by_hash;
+
+  while (buffer.size > 0)
+  {
+    const auto kind = Deserialize<uint8_t>(buffer);
+    BufferSpan record = DeserializeSpan(buffer);
+
+    if (kind == kColumnarSchema)
+    {
+      const auto hash = Deserialize<uint64_t>(record);
+      const BufferSpan name = DeserializeSpan(record);
+      const BufferSpan text = DeserializeSpan(record);
+      const std::string channel_name(reinterpret_cast<const char*>(name.data), name.size);
+      auto& channel = channels_[channel_name];
+      channel.schema = BuilSchemaFromText(
+          std::string(reinterpret_cast<const char*>(text.data), text.size));
+      channel_by_hash[hash] = &channel;
+    }
+    else if (kind == kColumnarBlock)
+    {
+      const auto hash = Deserialize<uint64_t>(record);
+      auto it = channel_by_hash.find(hash);
+      if (it == channel_by_hash.end())
+      {
+        throw std::runtime_error("ColumnarReader: block of an unknown channel");
+      }
+      Channel& channel = *it->second;
+      Block block;
+      block.rows = uint32_t(DeserializeVarint(record));
+      block.timestamps = DeserializeSpan(record);
+      const uint64_t columns_count = DeserializeVarint(record);
+      for (uint64_t c = 0; c < columns_count; c++)
+      {
+        const BufferSpan name = DeserializeSpan(record);
+        Column column;
+        column.type = static_cast<BasicType>(Deserialize<uint8_t>(record));
+        const auto flags = Deserialize<uint8_t>(record);
+        if (flags & kColumnSparse)
+        {
+          column.present = {record.data, (block.rows + 7) / 8};
+          if (column.present.size > record.size)
+          {
+            throw std::runtime_error("Buffer overflow");
+          }
+          record.trimFront(column.present.size);
+        }
+        column.values = DeserializeSpan(record);
+
+        std::string series_name(reinterpret_cast<const char*>(name.data), name.size);
+        if (std::find(channel.series_names.begin(), channel.series_names.end(),
+                      series_name) == channel.series_names.end())
+        {
+          channel.series_names.push_back(series_name);
+        }
+        block.columns.insert({std::move(series_name), column});
+      }
+      channel.blocks.push_back(std::move(block));
+    }
+    else if (kind == kColumnarDropped)
+    {
+      dropped_snapshots_ = 0;
+      for (int i = 0; i < 3; i++)
+      {
+        dropped_snapshots_ += DeserializeVarint(record);
+      }
+    }
+    // unknown records are skipped
+  }
+}
+
+inline std::vector<std::string> ColumnarReader::channelNames() const
+{
+  std::vector<std::string> names;
+  for (const auto& [name, channel] : channels_)
+  {
+    names.push_back(name);
+  }
+  return names;
+}
+
+inline const ColumnarReader::Channel&
+ColumnarReader::getChannel(const std::string& channel_name) const
+{
+  auto it = channels_.find(channel_name);
+  if (it == channels_.end())
+  {
+    throw std::runtime_error("ColumnarReader: unknown channel " + channel_name);
+  }
+  return it->second;
+}
+
+inline const Schema& ColumnarReader::schema(const std::string& channel_name) const
+{
+  return getChannel(channel_name).schema;
+}
+
+inline const std::vector<std::string>&
+ColumnarReader::seriesNames(const std::string& channel_name) const
+{
+  return getChannel(channel_name).series_names;
+}
+
+inline ColumnSeries ColumnarReader::readSeries(const std::string& channel_name,
+                                               const std::string& series_name) const
+{
+  const Channel& channel = getChannel(channel_name);
+
+  // quantized series: the name is the one of the field, or one of its elements
+  std::optional<Quantization> quantization;
+  for (const auto& field : channel.schema.fields)
+  {
+    if (field.quantization &&
+        (series_name == field.field_name ||
+         (field.is_vector && series_name.rfind(field.field_name + "[", 0) == 0)))
+    {
+      quantization = field.quantization;
+    }
+  }
+
+  ColumnSeries series;
+  bool found = false;
+  std::vector<int64_t> timestamps;
+
+  for (const auto& block : channel.blocks)
+  {
+    auto it = block.columns.find(series_name);
+    if (it == block.columns.end())
+    {
+      continue;
+    }
+    const Column& column = it->second;
+    found = true;
+    series.type = column.type;
+
+    // timestamps of all the rows
+    timestamps.resize(block.rows);
+    BufferSpan ts_buffer = block.timestamps;
+    int64_t prev = 0;
+    int64_t prev_delta = 0;
+    for (uint32_t r = 0; r < block.rows; r++)
+    {
+      const int64_t delta = DecodeZigZag(DeserializeVarint(ts_buffer)) + prev_delta;
+      prev += delta;
+      prev_delta = (r == 0) ? 0 : delta;
+      timestamps[r] = prev;
+    }
+
+    const size_t first_value = series.values.size();
+    for (uint32_t r = 0; r < block.rows; r++)
+    {
+      if (column.present.size == 0 || GetBit(column.present, r))
+      {
+        series.timestamps.push_back(timestamps[r]);
+      }
+    }
+    const size_t count = series.timestamps.size() - first_value;
+    series.values.resize(series.timestamps.size());
+    double* values = series.values.data() + first_value;
+
+    switch (column.type)
+    {
+      case BasicType::BOOL: {
+        BitReader reader(column.values);
+        for (size_t i = 0; i < count; i++)
+        {
+          values[i] = double(reader.read(1));
+        }
+      }
+      break;
+
+      case BasicType::FLOAT32:
+      case BasicType::FLOAT64: {
+        BitReader reader(column.values);
+        uint64_t bits = 0;
+        unsigned leading = 0;
+        unsigned trailing = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+          if (i == 0)
+          {
+            bits = reader.read(64);
+          }
+          else if (reader.read(1) == 1)
+          {
+            if (reader.read(1) == 1)
+            {
+              // new window of meaningful bits
+              leading = unsigned(reader.read(5));
+              const unsigned length = unsigned(reader.read(6));
+              trailing = 64 - leading - (length == 0 ? 64 : length);
+            }
+            bits ^= reader.read(64 - leading - trailing) << trailing;
+          }
+          if (column.type == BasicType::FLOAT32)
+          {
+            const auto bits32 = uint32_t(bits >> 32);
+            float value;
+            std::memcpy(&value, &bits32, sizeof(value));
+            values[i] = double(value);
+          }
+          else
+          {
+            std::memcpy(&values[i], &bits, sizeof(double));
+          }
+        }
+      }
+      break;
+
+      default: {
+        BufferSpan buffer = column.values;
+        const bool is_unsigned =
+            column.type == BasicType::UINT8 || column.type == BasicType::UINT16 ||
+            column.type == BasicType::UINT32 || column.type == BasicType::UINT64;
+        uint64_t value = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+          value += uint64_t(DecodeZigZag(DeserializeVarint(buffer)));
+          values[i] = is_unsigned ? double(value) : double(int64_t(value));
+        }
+      }
+    }
+
+    if (quantization)
+    {
+      for (size_t i = 0; i < count; i++)
+      {
+        values[i] = quantization->offset + quantization->scale * values[i];
+      }
+    }
+  }
+  if (!found)
+  {
+    throw std::runtime_error("ColumnarReader: unknown series " + series_name);
+  }
+  return series;
+}
+
+}   // namespace DataTamerParser
@@ -17,7 +17,8 @@
 namespace DataTamerParser
 {
 
-constexpr int SCHEMA_VERSION = 4;
+/// Schemas with this version, or older, can be parsed
+constexpr int SCHEMA_VERSION = 7;
 
 enum class BasicType
 {
@@ -37,10 +38,14 @@ enum class BasicType
 
   FLOAT32,
   FLOAT64,
-  OTHER
+  OTHER,
+
+  // SCHEMA_VERSION >= 5. Deserialized as float
+  FLOAT16,
+  BFLOAT16
 };
 
-constexpr size_t TypesCount = 13;
+constexpr size_t TypesCount = 15;
 
 using VarNumber = std::variant<bool, char, int8_t, uint8_t, int16_t, uint16_t, int32_t,
                                uint32_t, int64_t, uint64_t, float, double>;
@@ -59,6 +64,13 @@ struct BufferSpan
 
 VarNumber DeserializeToVarNumber(BasicType type, BufferSpan& buffer);
 
+/// See DataTamer::Quantization
+struct Quantization
+{
+  double scale = 1.0;
+  double offset = 0.0;
+};
+
 //---------------------------------------------------------
 struct TypeField
 {
@@ -67,6 +79,8 @@ struct TypeField
   std::string type_name;
   bool is_vector = 0;
   uint32_t array_size = 0;
+  /// if set, ParseSnapshot returns the decoded double (offset + scale * integer)
+  std::optional<Quantization> quantization;
 
   bool operator==(const TypeField& other) const;
   bool operator!=(const TypeField& other) const;
@@ -74,6 +88,16 @@ struct TypeField
 
 using FieldsVector = std::vector<TypeField>;
 
+/// See DataTamer::PayloadEncoding
+enum class PayloadEncoding
+{
+  PLAIN,
+  DELTA
+};
+
+constexpr uint8_t kKeyframe = 0;
+constexpr uint8_t kDeltaFrame = 1;
+
 /**
  * @brief DataTamer uses a simple "flat" schema of key/value pairs (each pair is a "field").
  */
@@ -82,8 +106,24 @@ struct Schema
   uint64_t hash = 0;
   FieldsVector fields;
   std::string channel_name;
+  /// SCHEMA_VERSION of the writer. Since version 6, the bools are bit-packed:
+  /// the enabled bool fields are the bits of a block at the beginning of the
+  /// payload, the arrays and vectors of bools use one bit per element.
+  /// Since version 7, the frames of PayloadEncoding::DELTA have an index.
+  int version = SCHEMA_VERSION;
+  PayloadEncoding encoding = PayloadEncoding::PLAIN;
+  /// source of the timestamps: "system_clock" (default), "monotonic_coarse",
+  /// "tsc" or "simulated". All of them are nanoseconds since epoch, but
+  /// "simulated" is not related to the wall time.
+  std::string clock = "system_clock";
 
   std::map<std::string, FieldsVector> custom_types;
+
+  /// Used by ParseSnapshot with PayloadEncoding::DELTA: decoded payload of the
+  /// previous snapshot. The snapshots of a channel must be parsed in order.
+  mutable std::vector<uint8_t> previous_payload;
+  /// index of the previous frame (SCHEMA_VERSION >= 7)
+  mutable uint32_t previous_frame = 0;
 };
 
 Schema BuilSchemaFromText(const std::string& txt);
@@ -121,10 +161,54 @@ bool ParseSnapshot(const Schema& schema, SnapshotView snapshot,
                    const NumberCallback& callback_number,
                    const CustomCallback& callback_custom = NullCustomCallback);
 
+/**
+ * @brief DecodeDeltaPayload converts the payload of a snapshot encoded with
+ * PayloadEncoding::DELTA into a plain one, stored in schema.previous_payload.
+ *
+ * @return false if this is a delta frame and the previous snapshot is unknown,
+ * or it was lost (the frames are not consecutive). The following delta frames
+ * are not decoded either, until the next keyframe.
+ */
+bool DecodeDeltaPayload(const Schema& schema, const SnapshotView& snapshot);
+
 //---------------------------------------------------------
 //---------------------------------------------------------
 //---------------------------------------------------------
 
+/// See DataTamer::HalfToFloat (IEEE 754 binary16)
+inline float HalfToFloat(uint16_t value)
+{
+  uint32_t x = uint32_t(value & 0x7FFFu) << 13;
+  const uint32_t exponent = x & 0x0F800000u;
+  x += 0x38000000u;
+  if (exponent == 0x0F800000u)
+  {
+    // infinity or NaN
+    x += 0x38000000u;
+  }
+  else if (exponent == 0)
+  {
+    // zero or subnormal
+    x += 0x00800000u;
+    float f;
+    std::memcpy(&f, &x, sizeof(f));
+    f -= 6.103515625e-05f;   // 2^-14
+    std::memcpy(&x, &f, sizeof(x));
+  }
+  x |= uint32_t(value & 0x8000u) << 16;
+  float result;
+  std::memcpy(&result, &x, sizeof(result));
+  return result;
+}
+
+inline float BFloat16ToFloat(uint16_t value)
+{
+  const uint32_t x = uint32_t(value) << 16;
+  float result;
+  std::memcpy(&result, &x, sizeof(result));
+  return result;
+}
+
 template <typename T>
 inline T Deserialize(BufferSpan& buffer)
 {
@@ -174,6 +258,11 @@ inline VarNumber DeserializeToVarNumber(BasicType type, BufferSpan& buffer)
     case BasicType::FLOAT64:
       return Deserialize<double>(buffer);
 
+    case BasicType::FLOAT16:
+      return HalfToFloat(Deserialize<uint16_t>(buffer));
+    case BasicType::BFLOAT16:
+      return BFloat16ToFloat(Deserialize<uint16_t>(buffer));
+
     case BasicType::OTHER:
       return double(std::numeric_limits<double>::quiet_NaN());
   }
@@ -186,6 +275,27 @@ inline bool GetBit(BufferSpan mask, size_t index)
   return 0 != (byte & uint8_t(1 << (index % 8)));
 }
 
+// true if the field is saved as bits (see Schema::version)
+inline bool IsPackedBool(const Schema& schema, const TypeField& field)
+{
+  return schema.version >= 6 && field.type == BasicType::BOOL;
+}
+
+// Size of the block of bools, at the beginning of the payload
+inline size_t PackedBoolsBlockSize(const Schema& schema, BufferSpan active_mask)
+{
+  size_t count = 0;
+  for (size_t i = 0; i < schema.fields.size(); i++)
+  {
+    const auto& field = schema.fields[i];
+    if (IsPackedBool(schema, field) && !field.is_vector && GetBit(active_mask, i))
+    {
+      count++;
+    }
+  }
+  return (count + 7) / 8;
+}
+
 [[nodiscard]] inline uint64_t AddFieldToHash(const TypeField& field, uint64_t hash)
 {
   // https://stackoverflow.com/questions/2590677/how-do-i-combine-hash-values-in-c0x
@@ -193,6 +303,7 @@ inline bool GetBit(BufferSpan mask, size_t index)
   const std::hash<BasicType> type_hasher;
   const std::hash<bool> bool_hasher;
   const std::hash<uint32_t> uint_hasher;
+  const std::hash<double> double_hasher;
 
   auto combine = [&hash](const auto& hasher, const auto& val) {
     hash ^= hasher(val) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
@@ -206,14 +317,22 @@ inline bool GetBit(BufferSpan mask, size_t index)
   }
   combine(bool_hasher, field.is_vector);
   combine(uint_hasher, field.array_size);
+  if (field.quantization)
+  {
+    combine(double_hasher, field.quantization->scale);
+    combine(double_hasher, field.quantization->offset);
+  }
   return hash;
 }
 
-bool TypeField::operator==(const TypeField& other) const
+inline bool TypeField::operator==(const TypeField& other) const
 {
   return is_vector == other.is_vector && type == other.type &&
          array_size == other.array_size && field_name == other.field_name &&
-         type_name == other.type_name;
+         type_name == other.type_name &&
+         quantization.has_value() == other.quantization.has_value() &&
+         (!quantization || (quantization->scale == other.quantization->scale &&
+                            quantization->offset == other.quantization->offset));
 }
 
 inline Schema BuilSchemaFromText(const std::string& txt)
@@ -232,6 +351,8 @@ inline Schema BuilSchemaFromText(const std::string& txt)
   std::istringstream ss(txt);
   std::string line;
   Schema schema;
+  // without the "### version:" line, the schema is older than the packed bools
+  schema.version = 5;
   uint64_t declared_schema = 0;
 
   std::vector<TypeField>* field_vector = &schema.fields;
@@ -279,8 +400,9 @@ inline Schema BuilSchemaFromText(const std::string& txt)
 
     if (str_left == "### version:")
     {
-      // check compatibility
-      if (std::stoi(str_right) != SCHEMA_VERSION)
+      // check compatibility: older versions are a subset of the current one
+      schema.version = std::stoi(str_right);
+      if (schema.version > SCHEMA_VERSION)
       {
         throw std::runtime_error("Wrong SCHEMA_VERSION");
       }
@@ -301,15 +423,35 @@ inline Schema BuilSchemaFromText(const std::string& txt)
       continue;
     }
 
+    if (str_left == "### encoding:")
+    {
+      if (str_right == "delta")
+      {
+        schema.encoding = PayloadEncoding::DELTA;
+      }
+      else if (str_right != "plain")
+      {
+        throw std::runtime_error("Unknown encoding: " + str_right);
+      }
+      continue;
+    }
+
+    if (str_left == "### clock:")
+    {
+      schema.clock = str_right;
+      continue;
+    }
+
     TypeField field;
 
     static const std::array<std::string, TypesCount> kNamesNew = {
-        "bool",   "char",  "int8",   "uint8",   "int16",   "uint16", "int32",
-        "uint32", "int64", "uint64", "float32", "float64", "other"};
-    // backcompatibility to old format
+        "bool",   "char",    "int8",    "uint8",   "int16",   "uint16",
+        "int32",  "uint32",  "int64",   "uint64",  "float32", "float64",
+        "other",  "float16", "bfloat16"};
+    // backcompatibility to old format (these types did not exist)
     static const std::array<std::string, TypesCount> kNamesOld = {
         "BOOL",   "CHAR",  "INT8",   "UINT8", "INT16",  "UINT16", "INT32",
-        "UINT32", "INT64", "UINT64", "FLOAT", "DOUBLE", "OTHER"};
+        "UINT32", "INT64", "UINT64", "FLOAT", "DOUBLE", "OTHER", "", ""};
 
     for (size_t i = 0; i < TypesCount; i++)
     {
@@ -318,7 +460,7 @@ inline Schema BuilSchemaFromText(const std::string& txt)
         field.type = static_cast<BasicType>(i);
         break;
       }
-      if (str_right.find(kNamesOld[i]) == 0)
+      if (!kNamesOld[i].empty() && str_right.find(kNamesOld[i]) == 0)
       {
         field.type = static_cast<BasicType>(i);
         std::swap(str_type, str_name);
@@ -350,6 +492,22 @@ inline Schema BuilSchemaFromText(const std::string& txt)
     field.field_name = *str_name;
     trimString(field.field_name);
 
+    // optional quantization: "int16 name scale=0.01 offset=20"
+    const auto scale_pos = field.field_name.find(" scale=");
+    if (scale_pos != std::string::npos)
+    {
+      const auto offset_pos = field.field_name.find(" offset=", scale_pos);
+      if (offset_pos == std::string::npos)
+      {
+        throw std::runtime_error("Expecting \"offset=\" in line: " + line);
+      }
+      Quantization quantization;
+      quantization.scale = std::stod(field.field_name.substr(scale_pos + 7));
+      quantization.offset = std::stod(field.field_name.substr(offset_pos + 8));
+      field.quantization = quantization;
+      field.field_name.erase(scale_pos);
+    }
+
     // update the hash
     if (field_vector == &schema.fields)
     {
@@ -387,7 +545,17 @@ bool ParseSnapshotRecursive(const TypeField& field,
     if(field.type != BasicType::OTHER)
     {
       const auto var = DeserializeToVarNumber(field.type, buffer);
-      callback_number(var_name, var);
+      if (field.quantization)
+      {
+        const double saved = std::visit([](auto value) { return double(value); }, var);
+        const VarNumber decoded =
+            field.quantization->offset + field.quantization->scale * saved;
+        callback_number(var_name, decoded);
+      }
+      else
+      {
+        callback_number(var_name, var);
+      }
     }
     else {
       const FieldsVector& fields = types_list.at(field.type_name);
@@ -414,6 +582,136 @@ bool ParseSnapshotRecursive(const TypeField& field,
 }
 
 
+// Move the buffer forward, by the size of a serialized field
+inline void SkipField(const TypeField& field,
+                      const std::map<std::string, FieldsVector>& types_list,
+                      BufferSpan& buffer)
+{
+  uint32_t vect_size = field.is_vector ? field.array_size : 1;
+  if (field.is_vector && field.array_size == 0)
+  {
+    // dynamic vector
+    vect_size = Deserialize<uint32_t>(buffer);
+  }
+  if (field.type != BasicType::OTHER)
+  {
+    static constexpr std::array<size_t, TypesCount> kSizes = {1, 1, 1, 1, 2, 2, 4, 4,
+                                                              8, 8, 4, 8, 0, 2, 2};
+    const size_t size = vect_size * kSizes[static_cast<size_t>(field.type)];
+    if (size > buffer.size)
+    {
+      throw std::runtime_error("Buffer overflow");
+    }
+    buffer.trimFront(size);
+    return;
+  }
+  const FieldsVector& fields = types_list.at(field.type_name);
+  for (uint32_t a = 0; a < vect_size; a++)
+  {
+    for (const auto& sub_field : fields)
+    {
+      SkipField(sub_field, types_list, buffer);
+    }
+  }
+}
+
+// Same as SkipField, for the fields of the schema (not the custom types)
+inline void SkipSchemaField(const Schema& schema, const TypeField& field,
+                            BufferSpan& buffer)
+{
+  if (!IsPackedBool(schema, field))
+  {
+    SkipField(field, schema.custom_types, buffer);
+    return;
+  }
+  if (!field.is_vector)
+  {
+    // saved in the block of bools
+    return;
+  }
+  uint32_t vect_size = field.array_size;
+  if (vect_size == 0)
+  {
+    vect_size = Deserialize<uint32_t>(buffer);
+  }
+  const size_t size = (vect_size + 7) / 8;
+  if (size > buffer.size)
+  {
+    throw std::runtime_error("Buffer overflow");
+  }
+  buffer.trimFront(size);
+}
+
+inline bool DecodeDeltaPayload(const Schema& schema, const SnapshotView& snapshot)
+{
+  BufferSpan encoded = snapshot.payload;
+  const auto frame_type = Deserialize<uint8_t>(encoded);
+  auto& decoded = schema.previous_payload;
+  // older versions can't detect the missing frames
+  const bool has_index = schema.version >= 7;
+  const uint32_t frame_index = has_index ? Deserialize<uint32_t>(encoded) : 0;
+  const bool consecutive = !has_index || frame_index == schema.previous_frame + 1;
+  schema.previous_frame = frame_index;
+
+  if (frame_type == kKeyframe)
+  {
+    decoded.assign(encoded.data, encoded.data + encoded.size);
+    return true;
+  }
+  if (frame_type != kDeltaFrame)
+  {
+    throw std::runtime_error("Unknown frame type in delta encoding");
+  }
+  if (!consecutive)
+  {
+    // the previous frame is lost
+    decoded.clear();
+  }
+  if (decoded.empty())
+  {
+    // no keyframe received yet
+    return false;
+  }
+
+  BufferSpan changed_mask = {encoded.data, snapshot.active_mask.size};
+  const size_t bools_size = PackedBoolsBlockSize(schema, snapshot.active_mask);
+  if (changed_mask.size + bools_size > encoded.size || bools_size > decoded.size())
+  {
+    throw std::runtime_error("Buffer overflow");
+  }
+  encoded.trimFront(changed_mask.size);
+
+  // the block of bools is always included
+  thread_local std::vector<uint8_t> output;
+  output.assign(encoded.data, encoded.data + bools_size);
+  encoded.trimFront(bools_size);
+  BufferSpan previous = {decoded.data() + bools_size, decoded.size() - bools_size};
+
+  for (size_t i = 0; i < schema.fields.size(); i++)
+  {
+    if (!GetBit(snapshot.active_mask, i))
+    {
+      continue;
+    }
+    const auto& field = schema.fields[i];
+    const auto* previous_start = previous.data;
+    SkipSchemaField(schema, field, previous);
+
+    if (GetBit(changed_mask, i))
+    {
+      const auto* start = encoded.data;
+      SkipSchemaField(schema, field, encoded);
+      output.insert(output.end(), start, encoded.data);
+    }
+    else
+    {
+      output.insert(output.end(), previous_start, previous.data);
+    }
+  }
+  decoded.swap(output);
+  return true;
+}
+
 template <typename NumberCallback, typename CustomCallback>
 inline bool ParseSnapshot(const Schema& schema, SnapshotView snapshot,
                           const NumberCallback& callback_number,
@@ -425,13 +723,59 @@ inline bool ParseSnapshot(const Schema& schema, SnapshotView snapshot,
   }
   BufferSpan buffer = snapshot.payload;
 
+  if (schema.encoding == PayloadEncoding::DELTA)
+  {
+    if (!DecodeDeltaPayload(schema, snapshot))
+    {
+      return false;
+    }
+    buffer = {schema.previous_payload.data(), schema.previous_payload.size()};
+  }
+
+  const size_t bools_size = PackedBoolsBlockSize(schema, snapshot.active_mask);
+  if (bools_size > buffer.size)
+  {
+    throw std::runtime_error("Buffer overflow");
+  }
+  const BufferSpan bools_block = {buffer.data, bools_size};
+  buffer.trimFront(bools_size);
+  size_t bool_index = 0;
+
   for (size_t i = 0; i < schema.fields.size(); i++)
   {
     const auto& field = schema.fields[i];
-    if (GetBit(snapshot.active_mask, i))
+    if (!GetBit(snapshot.active_mask, i))
+    {
+      continue;
+    }
+    if (!IsPackedBool(schema, field))
     {
       ParseSnapshotRecursive(field, schema.custom_types, buffer, callback_number, "");
     }
+    else if (!field.is_vector)
+    {
+      callback_number(field.field_name, VarNumber(GetBit(bools_block, bool_index++)));
+    }
+    else
+    {
+      uint32_t vect_size = field.array_size;
+      if (vect_size == 0)
+      {
+        // dynamic vector
+        vect_size = Deserialize<uint32_t>(buffer);
+      }
+      const BufferSpan bits = {buffer.data, (vect_size + 7) / 8};
+      if (bits.size > buffer.size)
+      {
+        throw std::runtime_error("Buffer overflow");
+      }
+      buffer.trimFront(bits.size);
+      for (uint32_t a = 0; a < vect_size; a++)
+      {
+        const auto name = field.field_name + "[" + std::to_string(a) + "]";
+        callback_number(name, VarNumber(GetBit(bits, a)));
+      }
+    }
   }
   return true;
 }
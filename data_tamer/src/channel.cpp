@@ -1,42 +1,584 @@
 #include "data_tamer/channel.hpp"
 #include "data_tamer/data_sink.hpp"
+#include "data_tamer/details/snapshot_pool.hpp"
 #include "data_tamer/contrib/SerializeMe.hpp"
+#include "ConcurrentQueue/blockingconcurrentqueue.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
 #include <iostream>
+#include <thread>
 #include <unordered_map>
 
 namespace DataTamer
 {
 
+// Number of buffers in the SnapshotPool that are allocated in advance.
+static constexpr size_t kPreallocatedSnapshots = 4;
+
+// Sinks are selected using the bits of an uint64_t (see LogChannel::createSnapshot)
+static constexpr size_t kMaxSinksCount = 64;
+
 struct LogChannel::Pimpl
 {
-  struct ValueHolder
+  // data of a series that is not needed by takeSnapshot
+  struct SeriesInfo
   {
     std::string name;
-    bool enabled = true;
     bool registered = true;
-    ValuePtr holder;
+    // may be nullptr
+    CustomSerializer::Ptr type_info;
+  };
+
+  // Sequence of operations executed by takeSnapshot, computed once
+  // when the active mask changes (see buildSnapshotPlan).
+  struct SnapshotPlan
+  {
+    struct Step
+    {
+      // if value is nullptr, this step is a memcpy of [src, src + size)
+      const ValuePtr* value = nullptr;
+      const uint8_t* src = nullptr;
+      size_t size = 0;
+    };
+    std::vector<Step> steps;
+    // serialized size of all the enabled fixed-size series
+    size_t fixed_size = 0;
+    // enabled series whose size must be evaluated at each snapshot
+    std::vector<const ValuePtr*> variable_size_values;
+
+    struct Series
+    {
+      size_t index = 0;
+      const ValuePtr* value = nullptr;
+      // zero if the size is variable
+      size_t fixed_size = 0;
+    };
+    // all the enabled series, in order, but the bools. Used by the delta encoding
+    std::vector<Series> enabled_series;
+    // enabled bools, saved as bits at the beginning of the payload
+    std::vector<const ValuePtr*> bools;
   };
 
+  // State of the delta encoding (see LogChannel::setDeltaEncoding)
+  struct DeltaEncoder
+  {
+    // zero if delta encoding is disabled
+    uint32_t keyframe_period = 0;
+    uint32_t frames_since_keyframe = 0;
+    // written after the frame type, to detect the missing frames
+    uint32_t frame_index = 0;
+    // previous snapshot (not encoded) and the size of each of its series
+    bool has_previous = false;
+    PayloadVector previous_payload;
+    std::vector<size_t> previous_sizes;
+    // preallocated buffers
+    std::vector<size_t> sizes;
+    PayloadVector encoded;
+  };
+
+  // Used by the deferred serialization (see LogChannel::setDeferredSerialization).
+  // It is immutable once built, because it is shared with the jobs in the queue.
+  struct CapturePlan
+  {
+    struct Entry
+    {
+      // position and size of the value in the captured buffer
+      size_t offset = 0;
+      size_t size = 0;
+      // nullptr if the captured bytes are already serialized
+      CustomSerializer::Ptr serializer;
+      size_t elements_count = 1;
+      // array of bools, to be packed
+      bool packed_bools = false;
+    };
+    std::vector<Entry> entries;
+    // position of the enabled bools in the captured buffer
+    std::vector<size_t> bool_offsets;
+
+    struct Step
+    {
+      const uint8_t* src = nullptr;
+      size_t offset = 0;
+      size_t size = 0;
+    };
+    // memcpy executed by takeSnapshot
+    std::vector<Step> steps;
+    size_t capture_size = 0;
+    size_t payload_size = 0;
+    // all the enabled series (SnapshotPlan::Series::value is not used)
+    std::vector<SnapshotPlan::Series> enabled_series;
+  };
+
+  struct DeferredJob
+  {
+    SnapshotPtr captured;
+    std::shared_ptr<const CapturePlan> plan;
+    bool force_keyframe = false;
+    uint64_t targets = 0;
+  };
+
+  struct SinkState
+  {
+    // dedicated lane into the queue of the sink, or its shared lane
+    std::shared_ptr<DataSinkBase::Lane> lane;
+    SinkDecimation decimation;
+    uint64_t snapshots_count = 0;
+    bool has_pushed = false;
+    std::chrono::nanoseconds last_pushed = {};
+    // a new sink must receive a keyframe first (delta encoding only)
+    bool needs_keyframe = true;
+    // last value of DataSinkBase::keyframeRequests()
+    uint64_t keyframe_requests = 0;
+  };
+
+  ~Pimpl();
+
   std::string channel_name;
 
   mutable Mutex mutex;
 
-  std::vector<ValueHolder> series;
+  // The series are stored in parallel arrays with the same index, to keep
+  // the data used by takeSnapshot dense and separated from the rest.
+  std::vector<ValuePtr> values;
+  std::vector<uint8_t> enabled;
+  std::vector<SeriesInfo> series_info;
   std::unordered_map<std::string, size_t> registered_values;
 
   bool mask_dirty = true;
+  SnapshotPlan plan;
+  ActiveMask active_mask;
+  DeltaEncoder delta;
+
+  // buffers shared with the sinks
+  std::shared_ptr<SnapshotPool> snapshot_pool = SnapshotPool::create();
+
+  bool deferred = false;
+  std::shared_ptr<const CapturePlan> capture_plan;
+  std::thread deferred_thread;
+  std::atomic_bool deferred_run = false;
+  moodycamel::BlockingConcurrentQueue<DeferredJob> deferred_queue;
+  // captureSnapshot() is called by many threads (see ChannelsRegistry::takeSnapshotAll),
+  // but always holding the mutex: a single token keeps the snapshots in order
+  moodycamel::ProducerToken deferred_token{ deferred_queue };
 
-  Snapshot snapshot;
   Schema schema;
   bool logging_started = false;
 
-  std::unordered_set<std::shared_ptr<DataSinkBase>> sinks;
+  Clock::Ptr clock = std::make_shared<SystemClock>();
+
+  // true if the channel belongs to a ChannelsRegistry (see DataSinkBase::sharedLane)
+  bool shared_lanes = false;
+
+  // sinks and sinks_state have the same size and order
+  std::vector<std::shared_ptr<DataSinkBase>> sinks;
+  std::vector<SinkState> sinks_state;
+
+  // bit N is set if sinks[N] wants a snapshot with this timestamp
+  uint64_t selectSinks(std::chrono::nanoseconds timestamp);
+
+  // true if any of the targets is new, or called DataSinkBase::requestKeyframe,
+  // since its previous snapshot. The requests of the targets are consumed
+  bool keyframeRequested(uint64_t targets);
+
+  void buildSnapshotPlan();
+
+  void buildCapturePlan();
+
+  void encodeDelta(PayloadVector& payload,
+                   const std::vector<SnapshotPlan::Series>& enabled_series,
+                   size_t bools_size, size_t mask_size, bool force_keyframe);
+
+  bool captureSnapshot(std::chrono::nanoseconds timestamp, bool force_keyframe,
+                       uint64_t targets);
+
+  void serializeDeferred(DeferredJob& job);
+
+  void startDeferredThread();
+
+  void stopDeferredThread();
 };
 
+// true if the value can be copied by takeSnapshot and serialized later
+static bool IsCapturable(const ValuePtr& value, const CustomSerializer::Ptr& type_info)
+{
+  return value.captureSize() > 0 && value.isFixedSize() &&
+         (value.isRawCopy() || type_info || value.type() == BasicType::BOOL);
+}
+
+// true if the value is saved as a single bit, in the block of bools
+static bool IsPackedBool(const ValuePtr& value)
+{
+  return value.type() == BasicType::BOOL && !value.isVector();
+}
+
+static bool ReadBool(const ValuePtr& value)
+{
+  if (value.isRawCopy())
+  {
+    return *static_cast<const bool*>(value.data());
+  }
+  uint8_t byte = 0;
+  SerializeMe::SpanBytes buffer(&byte, 1);
+  value.serialize(buffer);
+  return byte != 0;
+}
+
+LogChannel::Pimpl::~Pimpl()
+{
+  stopDeferredThread();
+}
+
+void LogChannel::Pimpl::buildSnapshotPlan()
+{
+  plan.steps.clear();
+  plan.variable_size_values.clear();
+  plan.enabled_series.clear();
+  plan.bools.clear();
+  plan.fixed_size = 0;
+
+  for (size_t i = 0; i < values.size(); i++)
+  {
+    if (!enabled[i])
+    {
+      continue;
+    }
+    const auto& value = values[i];
+    if (IsPackedBool(value))
+    {
+      plan.bools.push_back(&value);
+      continue;
+    }
+    if (!value.isFixedSize())
+    {
+      plan.variable_size_values.push_back(&value);
+      plan.enabled_series.push_back({i, &value, 0});
+      plan.steps.push_back({&value, nullptr, 0});
+      continue;
+    }
+    const size_t size = value.getSerializedSize();
+    plan.fixed_size += size;
+    plan.enabled_series.push_back({i, &value, size});
+
+    if (!value.isRawCopy())
+    {
+      plan.steps.push_back({&value, nullptr, size});
+      continue;
+    }
+    // merge into the previous memcpy, if the two series are adjacent in memory
+    const auto* src = static_cast<const uint8_t*>(value.data());
+    if (!plan.steps.empty())
+    {
+      auto& prev = plan.steps.back();
+      if (!prev.value && prev.src + prev.size == src)
+      {
+        prev.size += size;
+        continue;
+      }
+    }
+    plan.steps.push_back({nullptr, src, size});
+  }
+  plan.fixed_size += details::PackedBoolsSize(plan.bools.size());
+}
+
+void LogChannel::Pimpl::encodeDelta(PayloadVector& payload,
+                                    const std::vector<SnapshotPlan::Series>& enabled_series,
+                                    size_t bools_size, size_t mask_size,
+                                    bool force_keyframe)
+{
+  delta.sizes.clear();
+  for (const auto& entry : enabled_series)
+  {
+    const size_t size =
+        entry.fixed_size != 0 ? entry.fixed_size : entry.value->getSerializedSize();
+    delta.sizes.push_back(size);
+  }
+
+  const bool keyframe = force_keyframe || !delta.has_previous ||
+                        (++delta.frames_since_keyframe >= delta.keyframe_period);
+  auto& encoded = delta.encoded;
+  constexpr size_t header_size = sizeof(uint8_t) + sizeof(uint32_t);
+  encoded.clear();
+
+  if (keyframe)
+  {
+    delta.frames_since_keyframe = 0;
+    encoded.resize(header_size);
+    encoded[0] = kKeyframe;
+    std::memcpy(&encoded[1], &delta.frame_index, sizeof(uint32_t));
+    encoded.insert(encoded.end(), payload.begin(), payload.end());
+  }
+  else
+  {
+    // header and bitmask of the changed series. The bools are always included
+    encoded.resize(header_size + mask_size, 0);
+    encoded[0] = kDeltaFrame;
+    std::memcpy(&encoded[1], &delta.frame_index, sizeof(uint32_t));
+    encoded.insert(encoded.end(), payload.begin(), payload.begin() + std::ptrdiff_t(bools_size));
+
+    const uint8_t* current = payload.data() + bools_size;
+    const uint8_t* previous = delta.previous_payload.data() + bools_size;
+    for (size_t k = 0; k < enabled_series.size(); k++)
+    {
+      const size_t size = delta.sizes[k];
+      const size_t previous_size = delta.previous_sizes[k];
+      if (size != previous_size || std::memcmp(current, previous, size) != 0)
+      {
+        const size_t index = enabled_series[k].index;
+        encoded[header_size + (index >> 3)] |= uint8_t(1 << (index % 8));
+        encoded.insert(encoded.end(), current, current + size);
+      }
+      current += size;
+      previous += previous_size;
+    }
+  }
+  // the current payload becomes the previous one. Buffers are swapped, not copied
+  delta.previous_payload.swap(payload);
+  delta.previous_sizes.swap(delta.sizes);
+  delta.has_previous = true;
+  delta.frame_index++;
+  payload.swap(encoded);
+}
+
+void LogChannel::Pimpl::buildCapturePlan()
+{
+  auto new_plan = std::make_shared<CapturePlan>();
+
+  for (size_t i = 0; i < values.size(); i++)
+  {
+    if (!enabled[i])
+    {
+      continue;
+    }
+    const auto& value = values[i];
+    const bool packed_bool = IsPackedBool(value);
+    CapturePlan::Entry entry;
+    entry.offset = new_plan->capture_size;
+    entry.size = value.captureSize();
+    if (packed_bool)
+    {
+      new_plan->bool_offsets.push_back(entry.offset);
+    }
+    else if (value.type() == BasicType::BOOL && !series_info[i].type_info)
+    {
+      entry.packed_bools = true;
+    }
+    else if (!value.isRawCopy())
+    {
+      // the serializer will read the captured object: it must be aligned
+      constexpr size_t alignment = alignof(std::max_align_t);
+      entry.offset = ((entry.offset + alignment - 1) / alignment) * alignment;
+      entry.serializer = series_info[i].type_info;
+      entry.elements_count = value.isVector() ? value.vectorSize() : 1;
+    }
+    new_plan->capture_size = entry.offset + entry.size;
+    if (!packed_bool)
+    {
+      const size_t serialized_size = value.getSerializedSize();
+      new_plan->payload_size += serialized_size;
+      new_plan->enabled_series.push_back({i, nullptr, serialized_size});
+      new_plan->entries.push_back(entry);
+    }
+
+    // merge into the previous memcpy, if the two series are adjacent in memory
+    const auto* src = static_cast<const uint8_t*>(value.data());
+    if (!new_plan->steps.empty())
+    {
+      auto& prev = new_plan->steps.back();
+      if (prev.src + prev.size == src && prev.offset + prev.size == entry.offset)
+      {
+        prev.size += entry.size;
+        continue;
+      }
+    }
+    new_plan->steps.push_back({src, entry.offset, entry.size});
+  }
+  new_plan->payload_size += details::PackedBoolsSize(new_plan->bool_offsets.size());
+  capture_plan = std::move(new_plan);
+}
+
+bool LogChannel::Pimpl::captureSnapshot(std::chrono::nanoseconds timestamp,
+                                        bool force_keyframe, uint64_t targets)
+{
+  auto captured = snapshot_pool->acquire();
+  captured->active_mask.assign(active_mask.begin(), active_mask.end());
+  captured->payload.resize(capture_plan->capture_size);
+  captured->schema_hash = schema.hash;
+  captured->timestamp = timestamp;
+  captured->channel_name = channel_name;
+
+  uint8_t* dst = captured->payload.data();
+  for (auto const& step : capture_plan->steps)
+  {
+    std::memcpy(dst + step.offset, step.src, step.size);
+  }
+  return deferred_queue.enqueue(
+      deferred_token, {std::move(captured), capture_plan, force_keyframe, targets});
+}
+
+void LogChannel::Pimpl::serializeDeferred(DeferredJob& job)
+{
+  if (!job.captured)
+  {
+    // pushed by stopDeferredThread
+    return;
+  }
+  const auto& captured = *job.captured;
+  auto snapshot = snapshot_pool->acquire();
+  snapshot->active_mask.assign(captured.active_mask.begin(), captured.active_mask.end());
+  snapshot->payload.resize(job.plan->payload_size);
+  snapshot->schema_hash = captured.schema_hash;
+  snapshot->timestamp = captured.timestamp;
+  snapshot->channel_name = captured.channel_name;
+
+  SerializeMe::SpanBytes payload_buffer(snapshot->payload.data(),
+                                        snapshot->payload.size());
+
+  const auto& bool_offsets = job.plan->bool_offsets;
+  const size_t bools_size = details::PackedBoolsSize(bool_offsets.size());
+  std::memset(payload_buffer.data(), 0, bools_size);
+  for (size_t k = 0; k < bool_offsets.size(); k++)
+  {
+    const uint8_t bit = captured.payload[bool_offsets[k]] != 0 ? 1 : 0;
+    payload_buffer.data()[k / 8] |= uint8_t(bit << (k % 8));
+  }
+  payload_buffer.trimFront(bools_size);
+
+  for (auto const& entry : job.plan->entries)
+  {
+    const uint8_t* src = captured.payload.data() + entry.offset;
+    if (entry.packed_bools)
+    {
+      details::PackBools(reinterpret_cast<const bool*>(src), entry.size,   // NOLINT
+                         payload_buffer.data());
+      payload_buffer.trimFront(details::PackedBoolsSize(entry.size));
+      continue;
+    }
+    if (!entry.serializer)
+    {
+      std::memcpy(payload_buffer.data(), src, entry.size);
+      payload_buffer.trimFront(entry.size);
+      continue;
+    }
+    const size_t stride = entry.size / entry.elements_count;
+    for (size_t k = 0; k < entry.elements_count; k++)
+    {
+      entry.serializer->serialize(src + k * stride, payload_buffer);
+    }
+  }
+  // give the captured buffer back to the pool
+  job.captured.reset();
+
+  // the sinks can be changed by addDataSink, in the meantime
+  std::lock_guard const lock(mutex);
+  if (delta.keyframe_period > 0)
+  {
+    const bool keyframe_requested = keyframeRequested(job.targets);
+    encodeDelta(snapshot->payload, job.plan->enabled_series, bools_size,
+                snapshot->active_mask.size(), job.force_keyframe || keyframe_requested);
+  }
+  WriteMessageHeader(*snapshot);
+
+  const SnapshotPtr shared_snapshot = std::move(snapshot);
+  for (size_t i = 0; i < sinks.size(); i++)
+  {
+    if (job.targets & (uint64_t(1) << i))
+    {
+      sinks[i]->pushSnapshot(*sinks_state[i].lane, shared_snapshot);
+    }
+  }
+}
+
+bool LogChannel::Pimpl::keyframeRequested(uint64_t targets)
+{
+  bool requested = false;
+  for (size_t i = 0; i < sinks.size(); i++)
+  {
+    if (!(targets & (uint64_t(1) << i)))
+    {
+      continue;
+    }
+    auto& state = sinks_state[i];
+    const uint64_t requests = sinks[i]->keyframeRequests();
+    if (state.needs_keyframe || requests != state.keyframe_requests)
+    {
+      state.needs_keyframe = false;
+      state.keyframe_requests = requests;
+      requested = true;
+    }
+  }
+  return requested;
+}
+
+uint64_t LogChannel::Pimpl::selectSinks(std::chrono::nanoseconds timestamp)
+{
+  uint64_t targets = 0;
+  for (size_t i = 0; i < sinks_state.size(); i++)
+  {
+    auto& state = sinks_state[i];
+    const auto& decimation = state.decimation;
+    if (state.snapshots_count++ % decimation.every_nth != 0)
+    {
+      continue;
+    }
+    if (decimation.min_period.count() > 0)
+    {
+      if (state.has_pushed && timestamp - state.last_pushed < decimation.min_period)
+      {
+        continue;
+      }
+      state.has_pushed = true;
+      state.last_pushed = timestamp;
+    }
+    targets |= (uint64_t(1) << i);
+  }
+  return targets;
+}
+
+void LogChannel::Pimpl::startDeferredThread()
+{
+  if (deferred_thread.joinable())
+  {
+    return;
+  }
+  deferred_run = true;
+  deferred_thread = std::thread([this]() {
+    DeferredJob job;
+    while (deferred_run)
+    {
+      // sleep until a job is pushed, or stopDeferredThread() is called
+      deferred_queue.wait_dequeue(job);
+      do
+      {
+        serializeDeferred(job);
+      } while (deferred_queue.try_dequeue(job));
+    }
+    // don't lose the snapshots taken before stopping
+    while (deferred_queue.try_dequeue(job))
+    {
+      serializeDeferred(job);
+    }
+  });
+}
+
+void LogChannel::Pimpl::stopDeferredThread()
+{
+  deferred_run = false;
+  if (deferred_thread.joinable())
+  {
+    // an empty job, to wake up the thread
+    deferred_queue.enqueue(DeferredJob{});
+    deferred_thread.join();
+  }
+}
+
 RegistrationID LogChannel::registerValueImpl(const std::string& name,
                                              ValuePtr&& value_ptr,
-                                             CustomSerializer::Ptr type_info)
+                                             CustomSerializer::Ptr type_info,
+                                             BasicType saved_type,
+                                             std::optional<Quantization> quantization)
 {
   if (name.find(' ') != std::string::npos)
   {
@@ -55,17 +597,36 @@ RegistrationID LogChannel::registerValueImpl(const std::string& name,
       throw std::runtime_error("Can't register a new value once recording started, "
                                "i.e. after takeShapshot was called the first time");
     }
-    // appending a new ValueHolder to series
+    if (_p->deferred && !IsCapturable(value_ptr, type_info))
+    {
+      throw std::runtime_error("Value [" + name + "] can not be registered: "
+                               "its serialization can not be deferred");
+    }
+    // appending a new series
     const auto type = value_ptr.type();
     const std::string type_name = type_info ? type_info->typeName() : ToStr(type);
-    TypeField field{name, type, type_name, value_ptr.isVector(), value_ptr.vectorSize()};
+    TypeField field;
+    field.field_name = name;
+    field.type = type;
+    field.type_name = type_name;
+    field.is_vector = value_ptr.isVector();
+    field.array_size = value_ptr.vectorSize();
+    if (saved_type != BasicType::OTHER)
+    {
+      // the variable is converted to saved_type by type_info
+      field.type = saved_type;
+      field.type_name = ToStr(saved_type);
+      field.quantization = quantization;
+    }
 
-    Pimpl::ValueHolder instance;
-    instance.name = name;
-    instance.holder = std::move(value_ptr);
-    _p->series.emplace_back(std::move(instance));
+    Pimpl::SeriesInfo info;
+    info.name = name;
+    info.type_info = type_info;
+    _p->values.emplace_back(std::move(value_ptr));
+    _p->enabled.push_back(1);
+    _p->series_info.emplace_back(std::move(info));
 
-    const size_t index = _p->series.size() - 1;
+    const size_t index = _p->values.size() - 1;
 
     _p->registered_values.insert({name, index});
 
@@ -89,22 +650,23 @@ RegistrationID LogChannel::registerValueImpl(const std::string& name,
   // trying to registered again an unregistered holder or to
   // overwite its holder
   const size_t index = it->second;
-  auto& instance = _p->series[index];
+  auto& info = _p->series_info[index];
 
   // check if the new holder is compatible
-  if (instance.holder != value_ptr)
+  if (_p->values[index] != value_ptr)
   {
     throw std::runtime_error("Can't change the type of a previously "
                              "registered value");
   }
 
   // if it was marked as NOT registered, we should registered it again
-  if (!instance.registered)
+  if (!info.registered)
   {
-    instance.registered = true;
+    info.registered = true;
   }
-  instance.enabled = true;
-  instance.holder = std::move(value_ptr);
+  _p->enabled[index] = 1;
+  _p->values[index] = std::move(value_ptr);
+  info.type_info = type_info;
   return {index, 1};
 }
 
@@ -133,10 +695,10 @@ void LogChannel::setEnabled(const RegistrationID& id, bool enable)
   std::lock_guard const lock(_p->mutex);
   for (size_t i = 0; i < id.fields_count; i++)
   {
-    auto& instance = _p->series[id.first_index + i];
-    if (instance.enabled != enable)
+    const size_t index = id.first_index + i;
+    if (bool(_p->enabled[index]) != enable)
     {
-      instance.enabled = enable;
+      _p->enabled[index] = enable ? 1 : 0;
       _p->mask_dirty = true;
     }
   }
@@ -147,15 +709,133 @@ void LogChannel::unregister(const RegistrationID& id)
   std::lock_guard const lock(_p->mutex);
   for (size_t i = 0; i < id.fields_count; i++)
   {
-    auto& instance = _p->series[id.first_index + i];
-    instance.registered = false;
-    instance.enabled = false;
+    const size_t index = id.first_index + i;
+    _p->series_info[index].registered = false;
+    _p->enabled[index] = 0;
+  }
+  _p->mask_dirty = true;
+}
+
+void LogChannel::addDataSink(std::shared_ptr<DataSinkBase> sink, SinkDecimation decimation)
+{
+  if (decimation.every_nth == 0)
+  {
+    throw std::runtime_error("SinkDecimation::every_nth can not be zero");
+  }
+  const bool decimated = decimation.every_nth > 1 || decimation.min_period.count() > 0;
+
+  std::lock_guard const lock(_p->mutex);
+  if (decimated && _p->delta.keyframe_period > 0)
+  {
+    throw std::runtime_error("SinkDecimation can not be used with the delta encoding");
+  }
+  auto it = std::find(_p->sinks.begin(), _p->sinks.end(), sink);
+  if (it != _p->sinks.end())
+  {
+    const auto index = size_t(it - _p->sinks.begin());
+    _p->sinks_state[index].decimation = decimation;
+    _p->sinks_state[index].snapshots_count = 0;
+    _p->sinks_state[index].has_pushed = false;
+    _p->sinks_state[index].last_pushed = {};
+    return;
+  }
+  if (_p->sinks.size() == kMaxSinksCount)
+  {
+    throw std::runtime_error("Too many sinks in channel [" + _p->channel_name + "]");
+  }
+  _p->sinks.push_back(sink);
+  _p->sinks_state.push_back({});
+  _p->sinks_state.back().lane = _p->shared_lanes ? sink->sharedLane() : sink->createLane();
+  _p->sinks_state.back().decimation = decimation;
+  // the other sinks received addChannel already, at the first takeSnapshot
+  if (_p->logging_started)
+  {
+    sink->addChannel(_p->channel_name, _p->schema);
   }
 }
 
-void LogChannel::addDataSink(std::shared_ptr<DataSinkBase> sink)
+void LogChannel::setDeltaEncoding(uint32_t keyframe_period)
 {
-  _p->sinks.insert(sink);
+  std::lock_guard const lock(_p->mutex);
+  if (_p->logging_started)
+  {
+    throw std::runtime_error("Can't change the encoding once recording started, "
+                             "i.e. after takeShapshot was called the first time");
+  }
+  if (keyframe_period > 0)
+  {
+    for (const auto& state : _p->sinks_state)
+    {
+      if (state.decimation.every_nth > 1 || state.decimation.min_period.count() > 0)
+      {
+        throw std::runtime_error("The delta encoding can not be used with SinkDecimation");
+      }
+    }
+  }
+  _p->delta.keyframe_period = keyframe_period;
+  _p->schema.encoding =
+      (keyframe_period > 0) ? PayloadEncoding::DELTA : PayloadEncoding::PLAIN;
+}
+
+void LogChannel::setDeferredSerialization(bool enable)
+{
+  std::lock_guard const lock(_p->mutex);
+  if (_p->logging_started)
+  {
+    throw std::runtime_error("Can't change the serialization mode once recording "
+                             "started, i.e. after takeShapshot was called the first time");
+  }
+  if (enable)
+  {
+    for (size_t i = 0; i < _p->values.size(); i++)
+    {
+      const auto& info = _p->series_info[i];
+      if (!IsCapturable(_p->values[i], info.type_info))
+      {
+        throw std::runtime_error("The serialization of value [" + info.name +
+                                 "] can not be deferred");
+      }
+    }
+    _p->startDeferredThread();
+  }
+  else
+  {
+    _p->stopDeferredThread();
+  }
+  _p->deferred = enable;
+  _p->mask_dirty = true;
+}
+
+void LogChannel::setClock(Clock::Ptr clock)
+{
+  if (!clock)
+  {
+    throw std::runtime_error("LogChannel::setClock: null clock");
+  }
+  std::lock_guard const lock(_p->mutex);
+  if (_p->logging_started)
+  {
+    throw std::runtime_error("Can't change the clock once recording started, "
+                             "i.e. after takeShapshot was called the first time");
+  }
+  setClockUnlocked(std::move(clock));
+}
+
+bool LogChannel::loggingStarted() const
+{
+  return _p->logging_started;
+}
+
+void LogChannel::setClockUnlocked(Clock::Ptr clock)
+{
+  _p->schema.clock = clock->name();
+  _p->clock = std::move(clock);
+}
+
+Clock::Ptr LogChannel::clock() const
+{
+  std::lock_guard const lock(_p->mutex);
+  return _p->clock;
 }
 
 Schema LogChannel::getSchema() const
@@ -175,74 +855,186 @@ void LogChannel::addCustomType(const std::string& custom_type_name,
   _p->schema.custom_types[custom_type_name] = fields;
 }
 
+bool LogChannel::takeSnapshot()
+{
+  // the clock is read with the mutex locked, as setClock changes it
+  std::lock_guard const lock(_p->mutex);
+  return takeSnapshotUnlocked(_p->clock->now());
+}
+
 bool LogChannel::takeSnapshot(std::chrono::nanoseconds timestamp)
 {
+  std::lock_guard const lock(_p->mutex);
+  return takeSnapshotUnlocked(timestamp);
+}
+
+bool LogChannel::takeSnapshotUnlocked(std::chrono::nanoseconds timestamp)
+{
+  SnapshotPtr shared_snapshot;
+  uint64_t targets = 0;
+  bool has_sinks = false;
+  if (!createSnapshot(timestamp, shared_snapshot, targets, has_sinks))
   {
-    std::lock_guard const lock(_p->mutex);
+    return false;
+  }
+  if (!shared_snapshot)
+  {
+    // deferred serialization (the snapshot will be pushed by deferred_thread)
+    // or decimated by all the sinks
+    return true;
+  }
 
-    if (_p->sinks.empty())
+  // all the sinks share the same buffer. It is pushed with the mutex locked:
+  // each lane receives the snapshots in the same order they were created
+  bool all_pushed = true;
+  for (size_t i = 0; i < _p->sinks.size(); i++)
+  {
+    if (targets & (uint64_t(1) << i))
     {
-      return false;
+      all_pushed &= _p->sinks[i]->pushSnapshot(*_p->sinks_state[i].lane, shared_snapshot);
     }
-    // update the _p->snapshot.active_mask if necessary
-    if (_p->mask_dirty)
+  }
+  return all_pushed;
+}
+
+bool LogChannel::createSnapshot(std::chrono::nanoseconds timestamp,
+                                SnapshotPtr& shared_snapshot, uint64_t& targets,
+                                bool& has_sinks)
+{
+  shared_snapshot.reset();
+  targets = 0;
+  has_sinks = !_p->sinks.empty();
+  if (!has_sinks)
+  {
+    return false;
+  }
+  // update the _p->active_mask if necessary
+  const bool plan_changed = _p->mask_dirty;
+  if (_p->mask_dirty)
+  {
+    _p->mask_dirty = false;
+    auto& mask = _p->active_mask;
+    mask.clear();
+    const auto vect_size = (_p->values.size() + 7) / 8;   // ceiling size
+    mask.resize(vect_size, 0xFF);
+    for (size_t i = 0; i < _p->values.size(); i++)
     {
-      _p->mask_dirty = false;
-      auto& mask = _p->snapshot.active_mask;
-      mask.clear();
-      const auto vect_size = (_p->series.size() + 7) / 8;   // ceiling size
-      mask.resize(vect_size, 0xFF);
-      for (size_t i = 0; i < _p->series.size(); i++)
+      if (!_p->enabled[i])
       {
-        auto const& instance = _p->series[i];
-        if (!instance.enabled)
-        {
-          SetBit(mask, i, false);
-        }
+        SetBit(mask, i, false);
       }
     }
+    _p->buildSnapshotPlan();
+    if (_p->deferred)
+    {
+      _p->buildCapturePlan();
+    }
+  }
 
-    size_t payload_size = 0;
-    for (size_t i = 0; i < _p->series.size(); i++)
+  // only the size of the variable-size series need to be computed
+  size_t payload_size = _p->plan.fixed_size;
+  for (const auto* value : _p->plan.variable_size_values)
+  {
+    payload_size += value->getSerializedSize();
+  }
+  if (plan_changed)
+  {
+    // pre-allocate the buffers, to avoid allocations in the following snapshots
+    if (_p->deferred)
+    {
+      // both the captured and the serialized snapshots use the pool
+      payload_size = std::max(payload_size, _p->capture_plan->capture_size);
+      _p->snapshot_pool->reserve(2 * kPreallocatedSnapshots, _p->active_mask.size(),
+                                 payload_size);
+    }
+    else
     {
-      auto const& instance = _p->series[i];
-      payload_size += instance.holder.getSerializedSize();
+      _p->snapshot_pool->reserve(kPreallocatedSnapshots, _p->active_mask.size(),
+                                 payload_size);
     }
-    _p->snapshot.payload.resize(payload_size);
+  }
 
-    // call sink->addChannel (usually done once)
-    if (!_p->logging_started)
+  // call sink->addChannel (usually done once)
+  if (!_p->logging_started)
+  {
+    _p->logging_started = true;
+    for (auto const& sink : _p->sinks)
     {
-      _p->logging_started = true;
-      _p->snapshot.schema_hash = _p->schema.hash;
-      for (auto const& sink : _p->sinks)
-      {
-        sink->addChannel(_p->channel_name, _p->schema);
-      }
+      sink->addChannel(_p->channel_name, _p->schema);
     }
+  }
+
+  targets = _p->selectSinks(timestamp);
+  if (targets == 0)
+  {
+    // none of the sinks wants this snapshot
+    return true;
+  }
+
+  if (_p->deferred)
+  {
+    // the sinks are called by deferred_thread
+    return _p->captureSnapshot(timestamp, plan_changed, targets);
+  }
 
-    _p->snapshot.timestamp = timestamp;
-    _p->snapshot.channel_name = channelName();
+  // the buffer is recycled: assign() and resize() usually don't allocate
+  auto snapshot = _p->snapshot_pool->acquire();
+  snapshot->active_mask.assign(_p->active_mask.begin(), _p->active_mask.end());
+  snapshot->payload.resize(payload_size);
+  snapshot->schema_hash = _p->schema.hash;
+  snapshot->timestamp = timestamp;
+  snapshot->channel_name = channelName();
 
-    // serialize data into _p->snapshot.payload
-    SerializeMe::SpanBytes payload_buffer(_p->snapshot.payload);
+  // serialize data into snapshot->payload
+  SerializeMe::SpanBytes payload_buffer(snapshot->payload.data(),
+                                      snapshot->payload.size());
 
-    for (auto const& entry : _p->series)
+  // the bools are packed at the beginning of the payload
+  const auto& bools = _p->plan.bools;
+  const size_t bools_size = details::PackedBoolsSize(bools.size());
+  std::memset(payload_buffer.data(), 0, bools_size);
+  for (size_t k = 0; k < bools.size(); k++)
+  {
+    const uint8_t bit = ReadBool(*bools[k]) ? 1 : 0;
+    payload_buffer.data()[k / 8] |= uint8_t(bit << (k % 8));
+  }
+  payload_buffer.trimFront(bools_size);
+
+  for (auto const& step : _p->plan.steps)
+  {
+    if (step.value)
     {
-      if (entry.enabled)
-      {
-        entry.holder.serialize(payload_buffer);
-      }
+      step.value->serialize(payload_buffer);
+    }
+    else
+    {
+      std::memcpy(payload_buffer.data(), step.src, step.size);
+      payload_buffer.trimFront(step.size);
     }
-    _p->snapshot.payload.resize(_p->snapshot.payload.size() - payload_buffer.size());
   }
+  snapshot->payload.resize(snapshot->payload.size() - payload_buffer.size());
 
-  bool all_pushed = true;
-  for (auto& sink : _p->sinks)
+  if (_p->delta.keyframe_period > 0)
   {
-    all_pushed &= sink->pushSnapshot(_p->snapshot);
+    // a new plan means that the active mask changed
+    const bool keyframe_requested = _p->keyframeRequested(targets);
+    _p->encodeDelta(snapshot->payload, _p->plan.enabled_series, bools_size,
+                    _p->active_mask.size(), plan_changed || keyframe_requested);
   }
-  return all_pushed;
+  WriteMessageHeader(*snapshot);
+  shared_snapshot = std::move(snapshot);
+  return true;
+}
+
+const std::vector<std::shared_ptr<DataSinkBase>>& LogChannel::dataSinks() const
+{
+  return _p->sinks;
+}
+
+void LogChannel::useSharedLanes()
+{
+  std::lock_guard const lock(_p->mutex);
+  _p->shared_lanes = true;
 }
 
 }   // namespace DataTamer
@@ -0,0 +1,154 @@
+#include "data_tamer/clock.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <thread>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64)
+#define DATA_TAMER_HAS_TSC
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#endif
+
+namespace DataTamer
+{
+
+static std::chrono::nanoseconds SystemNow()
+{
+  return SystemClock().now();
+}
+
+#ifdef CLOCK_MONOTONIC_COARSE
+static std::chrono::nanoseconds MonotonicCoarseNow()
+{
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+  return std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+}
+#else
+// fallback when CLOCK_MONOTONIC_COARSE is not available
+static std::chrono::nanoseconds MonotonicCoarseNow()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch());
+}
+#endif
+
+CoarseMonotonicClock::CoarseMonotonicClock() :
+  offset_(SystemNow() - MonotonicCoarseNow())
+{}
+
+std::chrono::nanoseconds CoarseMonotonicClock::now() const
+{
+  return MonotonicCoarseNow() + offset_;
+}
+
+#ifdef DATA_TAMER_HAS_TSC
+
+// larger errors are corrected with a jump, instead of slewing. The slew
+// changes the frequency by at most 10%
+static constexpr double kMaxSlewNsec = 1e6;
+static constexpr double kMaxSlewRatio = 0.1;
+
+TscClock::TscClock(std::chrono::milliseconds calibration_time,
+                   std::chrono::milliseconds recalibration_period)
+{
+  const auto nsec_start = SystemNow();
+  const uint64_t tsc_start = __rdtsc();
+  std::this_thread::sleep_for(calibration_time);
+  const auto nsec_end = SystemNow();
+  const uint64_t tsc_end = __rdtsc();
+
+  if (tsc_end <= tsc_start || nsec_end <= nsec_start)
+  {
+    throw std::runtime_error("TscClock: calibration failed");
+  }
+  Calibration calibration;
+  calibration.nsec_per_tick =
+      double((nsec_end - nsec_start).count()) / double(tsc_end - tsc_start);
+  calibration.tsc_origin = tsc_end;
+  calibration.nsec_origin = nsec_end.count();
+  calibration.tsc_start = tsc_start;
+  calibration.nsec_start = nsec_start.count();
+  calibration_.store(calibration);
+
+  if (recalibration_period.count() > 0)
+  {
+    const auto period_nsec = std::chrono::nanoseconds(recalibration_period).count();
+    recalibration_ticks_ = uint64_t(double(period_nsec) / calibration.nsec_per_tick);
+    next_recalibration_ = tsc_end + recalibration_ticks_;
+  }
+}
+
+std::chrono::nanoseconds TscClock::now() const
+{
+  const uint64_t tsc = __rdtsc();
+  if (recalibration_ticks_ > 0)
+  {
+    uint64_t next = next_recalibration_.load(std::memory_order_relaxed);
+    if (tsc >= next && next_recalibration_.compare_exchange_strong(
+                           next, tsc + recalibration_ticks_, std::memory_order_relaxed))
+    {
+      recalibrate(tsc);
+    }
+  }
+  const Calibration calibration = calibration_.load();
+  const int64_t ticks = int64_t(tsc - calibration.tsc_origin);
+  return std::chrono::nanoseconds(calibration.nsec_origin +
+                                  int64_t(double(ticks) * calibration.nsec_per_tick));
+}
+
+void TscClock::recalibrate(uint64_t tsc) const
+{
+  const int64_t nsec = SystemNow().count();
+  Calibration calibration = calibration_.load();
+  const int64_t estimated = calibration.nsec_origin +
+      int64_t(double(int64_t(tsc - calibration.tsc_origin)) * calibration.nsec_per_tick);
+
+  const double error = double(estimated - nsec);
+  const double period_nsec = double(recalibration_ticks_) * calibration.nsec_per_tick;
+  const double max_slew = std::min(kMaxSlewNsec, period_nsec * kMaxSlewRatio);
+
+  calibration.tsc_origin = tsc;
+  if (std::abs(error) > max_slew || nsec <= calibration.nsec_start ||
+      tsc <= calibration.tsc_start)
+  {
+    // the system_clock jumped: restart from it
+    calibration.nsec_origin = nsec;
+    calibration.tsc_start = tsc;
+    calibration.nsec_start = nsec;
+    calibration_.store(calibration);
+    return;
+  }
+  // frequency measured over the whole time since the first calibration.
+  // The error accumulated so far is recovered during the next period
+  const double nsec_per_tick = double(nsec - calibration.nsec_start) /
+                               double(tsc - calibration.tsc_start);
+  calibration.nsec_origin = estimated;
+  calibration.nsec_per_tick = nsec_per_tick * (1.0 - error / period_nsec);
+  calibration_.store(calibration);
+}
+
+#else
+
+TscClock::TscClock(std::chrono::milliseconds, std::chrono::milliseconds)
+{
+  throw std::runtime_error("TscClock is available only on x86");
+}
+
+std::chrono::nanoseconds TscClock::now() const
+{
+  return {};
+}
+
+void TscClock::recalibrate(uint64_t) const
+{}
+
+#endif
+
+}   // namespace DataTamer
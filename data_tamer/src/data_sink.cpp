@@ -1,37 +1,577 @@
 #include "data_tamer/data_sink.hpp"
+#include "data_tamer/details/mutex.hpp"
+#include "data_tamer/sink_executor.hpp"
 #include "ConcurrentQueue/concurrentqueue.h"
+#include "ConcurrentQueue/lightweightsemaphore.h"
 
+#include <algorithm>
+#include <array>
 #include <atomic>
+#include <cstring>
+#include <mutex>
 #include <thread>
+#include <tuple>
 
 namespace DataTamer
 {
 
+// maximum number of snapshots passed to storeSnapshots
+static constexpr size_t kMaxBatchSize = 64;
+// batches stored by SinkExecutor, before moving to the next sink
+static constexpr size_t kMaxBatchesPerRun = 16;
+// channels whose dropped snapshots are counted separately (SinkStatistics::channels_dropped)
+static constexpr size_t kMaxDroppedChannels = 256;
+
+struct DataSinkBase::Lane
+{
+  Lane(moodycamel::ConcurrentQueue<SnapshotPtr>& queue, bool is_shared) :
+    token(queue), shared(is_shared)
+  {}
+
+  moodycamel::ProducerToken token;
+  // only the shared lane is locked (see sharedLane)
+  const bool shared;
+  Mutex mutex;
+};
+
 struct DataSinkBase::Pimpl
 {
-  Pimpl(DataSinkBase* self)
+  // Runs storeSnapshots in the threads of a SinkExecutor
+  struct ExecutorTask : public SinkExecutor::Task
   {
-    run = true;
+    bool run() override;
+
+    // nullptr once the sink is detached from the executor
+    Pimpl* pimpl = nullptr;
+    std::mutex mutex;
+    // true if the task is in the queue of the executor, or running
+    std::atomic_bool scheduled = false;
+    std::array<SnapshotPtr, kMaxBatchSize> dequeued;
+    std::vector<SnapshotPtr> batch;
+  };
+
+  Pimpl(DataSinkBase* sink) : self(sink)
+  {
+    shared_lane = std::make_shared<Lane>(queue, true);
+    if (const auto default_executor = DefaultExecutor())
+    {
+      attachExecutor(default_executor);
+    }
+    else
+    {
+      startThread();
+    }
+  }
+
+  static std::shared_ptr<SinkExecutor>& DefaultExecutor()
+  {
+    static std::shared_ptr<SinkExecutor> default_executor;
+    return default_executor;
+  }
 
-    thread = std::thread([this, self]() {
-      Snapshot snapshot_copy;
+  void startThread()
+  {
+    run = true;
+    thread = std::thread([this]() {
+      std::array<SnapshotPtr, kMaxBatchSize> dequeued;
+      std::vector<SnapshotPtr> batch;
+      batch.reserve(kMaxBatchSize);
       while (run)
       {
-        while (queue.try_dequeue(snapshot_copy))
+        size_t count = waitSnapshots(dequeued.data());
+        while (count > 0)
         {
-          self->storeSnapshot(snapshot_copy);
+          storeBatch(dequeued.data(), count, batch);
+          count = queue.try_dequeue_bulk(dequeued.data(), kMaxBatchSize);
         }
-        // avoid busy loop
-        std::this_thread::sleep_for(std::chrono::microseconds(250));
       }
     });
   }
 
+  void stopThread()
+  {
+    run = false;
+    if (thread.joinable())
+    {
+      // wake up the thread, if it is waiting
+      wake_up.signal();
+      thread.join();
+    }
+  }
+
+  // called after pushing into the queue
+  void notifyConsumer()
+  {
+    if (task)
+    {
+      notifyExecutor();
+      return;
+    }
+    // see waitSnapshots()
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleeping.load())
+    {
+      wake_up.signal();
+    }
+  }
+
+  void attachExecutor(const std::shared_ptr<SinkExecutor>& new_executor)
+  {
+    executor = new_executor;
+    task = std::make_shared<ExecutorTask>();
+    task->pimpl = this;
+    task->batch.reserve(kMaxBatchSize);
+    // snapshots pushed before
+    if (queue.size_approx() > 0)
+    {
+      notifyExecutor();
+    }
+  }
+
+  // the snapshots still in the queue are stored by the calling thread
+  void detachExecutor()
+  {
+    if (!task)
+    {
+      return;
+    }
+    {
+      std::scoped_lock lk(task->mutex);
+      while (size_t count = queue.try_dequeue_bulk(task->dequeued.data(), kMaxBatchSize))
+      {
+        storeBatch(task->dequeued.data(), count, task->batch);
+      }
+      task->pimpl = nullptr;
+    }
+    task.reset();
+    executor.reset();
+  }
+
+  void notifyExecutor()
+  {
+    // see ExecutorTask::run()
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!task->scheduled.load() && !task->scheduled.exchange(true))
+    {
+      executor->schedule(task);
+    }
+  }
+
+  // pass the dequeued snapshots to storeSnapshots
+  void storeBatch(SnapshotPtr* dequeued, size_t count, std::vector<SnapshotPtr>& batch)
+  {
+    size_t batch_bytes = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+      batch_bytes += SnapshotSize(*dequeued[i]);
+      batch.push_back(std::move(dequeued[i]));
+    }
+    if (!batch.empty())
+    {
+      release(batch.size(), batch_bytes);
+      countChannels(batch);
+      const auto start = std::chrono::steady_clock::now();
+      self->storeSnapshots(batch);
+      const auto elapsed = std::chrono::steady_clock::now() - start;
+
+      // give the buffers back as soon as possible, before counting them as stored
+      const size_t stored_count = batch.size();
+      batch.clear();
+      stored += stored_count;
+      bytes_out += batch_bytes;
+      auto usec = uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+      size_t bucket = 0;
+      while (usec > 0 && bucket + 1 < store_latency.size())
+      {
+        usec >>= 1;
+        bucket++;
+      }
+      store_latency[bucket]++;
+    }
+  }
+
+  void countChannels(const std::vector<SnapshotPtr>& batch)
+  {
+    std::scoped_lock lk(channels_mutex);
+    for (const auto& snapshot : batch)
+    {
+      auto& counter = channel_counters[snapshot->schema_hash];
+      if (counter.count++ == 0)
+      {
+        counter.name = snapshot->channel_name;
+      }
+    }
+  }
+
+  // The following delta frames of the channel can't be decoded without the
+  // dropped snapshot: all the channels are asked for a keyframe.
+  // Called by the producers: it never locks. The first snapshot dropped by a
+  // channel claims a slot of drop_slots (open addressing, by schema hash)
+  void countDropped(const Snapshot& snapshot)
+  {
+    keyframe_requests++;
+    for (size_t i = 0; i < drop_slots.size(); i++)
+    {
+      auto& slot = drop_slots[(snapshot.schema_hash + i) % drop_slots.size()];
+      int state = slot.state.load(std::memory_order_acquire);
+      if (state == DropSlot::FREE &&
+          slot.state.compare_exchange_strong(state, DropSlot::CLAIMED))
+      {
+        slot.hash = snapshot.schema_hash;
+        slot.name = snapshot.channel_name;
+        slot.dropped.fetch_add(1, std::memory_order_relaxed);
+        slot.state.store(DropSlot::READY, std::memory_order_release);
+        return;
+      }
+      // another producer is claiming this slot
+      while (state == DropSlot::CLAIMED)
+      {
+        state = slot.state.load(std::memory_order_acquire);
+      }
+      if (slot.hash == snapshot.schema_hash)
+      {
+        slot.dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+      }
+    }
+    // too many channels: counted only by DropCounters
+  }
+
+  void countEnqueued(size_t count, size_t bytes)
+  {
+    enqueued += count;
+    bytes_in += bytes;
+    const size_t depth = queued_count.load(std::memory_order_relaxed);
+    size_t high_water = queue_high_water.load(std::memory_order_relaxed);
+    while (depth > high_water && !queue_high_water.compare_exchange_weak(high_water, depth))
+    {
+    }
+  }
+
+  // spin for spin_time, then sleep until a snapshot is pushed, or stopThread.
+  // Returns the number of snapshots dequeued (it may be zero)
+  size_t waitSnapshots(SnapshotPtr* snapshots)
+  {
+    size_t count = queue.try_dequeue_bulk(snapshots, kMaxBatchSize);
+    if (count > 0)
+    {
+      return count;
+    }
+    const auto spin_time = std::chrono::microseconds(spin_usec.load(std::memory_order_relaxed));
+    if (spin_time.count() > 0)
+    {
+      const auto deadline = std::chrono::steady_clock::now() + spin_time;
+      while (queue.size_approx() == 0 && std::chrono::steady_clock::now() < deadline)
+      {
+      }
+    }
+    // A producer that didn't see sleeping == true didn't signal wake_up:
+    // check the queue once more, after setting the flag
+    sleeping = true;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (queue.size_approx() == 0 && run)
+    {
+      wake_up.wait();
+    }
+    sleeping = false;
+    return queue.try_dequeue_bulk(snapshots, kMaxBatchSize);
+  }
+
+  static size_t SnapshotSize(const Snapshot& snapshot)
+  {
+    return snapshot.payload.size() + snapshot.active_mask.size();
+  }
+
+  // Counts the snapshot as part of the queue. Returns false, and undoes it,
+  // if the limits are exceeded.
+  bool tryReserve(size_t size)
+  {
+    const size_t prev_count = queued_count.fetch_add(1);
+    const size_t prev_bytes = queued_bytes.fetch_add(size);
+    const size_t max_snapshots = limit_snapshots.load(std::memory_order_relaxed);
+    const size_t max_bytes = limit_bytes.load(std::memory_order_relaxed);
+    // a single snapshot larger than max_bytes is accepted by an empty queue
+    if ((max_snapshots == 0 || prev_count < max_snapshots) &&
+        (max_bytes == 0 || prev_bytes == 0 || prev_bytes + size <= max_bytes))
+    {
+      return true;
+    }
+    // no need to wake up the blocked producers: the space is the same as before
+    queued_count.fetch_sub(1);
+    queued_bytes.fetch_sub(size);
+    return false;
+  }
+
+  void release(size_t count, size_t bytes)
+  {
+    queued_count.fetch_sub(count);
+    queued_bytes.fetch_sub(bytes);
+    // see waitSpace()
+    if (blocked_producers.load() > 0)
+    {
+      std::scoped_lock lk(space_mutex);
+      space_cv.notify_all();
+    }
+  }
+
+  bool lessThanHalfFull() const
+  {
+    const size_t max_snapshots = limit_snapshots.load(std::memory_order_relaxed);
+    const size_t max_bytes = limit_bytes.load(std::memory_order_relaxed);
+    return (max_snapshots == 0 || queued_count.load() * 2 < max_snapshots) &&
+           (max_bytes == 0 || queued_bytes.load() * 2 < max_bytes);
+  }
+
+  // OverflowPolicy::BLOCK
+  bool waitSpace(size_t size)
+  {
+    const auto timeout = std::chrono::microseconds(block_usec.load(std::memory_order_relaxed));
+    std::unique_lock lk(space_mutex);
+    blocked_producers++;
+    const bool reserved = space_cv.wait_for(lk, timeout, [&]() { return tryReserve(size); });
+    blocked_producers--;
+    return reserved;
+  }
+
+  // OverflowPolicy::DROP_OLDEST. The queue is FIFO only within a producer (Lane):
+  // the evicted snapshot is the oldest of one of them, and it may belong to
+  // any channel, not necessarily the one of the new snapshot.
+  // The queue contains only snapshots, therefore the producers can dequeue
+  // without stealing anything else from the consumer
+  bool evictUntilReserved(size_t size)
+  {
+    SnapshotPtr oldest;
+    while (!tryReserve(size))
+    {
+      if (!queue.try_dequeue(oldest))
+      {
+        return false;
+      }
+      release(1, SnapshotSize(*oldest));
+      evicted++;
+      countDropped(*oldest);
+      oldest.reset();
+    }
+    return true;
+  }
+
+  // OverflowPolicy::DECIMATE. Returns false if the snapshot must be skipped
+  bool keepDecimated()
+  {
+    uint32_t factor = decimation.load(std::memory_order_relaxed);
+    if (factor == 1)
+    {
+      return true;
+    }
+    if (lessThanHalfFull())
+    {
+      factor = std::max(factor / 2, 1u);
+      decimation.store(factor, std::memory_order_relaxed);
+    }
+    return (decimation_count++ % factor) == 0;
+  }
+
+  // token may be nullptr
+  bool push(const SnapshotPtr& snapshot, moodycamel::ProducerToken* token)
+  {
+    const size_t size = SnapshotSize(*snapshot);
+    const auto policy = static_cast<OverflowPolicy>(limit_policy.load(std::memory_order_relaxed));
+    bool reserved = false;
+    switch (policy)
+    {
+      case OverflowPolicy::DROP_NEWEST:
+        reserved = tryReserve(size);
+        break;
+      case OverflowPolicy::DROP_OLDEST:
+        reserved = evictUntilReserved(size);
+        break;
+      case OverflowPolicy::BLOCK:
+        reserved = tryReserve(size) || waitSpace(size);
+        break;
+      case OverflowPolicy::DECIMATE:
+        if (!keepDecimated())
+        {
+          decimated++;
+          countDropped(*snapshot);
+          return false;
+        }
+        reserved = tryReserve(size);
+        if (!reserved)
+        {
+          const uint32_t factor = decimation.load(std::memory_order_relaxed);
+          decimation.store(std::min(factor * 2, kMaxDecimation), std::memory_order_relaxed);
+        }
+        break;
+    }
+    if (!reserved)
+    {
+      rejected++;
+      countDropped(*snapshot);
+      return false;
+    }
+    const bool in_queue = token ? queue.enqueue(*token, snapshot) : queue.enqueue(snapshot);
+    if (!in_queue)
+    {
+      release(1, size);
+      rejected++;
+      countDropped(*snapshot);
+      return false;
+    }
+    countEnqueued(1, size);
+    notifyConsumer();
+    return true;
+  }
+
+  static constexpr uint32_t kMaxDecimation = 1024;
+
+  DataSinkBase* self = nullptr;
   std::thread thread;
   std::atomic_bool run = true;
-  moodycamel::ConcurrentQueue<Snapshot> queue;
+  std::atomic<int64_t> spin_usec = 0;
+  moodycamel::ConcurrentQueue<SnapshotPtr> queue;
+  // the thread sleeps on it, when the queue is empty (see waitSnapshots)
+  moodycamel::LightweightSemaphore wake_up;
+  std::atomic_bool sleeping = false;
+  // destroyed before the queue
+  std::shared_ptr<Lane> shared_lane;
+
+  // snapshots in the queue, and their size
+  std::atomic<size_t> queued_count = 0;
+  std::atomic<size_t> queued_bytes = 0;
+
+  std::atomic<size_t> limit_snapshots = 0;
+  std::atomic<size_t> limit_bytes = 0;
+  std::atomic<int> limit_policy = int(OverflowPolicy::DROP_NEWEST);
+  std::atomic<int64_t> block_usec = 0;
+
+  std::mutex space_mutex;
+  std::condition_variable space_cv;
+  std::atomic<int> blocked_producers = 0;
+
+  std::atomic<uint32_t> decimation = 1;
+  std::atomic<uint64_t> decimation_count = 0;
+
+  std::atomic<uint64_t> rejected = 0;
+  std::atomic<uint64_t> evicted = 0;
+  std::atomic<uint64_t> decimated = 0;
+
+  std::atomic<uint64_t> keyframe_requests = 0;
+
+  // statistics
+  std::atomic<size_t> queue_high_water = 0;
+  std::atomic<uint64_t> enqueued = 0;
+  std::atomic<uint64_t> stored = 0;
+  std::atomic<uint64_t> bytes_in = 0;
+  std::atomic<uint64_t> bytes_out = 0;
+  std::array<std::atomic<uint64_t>, std::tuple_size_v<decltype(SinkStatistics::store_latency)>>
+      store_latency = {};
+
+  struct ChannelCounter
+  {
+    std::string name;
+    uint64_t count = 0;
+  };
+  // key: schema hash. Updated by the sink thread, once per batch
+  std::unordered_map<size_t, ChannelCounter> channel_counters;
+  std::mutex channels_mutex;
+
+  struct DropSlot
+  {
+    enum State : int
+    {
+      FREE,
+      CLAIMED,
+      READY
+    };
+    std::atomic<int> state = FREE;
+    // written once, before state becomes READY
+    size_t hash = 0;
+    std::string name;
+    std::atomic<uint64_t> dropped = 0;
+  };
+  // snapshots dropped by each channel (see countDropped)
+  std::array<DropSlot, kMaxDroppedChannels> drop_slots;
+
+  // used instead of thread, if the sink uses a SinkExecutor
+  std::shared_ptr<SinkExecutor> executor;
+  std::shared_ptr<ExecutorTask> task;
 };
 
+bool DataSinkBase::Pimpl::ExecutorTask::run()
+{
+  std::scoped_lock lk(mutex);
+  if (!pimpl)
+  {
+    scheduled = false;
+    return false;
+  }
+  // a limited number of batches, not to starve the other sinks of the executor
+  for (size_t i = 0; i < kMaxBatchesPerRun; i++)
+  {
+    const size_t count = pimpl->queue.try_dequeue_bulk(dequeued.data(), kMaxBatchSize);
+    if (count == 0)
+    {
+      // A producer that saw scheduled == true didn't schedule this task:
+      // check the queue once more, after clearing the flag
+      scheduled = false;
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      return pimpl->queue.size_approx() > 0 && !scheduled.exchange(true);
+    }
+    pimpl->storeBatch(dequeued.data(), count, batch);
+  }
+  return true;
+}
+
+void WriteMessageHeader(Snapshot& snapshot)
+{
+  const auto mask_size = uint32_t(snapshot.active_mask.size());
+  const auto payload_size = uint32_t(snapshot.payload.size());
+  const size_t header_size = sizeof(uint32_t) * 2 + mask_size;
+  if (header_size > kPayloadHeadroom || snapshot.payload.data() == nullptr)
+  {
+    return;
+  }
+  uint8_t* dst = snapshot.payload.data() - header_size;
+  std::memcpy(dst, &mask_size, sizeof(uint32_t));
+  dst += sizeof(uint32_t);
+  if (mask_size > 0)
+  {
+    std::memcpy(dst, snapshot.active_mask.data(), mask_size);
+  }
+  dst += mask_size;
+  std::memcpy(dst, &payload_size, sizeof(uint32_t));
+}
+
+const uint8_t* GetFramedMessage(const Snapshot& snapshot, size_t& size)
+{
+  const auto mask_size = uint32_t(snapshot.active_mask.size());
+  const auto payload_size = uint32_t(snapshot.payload.size());
+  const size_t header_size = sizeof(uint32_t) * 2 + mask_size;
+  if (header_size > kPayloadHeadroom || snapshot.payload.data() == nullptr)
+  {
+    return nullptr;
+  }
+  const uint8_t* message = snapshot.payload.data() - header_size;
+  const uint8_t* ptr = message;
+  // the header might be stale, if the snapshot was modified after takeSnapshot
+  if (std::memcmp(ptr, &mask_size, sizeof(uint32_t)) != 0)
+  {
+    return nullptr;
+  }
+  ptr += sizeof(uint32_t);
+  if (mask_size > 0 && std::memcmp(ptr, snapshot.active_mask.data(), mask_size) != 0)
+  {
+    return nullptr;
+  }
+  ptr += mask_size;
+  if (std::memcmp(ptr, &payload_size, sizeof(uint32_t)) != 0)
+  {
+    return nullptr;
+  }
+  size = header_size + payload_size;
+  return message;
+}
+
 DataSinkBase::DataSinkBase() : _p(new Pimpl(this))
 {}
 
@@ -40,18 +580,173 @@ DataSinkBase::~DataSinkBase()
   stopThread();
 }
 
+bool DataSinkBase::pushSnapshot(const SnapshotPtr& snapshot)
+{
+  return _p->push(snapshot, nullptr);
+}
+
 bool DataSinkBase::pushSnapshot(const Snapshot& snapshot)
 {
-  return _p->queue.enqueue(snapshot);
+  return pushSnapshot(std::make_shared<const Snapshot>(snapshot));
 }
 
-void DataSinkBase::stopThread()
+std::shared_ptr<DataSinkBase::Lane> DataSinkBase::createLane()
+{
+  return std::make_shared<Lane>(_p->queue, false);
+}
+
+std::shared_ptr<DataSinkBase::Lane> DataSinkBase::sharedLane()
+{
+  return _p->shared_lane;
+}
+
+bool DataSinkBase::pushSnapshot(Lane& lane, const SnapshotPtr& snapshot)
+{
+  if (lane.shared)
+  {
+    std::scoped_lock lk(lane.mutex);
+    return _p->push(snapshot, &lane.token);
+  }
+  return _p->push(snapshot, &lane.token);
+}
+
+bool DataSinkBase::pushSnapshots(Lane& lane, const std::vector<SnapshotPtr>& snapshots)
+{
+  std::unique_lock<Mutex> lk;
+  if (lane.shared)
+  {
+    lk = std::unique_lock(lane.mutex);
+  }
+  const bool unlimited = _p->limit_snapshots.load(std::memory_order_relaxed) == 0 &&
+                         _p->limit_bytes.load(std::memory_order_relaxed) == 0;
+  if (!unlimited)
+  {
+    // each of them must be checked against the limits
+    bool all_pushed = true;
+    for (const auto& snapshot : snapshots)
+    {
+      all_pushed = _p->push(snapshot, &lane.token) && all_pushed;
+    }
+    return all_pushed;
+  }
+  size_t total_size = 0;
+  for (const auto& snapshot : snapshots)
+  {
+    total_size += Pimpl::SnapshotSize(*snapshot);
+  }
+  _p->queued_count += snapshots.size();
+  _p->queued_bytes += total_size;
+  if (!_p->queue.enqueue_bulk(lane.token, snapshots.begin(), snapshots.size()))
+  {
+    _p->queued_count -= snapshots.size();
+    _p->queued_bytes -= total_size;
+    _p->rejected += snapshots.size();
+    for (const auto& snapshot : snapshots)
+    {
+      _p->countDropped(*snapshot);
+    }
+    return false;
+  }
+  _p->countEnqueued(snapshots.size(), total_size);
+  _p->notifyConsumer();
+  return true;
+}
+
+bool DataSinkBase::storeSnapshots(const std::vector<SnapshotPtr>& snapshots)
+{
+  bool all_stored = true;
+  for (const auto& snapshot : snapshots)
+  {
+    all_stored = storeSnapshot(*snapshot) && all_stored;
+  }
+  return all_stored;
+}
+
+void DataSinkBase::setSpinTime(std::chrono::microseconds spin_time)
+{
+  _p->spin_usec.store(spin_time.count(), std::memory_order_relaxed);
+}
+
+void DataSinkBase::setQueueLimits(const QueueLimits& limits)
+{
+  _p->block_usec.store(limits.block_timeout.count(), std::memory_order_relaxed);
+  _p->limit_policy.store(int(limits.policy), std::memory_order_relaxed);
+  _p->limit_bytes.store(limits.max_bytes, std::memory_order_relaxed);
+  _p->limit_snapshots.store(limits.max_snapshots, std::memory_order_relaxed);
+  _p->decimation.store(1, std::memory_order_relaxed);
+}
+
+DropCounters DataSinkBase::dropCounters() const
+{
+  DropCounters counters;
+  counters.rejected = _p->rejected.load(std::memory_order_relaxed);
+  counters.evicted = _p->evicted.load(std::memory_order_relaxed);
+  counters.decimated = _p->decimated.load(std::memory_order_relaxed);
+  return counters;
+}
+
+void DataSinkBase::requestKeyframe()
 {
-  _p->run = false;
-  if (_p->thread.joinable())
+  _p->keyframe_requests++;
+}
+
+uint64_t DataSinkBase::keyframeRequests() const
+{
+  return _p->keyframe_requests.load(std::memory_order_relaxed);
+}
+
+void DataSinkBase::setExecutor(std::shared_ptr<SinkExecutor> executor)
+{
+  _p->detachExecutor();
+  _p->stopThread();
+  if (executor)
+  {
+    _p->attachExecutor(executor);
+  }
+  else
+  {
+    _p->startThread();
+  }
+}
+
+void DataSinkBase::SetDefaultExecutor(std::shared_ptr<SinkExecutor> executor)
+{
+  Pimpl::DefaultExecutor() = std::move(executor);
+}
+
+SinkStatistics DataSinkBase::statistics() const
+{
+  SinkStatistics stats;
+  stats.queue_depth = _p->queued_count.load(std::memory_order_relaxed);
+  stats.queue_high_water = _p->queue_high_water.load(std::memory_order_relaxed);
+  stats.enqueued = _p->enqueued.load(std::memory_order_relaxed);
+  stats.stored = _p->stored.load(std::memory_order_relaxed);
+  stats.dropped = dropCounters();
+  stats.bytes_in = _p->bytes_in.load(std::memory_order_relaxed);
+  stats.bytes_out = _p->bytes_out.load(std::memory_order_relaxed);
+  for (size_t i = 0; i < stats.store_latency.size(); i++)
+  {
+    stats.store_latency[i] = _p->store_latency[i].load(std::memory_order_relaxed);
+  }
+  for (const auto& slot : _p->drop_slots)
   {
-    _p->thread.join();
+    if (slot.state.load(std::memory_order_acquire) == Pimpl::DropSlot::READY)
+    {
+      stats.channels_dropped[slot.name] += slot.dropped.load(std::memory_order_relaxed);
+    }
   }
+  std::scoped_lock lk(_p->channels_mutex);
+  for (const auto& [hash, counter] : _p->channel_counters)
+  {
+    stats.channels[counter.name] += counter.count;
+  }
+  return stats;
+}
+
+void DataSinkBase::stopThread()
+{
+  _p->detachExecutor();
+  _p->stopThread();
 }
 
 }   // namespace DataTamer
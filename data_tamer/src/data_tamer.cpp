@@ -1,20 +1,147 @@
 #include "data_tamer/data_tamer.hpp"
 #include "data_tamer/details/mutex.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <memory>
 #include <mutex>
+#include <stdexcept>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 
 namespace DataTamer
 {
 
 struct ChannelsRegistry::Pimpl
 {
+  ~Pimpl();
+
   std::unordered_map<std::string, std::shared_ptr<LogChannel>> channels;
-  std::unordered_set<std::shared_ptr<DataSinkBase>> default_sinks;
+  std::unordered_map<std::shared_ptr<DataSinkBase>, SinkDecimation> default_sinks;
   Mutex mutex;
+  Clock::Ptr clock = std::make_shared<SystemClock>();
+  // true if snapshot_channels must be updated
+  bool channels_changed = true;
+
+  struct ChannelSnapshot
+  {
+    SnapshotPtr snapshot;
+    // see LogChannel::createSnapshot
+    uint64_t targets = 0;
+  };
+
+  // serialize one takeSnapshotAll at the time
+  Mutex snapshot_mutex;
+  // buffers reused by takeSnapshotAll. The channels are sorted by address,
+  // the order used to lock them
+  std::vector<std::shared_ptr<LogChannel>> snapshot_channels;
+  std::vector<std::unique_lock<Mutex>> channel_locks;
+  std::vector<ChannelSnapshot> channel_snapshots;
+  // snapshots of each sink, pushed at once
+  std::unordered_map<DataSinkBase*, std::vector<SnapshotPtr>> sink_batches;
+  std::chrono::nanoseconds snapshot_time = {};
+  std::atomic_size_t next_channel = 0;
+  std::atomic_bool all_pushed = true;
+
+  // threads used by takeSnapshotAll
+  std::vector<std::thread> workers;
+  Mutex workers_mutex;
+  std::condition_variable_any workers_start;
+  std::condition_variable_any workers_done;
+  uint64_t generation = 0;
+  size_t busy_workers = 0;
+  bool stop_workers = false;
+
+  void startWorkers(size_t count);
+  void stopWorkers();
+  // serialize the channels, locked already
+  void takeSnapshots();
+
+  // all the channels, sorted by address. mutex must be locked
+  std::vector<std::shared_ptr<LogChannel>> sortedChannels() const;
 };
 
+ChannelsRegistry::Pimpl::~Pimpl()
+{
+  stopWorkers();
+}
+
+void ChannelsRegistry::Pimpl::takeSnapshots()
+{
+  size_t index = 0;
+  while ((index = next_channel++) < snapshot_channels.size())
+  {
+    auto& result = channel_snapshots[index];
+    bool has_sinks = false;
+    const bool created = snapshot_channels[index]->createSnapshot(
+        snapshot_time, result.snapshot, result.targets, has_sinks);
+    // a channel without sinks is not an error here
+    if (!created && has_sinks)
+    {
+      all_pushed = false;
+    }
+  }
+}
+
+std::vector<std::shared_ptr<LogChannel>> ChannelsRegistry::Pimpl::sortedChannels() const
+{
+  std::vector<std::shared_ptr<LogChannel>> sorted;
+  sorted.reserve(channels.size());
+  for (auto const& [name, channel] : channels)
+  {
+    sorted.push_back(channel);
+  }
+  std::sort(sorted.begin(), sorted.end());
+  return sorted;
+}
+
+void ChannelsRegistry::Pimpl::startWorkers(size_t count)
+{
+  stop_workers = false;
+  for (size_t i = 0; i < count; i++)
+  {
+    workers.emplace_back([this, last_generation = generation]() mutable {
+      while (true)
+      {
+        {
+          std::unique_lock lk(workers_mutex);
+          workers_start.wait(
+              lk, [&]() { return stop_workers || generation != last_generation; });
+          if (stop_workers)
+          {
+            return;
+          }
+          last_generation = generation;
+        }
+        takeSnapshots();
+        {
+          std::unique_lock lk(workers_mutex);
+          if (--busy_workers == 0)
+          {
+            workers_done.notify_all();
+          }
+        }
+      }
+    });
+  }
+}
+
+void ChannelsRegistry::Pimpl::stopWorkers()
+{
+  {
+    std::unique_lock lk(workers_mutex);
+    stop_workers = true;
+  }
+  workers_start.notify_all();
+  for (auto& thread : workers)
+  {
+    thread.join();
+  }
+  workers.clear();
+}
+
 ChannelsRegistry::ChannelsRegistry() : _p(new Pimpl)
 {}
 
@@ -27,10 +154,11 @@ ChannelsRegistry& ChannelsRegistry::Global()
   return obj;
 }
 
-void ChannelsRegistry::addDefaultSink(std::shared_ptr<DataSinkBase> sink)
+void ChannelsRegistry::addDefaultSink(std::shared_ptr<DataSinkBase> sink,
+                                      SinkDecimation decimation)
 {
   std::scoped_lock lk(_p->mutex);
-  _p->default_sinks.insert(sink);
+  _p->default_sinks[sink] = decimation;
 }
 
 std::shared_ptr<LogChannel> ChannelsRegistry::getChannel(std::string const& channel_name)
@@ -40,11 +168,14 @@ std::shared_ptr<LogChannel> ChannelsRegistry::getChannel(std::string const& chan
   if (it == _p->channels.end())
   {
     auto new_channel = LogChannel::create(channel_name);
-    for (auto const& sink : _p->default_sinks)
+    new_channel->useSharedLanes();
+    new_channel->setClock(_p->clock);
+    for (auto const& [sink, decimation] : _p->default_sinks)
     {
-      new_channel->addDataSink(sink);
+      new_channel->addDataSink(sink, decimation);
     }
     _p->channels.insert({channel_name, new_channel});
+    _p->channels_changed = true;
     return new_channel;
   }
   return it->second;
@@ -52,9 +183,124 @@ std::shared_ptr<LogChannel> ChannelsRegistry::getChannel(std::string const& chan
 
 void ChannelsRegistry::clear()
 {
-  std::scoped_lock lk(_p->mutex);
+  std::scoped_lock lk(_p->snapshot_mutex, _p->mutex);
+  _p->snapshot_channels.clear();
   _p->channels.clear();
   _p->default_sinks.clear();
+  _p->channels_changed = true;
+}
+
+bool ChannelsRegistry::takeSnapshotAll(std::chrono::nanoseconds timestamp)
+{
+  std::scoped_lock snapshot_lock(_p->snapshot_mutex);
+  auto& channels = _p->snapshot_channels;
+  {
+    std::scoped_lock lk(_p->mutex);
+    if (_p->channels_changed)
+    {
+      _p->channels_changed = false;
+      channels = _p->sortedChannels();
+      _p->channel_snapshots.resize(channels.size());
+    }
+  }
+  _p->snapshot_time = timestamp;
+  _p->next_channel = 0;
+  _p->all_pushed = true;
+
+  // No snapshot can be taken by LogChannel::takeSnapshot until all of these are
+  // pushed: each sink receives the snapshots of each channel in order
+  for (auto const& channel : channels)
+  {
+    _p->channel_locks.emplace_back(channel->writeMutex());
+  }
+
+  // serialize in parallel, the calling thread included
+  {
+    std::unique_lock lk(_p->workers_mutex);
+    _p->busy_workers = _p->workers.size();
+    _p->generation++;
+  }
+  _p->workers_start.notify_all();
+  _p->takeSnapshots();
+  {
+    std::unique_lock lk(_p->workers_mutex);
+    _p->workers_done.wait(lk, [this]() { return _p->busy_workers == 0; });
+  }
+
+  // a single push for each sink, through the lane shared by all the channels
+  bool all_pushed = _p->all_pushed;
+  for (size_t i = 0; i < channels.size(); i++)
+  {
+    auto& result = _p->channel_snapshots[i];
+    if (!result.snapshot)
+    {
+      continue;
+    }
+    const auto& sinks = channels[i]->dataSinks();
+    for (size_t k = 0; k < sinks.size(); k++)
+    {
+      if (result.targets & (uint64_t(1) << k))
+      {
+        _p->sink_batches[sinks[k].get()].push_back(result.snapshot);
+      }
+    }
+    result.snapshot.reset();
+  }
+  for (auto& [sink, batch] : _p->sink_batches)
+  {
+    if (!batch.empty())
+    {
+      all_pushed &= sink->pushSnapshots(*sink->sharedLane(), batch);
+      batch.clear();
+    }
+  }
+  _p->channel_locks.clear();
+  return all_pushed;
+}
+
+bool ChannelsRegistry::takeSnapshotAll()
+{
+  Clock::Ptr clock;
+  {
+    std::scoped_lock lk(_p->mutex);
+    clock = _p->clock;
+  }
+  return takeSnapshotAll(clock->now());
+}
+
+void ChannelsRegistry::setClock(Clock::Ptr clock)
+{
+  if (!clock)
+  {
+    throw std::runtime_error("ChannelsRegistry::setClock: null clock");
+  }
+  std::scoped_lock lk(_p->mutex);
+  // all or nothing: the channels are locked (in the same order as takeSnapshotAll)
+  // and checked before changing any
+  const auto channels = _p->sortedChannels();
+  std::vector<std::unique_lock<Mutex>> channel_locks;
+  channel_locks.reserve(channels.size());
+  for (auto const& channel : channels)
+  {
+    channel_locks.emplace_back(channel->writeMutex());
+    if (channel->loggingStarted())
+    {
+      throw std::runtime_error("ChannelsRegistry::setClock: the channel [" +
+                               channel->channelName() + "] started recording already");
+    }
+  }
+  _p->clock = clock;
+  for (auto const& [name, channel] : _p->channels)
+  {
+    channel->setClockUnlocked(clock);
+  }
+}
+
+void ChannelsRegistry::setSnapshotThreads(size_t threads_count)
+{
+  std::scoped_lock snapshot_lock(_p->snapshot_mutex);
+  _p->stopWorkers();
+  _p->startWorkers(threads_count);
 }
 
 }   // namespace DataTamer
@@ -0,0 +1,86 @@
+#include "data_tamer/details/float16.hpp"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define DATA_TAMER_HAS_F16C
+#include <immintrin.h>
+#endif
+
+namespace DataTamer
+{
+
+template <typename Float>
+static void FloatToHalfPortable(const Float* values, size_t count, uint8_t* dst)
+{
+  // auto-vectorized by the compiler
+  for (size_t i = 0; i < count; i++)
+  {
+    const uint16_t half = FloatToHalf(static_cast<float>(values[i]));
+    std::memcpy(dst + i * sizeof(uint16_t), &half, sizeof(uint16_t));
+  }
+}
+
+#ifdef DATA_TAMER_HAS_F16C
+
+// compiled for CPUs with AVX and F16C, called only if the CPU has them
+__attribute__((target("avx,f16c"))) static void
+FloatToHalfF16C(const float* values, size_t count, uint8_t* dst)
+{
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8)
+  {
+    const __m256 floats = _mm256_loadu_ps(values + i);
+    const __m128i halves = _mm256_cvtps_ph(floats, _MM_FROUND_TO_NEAREST_INT);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * sizeof(uint16_t)), halves);
+  }
+  FloatToHalfPortable(values + i, count - i, dst + i * sizeof(uint16_t));
+}
+
+__attribute__((target("avx,f16c"))) static void
+FloatToHalfF16C(const double* values, size_t count, uint8_t* dst)
+{
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8)
+  {
+    const __m128 low = _mm256_cvtpd_ps(_mm256_loadu_pd(values + i));
+    const __m128 high = _mm256_cvtpd_ps(_mm256_loadu_pd(values + i + 4));
+    const __m256 floats = _mm256_insertf128_ps(_mm256_castps128_ps256(low), high, 1);
+    const __m128i halves = _mm256_cvtps_ph(floats, _MM_FROUND_TO_NEAREST_INT);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * sizeof(uint16_t)), halves);
+  }
+  FloatToHalfPortable(values + i, count - i, dst + i * sizeof(uint16_t));
+}
+
+static bool HasF16C()
+{
+  static const bool has_f16c =
+      __builtin_cpu_supports("avx") && __builtin_cpu_supports("f16c");
+  return has_f16c;
+}
+
+#endif
+
+void FloatToHalfArray(const float* values, size_t count, uint8_t* dst)
+{
+#ifdef DATA_TAMER_HAS_F16C
+  if (HasF16C())
+  {
+    FloatToHalfF16C(values, count, dst);
+    return;
+  }
+#endif
+  FloatToHalfPortable(values, count, dst);
+}
+
+void FloatToHalfArray(const double* values, size_t count, uint8_t* dst)
+{
+#ifdef DATA_TAMER_HAS_F16C
+  if (HasF16C())
+  {
+    FloatToHalfF16C(values, count, dst);
+    return;
+  }
+#endif
+  FloatToHalfPortable(values, count, dst);
+}
+
+}   // namespace DataTamer
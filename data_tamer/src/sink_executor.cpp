@@ -0,0 +1,179 @@
+#include "data_tamer/sink_executor.hpp"
+#include "ConcurrentQueue/blockingconcurrentqueue.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <future>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#endif
+
+namespace DataTamer
+{
+
+namespace
+{
+// Called by each thread of the executor. Returns an error message, empty if successful
+std::string ApplyThreadOptions(const SinkExecutorOptions& options)
+{
+#if defined(__linux__)
+  if (!options.cpu_affinity.empty())
+  {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    for (int cpu : options.cpu_affinity)
+    {
+      if (cpu < 0 || cpu >= CPU_SETSIZE)
+      {
+        return "invalid CPU in cpu_affinity: " + std::to_string(cpu);
+      }
+      CPU_SET(size_t(cpu), &cpus);
+    }
+    const int res = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    if (res != 0)
+    {
+      return std::string("cannot pthread_setaffinity_np: ") + std::strerror(res);
+    }
+  }
+
+  int policy = SCHED_OTHER;
+  switch (options.policy)
+  {
+    case SchedPolicy::OTHER:
+      policy = SCHED_OTHER;
+      break;
+    case SchedPolicy::BATCH:
+      policy = SCHED_BATCH;
+      break;
+    case SchedPolicy::IDLE:
+      policy = SCHED_IDLE;
+      break;
+    case SchedPolicy::FIFO:
+      policy = SCHED_FIFO;
+      break;
+    case SchedPolicy::RR:
+      policy = SCHED_RR;
+      break;
+  }
+  const bool realtime = (policy == SCHED_FIFO || policy == SCHED_RR);
+  sched_param param{};
+  param.sched_priority = realtime ? options.priority : 0;
+  int res = pthread_setschedparam(pthread_self(), policy, &param);
+  if (res != 0)
+  {
+    return std::string("cannot pthread_setschedparam: ") + std::strerror(res);
+  }
+
+  if (!realtime && policy != SCHED_IDLE && options.nice != 0)
+  {
+    // on Linux, the niceness is an attribute of the thread, not of the process
+    if (setpriority(PRIO_PROCESS, 0, options.nice) != 0)
+    {
+      return std::string("cannot setpriority: ") + std::strerror(errno);
+    }
+  }
+#else
+  if (!options.cpu_affinity.empty() || options.policy != SchedPolicy::OTHER ||
+      options.nice != 0)
+  {
+    return "the thread options are supported only on Linux";
+  }
+#endif
+  return {};
+}
+}   // namespace
+
+struct SinkExecutor::Pimpl
+{
+  SinkExecutorOptions options;
+  std::vector<std::thread> threads;
+  std::atomic_bool run = true;
+  moodycamel::BlockingConcurrentQueue<std::shared_ptr<Task>> tasks;
+
+  void stopThreads()
+  {
+    run = false;
+    for (size_t i = 0; i < threads.size(); i++)
+    {
+      // wake up the threads
+      tasks.enqueue(nullptr);
+    }
+    for (auto& thread : threads)
+    {
+      thread.join();
+    }
+    threads.clear();
+  }
+};
+
+SinkExecutor::SinkExecutor(const SinkExecutorOptions& options) : _p(new Pimpl)
+{
+  if (options.threads_count == 0)
+  {
+    throw std::runtime_error("SinkExecutor: threads_count can not be zero");
+  }
+  _p->options = options;
+
+  std::vector<std::promise<std::string>> started(options.threads_count);
+  std::vector<std::future<std::string>> errors;
+  for (auto& promise : started)
+  {
+    errors.push_back(promise.get_future());
+  }
+  for (auto& promise : started)
+  {
+    _p->threads.emplace_back([this, &promise]() {
+      promise.set_value(ApplyThreadOptions(_p->options));
+
+      std::shared_ptr<Task> task;
+      while (_p->run)
+      {
+        _p->tasks.wait_dequeue(task);
+        if (task && task->run())
+        {
+          _p->tasks.enqueue(std::move(task));
+        }
+        task.reset();
+      }
+    });
+  }
+
+  std::string error;
+  for (auto& future : errors)
+  {
+    const std::string thread_error = future.get();
+    if (error.empty())
+    {
+      error = thread_error;
+    }
+  }
+  if (!error.empty())
+  {
+    _p->stopThreads();
+    throw std::runtime_error("SinkExecutor: " + error);
+  }
+}
+
+SinkExecutor::~SinkExecutor()
+{
+  _p->stopThreads();
+}
+
+const SinkExecutorOptions& SinkExecutor::options() const
+{
+  return _p->options;
+}
+
+void SinkExecutor::schedule(const std::shared_ptr<Task>& task)
+{
+  _p->tasks.enqueue(task);
+}
+
+}   // namespace DataTamer
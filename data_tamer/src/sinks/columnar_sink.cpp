@@ -0,0 +1,682 @@
+#include "data_tamer/sinks/columnar_sink.hpp"
+#include "data_tamer_parser/columnar_reader.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+namespace DataTamer
+{
+
+namespace
+{
+
+void WriteVarint(std::vector<uint8_t>& out, uint64_t value)
+{
+  while (value >= 0x80)
+  {
+    out.push_back(uint8_t(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back(uint8_t(value));
+}
+
+uint64_t EncodeZigZag(int64_t value)
+{
+  return (uint64_t(value) << 1) ^ uint64_t(value >> 63);
+}
+
+void WriteBytes(std::vector<uint8_t>& out, const void* data, size_t size)
+{
+  const auto* bytes = static_cast<const uint8_t*>(data);
+  out.insert(out.end(), bytes, bytes + size);
+}
+
+// varint size, followed by the bytes
+void WriteSpan(std::vector<uint8_t>& out, const void* data, size_t size)
+{
+  WriteVarint(out, size);
+  WriteBytes(out, data, size);
+}
+
+unsigned CountLeadingZeros(uint64_t value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+  return value == 0 ? 64 : unsigned(__builtin_clzll(value));
+#else
+  unsigned count = 0;
+  for (uint64_t mask = uint64_t(1) << 63; mask != 0 && (value & mask) == 0; mask >>= 1)
+  {
+    count++;
+  }
+  return count;
+#endif
+}
+
+unsigned CountTrailingZeros(uint64_t value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+  return value == 0 ? 64 : unsigned(__builtin_ctzll(value));
+#else
+  unsigned count = 0;
+  for (uint64_t mask = 1; mask != 0 && (value & mask) == 0; mask <<= 1)
+  {
+    count++;
+  }
+  return count;
+#endif
+}
+
+// the bits are written starting from the most significant bit of each byte
+// (see DataTamerParser::BitReader)
+class BitWriter
+{
+public:
+  explicit BitWriter(std::vector<uint8_t>& out) : out_(out)
+  {}
+
+  void write(uint64_t value, unsigned bits)
+  {
+    while (bits > 0)
+    {
+      if (bit_pos_ == 0)
+      {
+        out_.push_back(0);
+      }
+      const unsigned available = 8 - bit_pos_;
+      const unsigned take = std::min(available, bits);
+      const auto chunk = unsigned(value >> (bits - take)) & ((1u << take) - 1);
+      out_.back() = uint8_t(out_.back() | (chunk << (available - take)));
+      bits -= take;
+      bit_pos_ = (bit_pos_ + take) % 8;
+    }
+  }
+
+private:
+  std::vector<uint8_t>& out_;
+  unsigned bit_pos_ = 0;
+};
+
+void EncodeTimestamps(const std::vector<int64_t>& timestamps, std::vector<uint8_t>& out)
+{
+  int64_t prev = 0;
+  int64_t prev_delta = 0;
+  for (size_t r = 0; r < timestamps.size(); r++)
+  {
+    const int64_t delta = timestamps[r] - prev;
+    WriteVarint(out, EncodeZigZag(delta - prev_delta));
+    prev = timestamps[r];
+    prev_delta = (r == 0) ? 0 : delta;
+  }
+}
+
+// Gorilla encoding of the XOR with the previous value
+void EncodeFloats(const std::vector<uint64_t>& values, std::vector<uint8_t>& out)
+{
+  BitWriter writer(out);
+  uint64_t prev = 0;
+  // window of the meaningful bits of the previous XOR
+  bool has_window = false;
+  unsigned prev_leading = 0;
+  unsigned prev_trailing = 0;
+
+  for (size_t i = 0; i < values.size(); i++)
+  {
+    if (i == 0)
+    {
+      writer.write(values[0], 64);
+      prev = values[0];
+      continue;
+    }
+    const uint64_t xor_value = values[i] ^ prev;
+    prev = values[i];
+    if (xor_value == 0)
+    {
+      writer.write(0, 1);
+      continue;
+    }
+    // the number of leading zeros is saved with 5 bits
+    const unsigned leading = std::min(CountLeadingZeros(xor_value), 31u);
+    const unsigned trailing = CountTrailingZeros(xor_value);
+    if (has_window && leading >= prev_leading && trailing >= prev_trailing)
+    {
+      writer.write(0b10, 2);
+      writer.write(xor_value >> prev_trailing, 64 - prev_leading - prev_trailing);
+      continue;
+    }
+    const unsigned length = 64 - leading - trailing;
+    writer.write(0b11, 2);
+    writer.write(leading, 5);
+    // a length of 64 is saved as 0
+    writer.write(length % 64, 6);
+    writer.write(xor_value >> trailing, length);
+    has_window = true;
+    prev_leading = leading;
+    prev_trailing = trailing;
+  }
+}
+
+void EncodeIntegers(const std::vector<uint64_t>& values, std::vector<uint8_t>& out)
+{
+  uint64_t prev = 0;
+  for (const uint64_t value : values)
+  {
+    WriteVarint(out, EncodeZigZag(int64_t(value - prev)));
+    prev = value;
+  }
+}
+
+void EncodeBools(const std::vector<uint64_t>& values, std::vector<uint8_t>& out)
+{
+  BitWriter writer(out);
+  for (const uint64_t value : values)
+  {
+    writer.write(value, 1);
+  }
+}
+
+// Bits of the value, as stored in the columns: floats in the most significant half,
+// integers converted to 64 bits
+uint64_t ToColumnBits(const DataTamerParser::VarNumber& number)
+{
+  return std::visit(
+      [](auto value) -> uint64_t {
+        using T = decltype(value);
+        if constexpr (std::is_same_v<T, float>)
+        {
+          uint32_t bits;
+          std::memcpy(&bits, &value, sizeof(bits));
+          return uint64_t(bits) << 32;
+        }
+        else if constexpr (std::is_same_v<T, double>)
+        {
+          uint64_t bits;
+          std::memcpy(&bits, &value, sizeof(bits));
+          return bits;
+        }
+        else if constexpr (std::is_signed_v<T>)
+        {
+          return uint64_t(int64_t(value));
+        }
+        else
+        {
+          return uint64_t(value);
+        }
+      },
+      number);
+}
+
+// Name of a custom type with its own encoding (see CustomSerializer::typeSchema),
+// that ColumnarSink can't split into series. Empty if there is none
+std::string OpaqueCustomType(const Schema& schema)
+{
+  const auto is_opaque = [&](const TypeField& field) {
+    return field.type == BasicType::OTHER && schema.custom_types.count(field.type_name) == 0;
+  };
+  for (const auto& field : schema.fields)
+  {
+    if (is_opaque(field))
+    {
+      return field.type_name;
+    }
+  }
+  for (const auto& [type_name, fields] : schema.custom_types)
+  {
+    for (const auto& field : fields)
+    {
+      if (is_opaque(field))
+      {
+        return field.type_name;
+      }
+    }
+  }
+  return {};
+}
+
+}   // namespace
+
+struct ColumnarSink::ChannelBuffer
+{
+  struct Column
+  {
+    std::string name;
+    DataTamerParser::BasicType type = DataTamerParser::BasicType::OTHER;
+    // rows where the series is present and its values
+    std::vector<uint32_t> rows;
+    std::vector<uint64_t> values;
+  };
+
+  // A field of the schema, or of a custom type, and the columns of its values.
+  // Built in addChannel, to split the payloads without looking up the names
+  struct Node
+  {
+    const DataTamerParser::TypeField* field = nullptr;
+    std::string name;
+    // true if this is an element of the array or vector `field`
+    bool is_element = false;
+    // column of a value of BasicType (not OTHER)
+    size_t column = 0;
+    // one for each field of a custom type
+    std::vector<Node> children;
+    // one for each element of an array or vector. Those of a vector are
+    // created when a longer vector is received
+    std::vector<Node> elements;
+  };
+
+  uint64_t hash = 0;
+  // quantized values are parsed as integers
+  DataTamerParser::Schema schema;
+  std::vector<int64_t> timestamps;
+  std::vector<Column> columns;
+  // one for each field of the schema
+  std::vector<Node> plan;
+  std::vector<uint8_t> record;
+
+  Node makeNode(const DataTamerParser::TypeField& field, const std::string& name,
+                bool is_element);
+  void growElements(Node& node, size_t size);
+  // the values of the row are appended to the columns
+  bool parsePayload(const DataTamerParser::SnapshotView& snapshot, uint32_t row);
+  void parseNode(Node& node, DataTamerParser::BufferSpan& buffer, uint32_t row);
+  void parseValue(Node& node, DataTamerParser::BufferSpan& buffer, uint32_t row);
+  void pushValue(size_t column, uint64_t bits, uint32_t row);
+  // remove the values of a row that could not be parsed completely
+  void discardRow(uint32_t row);
+};
+
+ColumnarSink::ChannelBuffer::Node
+ColumnarSink::ChannelBuffer::makeNode(const DataTamerParser::TypeField& field,
+                                      const std::string& name, bool is_element)
+{
+  using DataTamerParser::BasicType;
+
+  Node node;
+  node.field = &field;
+  node.name = name;
+  node.is_element = is_element;
+  if (field.is_vector && !is_element)
+  {
+    // arrays have a fixed size
+    growElements(node, field.array_size);
+  }
+  else if (field.type == BasicType::OTHER)
+  {
+    for (const auto& sub_field : schema.custom_types.at(field.type_name))
+    {
+      node.children.push_back(makeNode(sub_field, name + "/" + sub_field.field_name, false));
+    }
+  }
+  else
+  {
+    node.column = columns.size();
+    columns.emplace_back();
+    columns.back().name = name;
+    // FLOAT16 and BFLOAT16 are deserialized as float
+    columns.back().type = (field.type == BasicType::FLOAT16 ||
+                           field.type == BasicType::BFLOAT16) ?
+                              BasicType::FLOAT32 :
+                              field.type;
+  }
+  return node;
+}
+
+void ColumnarSink::ChannelBuffer::growElements(Node& node, size_t size)
+{
+  while (node.elements.size() < size)
+  {
+    const auto name = node.name + "[" + std::to_string(node.elements.size()) + "]";
+    node.elements.push_back(makeNode(*node.field, name, true));
+  }
+}
+
+bool ColumnarSink::ChannelBuffer::parsePayload(const DataTamerParser::SnapshotView& snapshot,
+                                               uint32_t row)
+{
+  using DataTamerParser::BufferSpan;
+  using DataTamerParser::GetBit;
+
+  BufferSpan buffer = snapshot.payload;
+  if (schema.encoding == DataTamerParser::PayloadEncoding::DELTA)
+  {
+    if (!DataTamerParser::DecodeDeltaPayload(schema, snapshot))
+    {
+      return false;
+    }
+    buffer = {schema.previous_payload.data(), schema.previous_payload.size()};
+  }
+
+  const size_t bools_size = DataTamerParser::PackedBoolsBlockSize(schema, snapshot.active_mask);
+  if (bools_size > buffer.size)
+  {
+    throw std::runtime_error("Buffer overflow");
+  }
+  const BufferSpan bools_block = {buffer.data, bools_size};
+  buffer.trimFront(bools_size);
+  size_t bool_index = 0;
+
+  for (size_t i = 0; i < plan.size(); i++)
+  {
+    if (!GetBit(snapshot.active_mask, i))
+    {
+      continue;
+    }
+    auto& node = plan[i];
+    const auto& field = *node.field;
+    if (!DataTamerParser::IsPackedBool(schema, field))
+    {
+      parseNode(node, buffer, row);
+    }
+    else if (!field.is_vector)
+    {
+      pushValue(node.column, GetBit(bools_block, bool_index++) ? 1 : 0, row);
+    }
+    else
+    {
+      // one bit per element
+      uint32_t vect_size = field.array_size;
+      if (vect_size == 0)
+      {
+        vect_size = DataTamerParser::Deserialize<uint32_t>(buffer);
+      }
+      const BufferSpan bits = {buffer.data, (vect_size + 7) / 8};
+      if (bits.size > buffer.size)
+      {
+        throw std::runtime_error("Buffer overflow");
+      }
+      buffer.trimFront(bits.size);
+      growElements(node, vect_size);
+      for (uint32_t a = 0; a < vect_size; a++)
+      {
+        pushValue(node.elements[a].column, GetBit(bits, a) ? 1 : 0, row);
+      }
+    }
+  }
+  return true;
+}
+
+void ColumnarSink::ChannelBuffer::parseNode(Node& node, DataTamerParser::BufferSpan& buffer,
+                                            uint32_t row)
+{
+  if (!node.field->is_vector || node.is_element)
+  {
+    parseValue(node, buffer, row);
+    return;
+  }
+  uint32_t vect_size = node.field->array_size;
+  if (vect_size == 0)
+  {
+    // dynamic vector
+    vect_size = DataTamerParser::Deserialize<uint32_t>(buffer);
+  }
+  if (vect_size > buffer.size)
+  {
+    // don't create the columns of a corrupted size
+    throw std::runtime_error("Buffer overflow");
+  }
+  growElements(node, vect_size);
+  for (uint32_t a = 0; a < vect_size; a++)
+  {
+    parseValue(node.elements[a], buffer, row);
+  }
+}
+
+void ColumnarSink::ChannelBuffer::parseValue(Node& node, DataTamerParser::BufferSpan& buffer,
+                                             uint32_t row)
+{
+  if (node.field->type == DataTamerParser::BasicType::OTHER)
+  {
+    for (auto& child : node.children)
+    {
+      parseNode(child, buffer, row);
+    }
+    return;
+  }
+  const auto value = DataTamerParser::DeserializeToVarNumber(node.field->type, buffer);
+  pushValue(node.column, ToColumnBits(value), row);
+}
+
+void ColumnarSink::ChannelBuffer::pushValue(size_t column, uint64_t bits, uint32_t row)
+{
+  columns[column].rows.push_back(row);
+  columns[column].values.push_back(bits);
+}
+
+void ColumnarSink::ChannelBuffer::discardRow(uint32_t row)
+{
+  for (auto& column : columns)
+  {
+    while (!column.rows.empty() && column.rows.back() == row)
+    {
+      column.rows.pop_back();
+      column.values.pop_back();
+    }
+  }
+}
+
+ColumnarSink::ColumnarSink(std::string const& filepath, size_t block_rows) :
+  filepath_(filepath), block_rows_(block_rows)
+{
+  if (block_rows_ == 0)
+  {
+    throw std::runtime_error("ColumnarSink: block_rows can not be zero");
+  }
+  file_.open(filepath_, std::ios::binary | std::ios::trunc);
+  if (!file_)
+  {
+    throw std::runtime_error("ColumnarSink: can't open file " + filepath_);
+  }
+  std::vector<uint8_t> header;
+  WriteBytes(header, DataTamerParser::kColumnarMagic,
+             sizeof(DataTamerParser::kColumnarMagic));
+  WriteBytes(header, &DataTamerParser::kColumnarVersion, sizeof(uint32_t));
+  file_.write(reinterpret_cast<const char*>(header.data()),   // NOLINT
+              std::streamsize(header.size()));
+}
+
+ColumnarSink::~ColumnarSink()
+{
+  stopThread();
+  stopRecording();
+}
+
+void ColumnarSink::addChannel(std::string const& channel_name, Schema const& schema)
+{
+  std::scoped_lock lk(mutex_);
+  if (channels_.count(schema.hash) > 0)
+  {
+    return;
+  }
+  const auto opaque_type = OpaqueCustomType(schema);
+  if (!opaque_type.empty())
+  {
+    // its snapshots will be ignored
+    std::cerr << "ColumnarSink: can't save the channel [" << channel_name
+              << "]: the custom type [" << opaque_type << "] has its own encoding"
+              << std::endl;
+    return;
+  }
+  auto& channel = channels_[schema.hash];
+  channel = std::make_unique<ChannelBuffer>();
+  channel->hash = schema.hash;
+
+  const std::string schema_text = ToStr(schema);
+  channel->schema = DataTamerParser::BuilSchemaFromText(schema_text);
+  for (auto& [type_name, fields] : channel->schema.custom_types)
+  {
+    for (auto& field : fields)
+    {
+      field.quantization.reset();
+    }
+  }
+  for (auto& field : channel->schema.fields)
+  {
+    field.quantization.reset();
+    channel->plan.push_back(channel->makeNode(field, field.field_name, false));
+  }
+
+  std::vector<uint8_t> record;
+  WriteBytes(record, &schema.hash, sizeof(uint64_t));
+  WriteSpan(record, channel_name.data(), channel_name.size());
+  WriteSpan(record, schema_text.data(), schema_text.size());
+  file_.put(char(DataTamerParser::kColumnarSchema));
+  writeRecord(record);
+}
+
+bool ColumnarSink::storeSnapshot(const Snapshot& snapshot)
+{
+  std::scoped_lock lk(mutex_);
+  return appendSnapshot(snapshot);
+}
+
+bool ColumnarSink::storeSnapshots(const std::vector<SnapshotPtr>& snapshots)
+{
+  std::scoped_lock lk(mutex_);
+  bool all_stored = true;
+  for (const auto& snapshot : snapshots)
+  {
+    all_stored = appendSnapshot(*snapshot) && all_stored;
+  }
+  return all_stored;
+}
+
+bool ColumnarSink::appendSnapshot(const Snapshot& snapshot)
+{
+  auto it = channels_.find(snapshot.schema_hash);
+  if (it == channels_.end() || !file_.is_open())
+  {
+    return false;
+  }
+  auto& channel = *it->second;
+  const auto row = uint32_t(channel.timestamps.size());
+
+  DataTamerParser::SnapshotView view;
+  view.schema_hash = snapshot.schema_hash;
+  view.timestamp = uint64_t(snapshot.timestamp.count());
+  view.active_mask = {snapshot.active_mask.data(), snapshot.active_mask.size()};
+  view.payload = {snapshot.payload.data(), snapshot.payload.size()};
+
+  try
+  {
+    if (!channel.parsePayload(view, row))
+    {
+      return false;
+    }
+  }
+  catch (std::exception& err)
+  {
+    channel.discardRow(row);
+    std::cerr << "ColumnarSink: can't parse a snapshot of [" << snapshot.channel_name
+              << "]: " << err.what() << std::endl;
+    return false;
+  }
+  channel.timestamps.push_back(snapshot.timestamp.count());
+
+  if (channel.timestamps.size() >= block_rows_)
+  {
+    flushBlock(channel);
+  }
+  return true;
+}
+
+void ColumnarSink::stopRecording()
+{
+  std::scoped_lock lk(mutex_);
+  if (!file_.is_open())
+  {
+    return;
+  }
+  for (auto& [hash, channel] : channels_)
+  {
+    flushBlock(*channel);
+  }
+  const auto counters = dropCounters();
+  std::vector<uint8_t> record;
+  WriteVarint(record, counters.rejected);
+  WriteVarint(record, counters.evicted);
+  WriteVarint(record, counters.decimated);
+  file_.put(char(DataTamerParser::kColumnarDropped));
+  writeRecord(record);
+  file_.close();
+}
+
+void ColumnarSink::writeRecord(const std::vector<uint8_t>& record)
+{
+  std::vector<uint8_t> size;
+  WriteVarint(size, record.size());
+  file_.write(reinterpret_cast<const char*>(size.data()),   // NOLINT
+              std::streamsize(size.size()));
+  file_.write(reinterpret_cast<const char*>(record.data()),   // NOLINT
+              std::streamsize(record.size()));
+}
+
+void ColumnarSink::flushBlock(ChannelBuffer& channel)
+{
+  using DataTamerParser::BasicType;
+
+  const size_t rows = channel.timestamps.size();
+  if (rows == 0)
+  {
+    return;
+  }
+  auto& record = channel.record;
+  record.clear();
+  WriteBytes(record, &channel.hash, sizeof(uint64_t));
+  WriteVarint(record, rows);
+
+  std::vector<uint8_t> encoded;
+  EncodeTimestamps(channel.timestamps, encoded);
+  WriteSpan(record, encoded.data(), encoded.size());
+
+  const auto columns_count = size_t(
+      std::count_if(channel.columns.begin(), channel.columns.end(),
+                    [](const auto& column) { return !column.values.empty(); }));
+  WriteVarint(record, columns_count);
+
+  for (auto& column : channel.columns)
+  {
+    if (column.values.empty())
+    {
+      continue;
+    }
+    WriteSpan(record, column.name.data(), column.name.size());
+    record.push_back(uint8_t(column.type));
+    if (column.rows.size() == rows)
+    {
+      record.push_back(0);
+    }
+    else
+    {
+      record.push_back(DataTamerParser::kColumnSparse);
+      std::vector<uint8_t> present((rows + 7) / 8, 0);
+      for (const uint32_t row : column.rows)
+      {
+        present[row >> 3] = uint8_t(present[row >> 3] | (1 << (row % 8)));
+      }
+      WriteBytes(record, present.data(), present.size());
+    }
+
+    encoded.clear();
+    switch (column.type)
+    {
+      case BasicType::BOOL:
+        EncodeBools(column.values, encoded);
+        break;
+      case BasicType::FLOAT32:
+      case BasicType::FLOAT64:
+        EncodeFloats(column.values, encoded);
+        break;
+      default:
+        EncodeIntegers(column.values, encoded);
+    }
+    WriteSpan(record, encoded.data(), encoded.size());
+
+    column.rows.clear();
+    column.values.clear();
+  }
+  channel.timestamps.clear();
+
+  file_.put(char(DataTamerParser::kColumnarBlock));
+  writeRecord(record);
+}
+
+}   // namespace DataTamer
@@ -0,0 +1,338 @@
+#include "data_tamer/sinks/flight_recorder_sink.hpp"
+#include "data_tamer/sinks/mcap_sink.hpp"
+
+#include <mcap/writer.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <unordered_set>
+
+namespace DataTamer
+{
+
+// the clock is read at least this often, while waiting the end of the
+// post-trigger window (a SimulatedClock may be moved without new snapshots)
+static constexpr std::chrono::milliseconds kClockPollPeriod(10);
+
+// dumpToFile gives the memory back in chunks of this size, at least
+static constexpr size_t kDumpReleaseBytes = 64 * 1024;
+
+// size of the two uint32 of the message header (see WriteMessageHeader)
+static constexpr size_t kFrameSizes = sizeof(uint32_t) * 2;
+
+FlightRecorderSink::FlightRecorderSink(size_t max_bytes,
+                                       std::chrono::nanoseconds post_trigger_window,
+                                       Clock::Ptr clock) :
+  ring_(max_bytes),
+  post_trigger_window_(post_trigger_window),
+  clock_(clock ? std::move(clock) : std::make_shared<SystemClock>())
+{}
+
+FlightRecorderSink::~FlightRecorderSink()
+{
+  stopThread();
+  {
+    // don't wait the end of the post-trigger window
+    std::scoped_lock lk(mutex_);
+    window_complete_ = true;
+  }
+  window_cv_.notify_all();
+  waitDump();
+}
+
+void FlightRecorderSink::addChannel(std::string const& channel_name, Schema const& schema)
+{
+  std::scoped_lock lk(mutex_);
+  schemas_[schema.hash] = {channel_name, schema};
+}
+
+bool FlightRecorderSink::storeSnapshot(const Snapshot& snapshot)
+{
+  std::scoped_lock lk(mutex_);
+  return appendRecord(snapshot);
+}
+
+bool FlightRecorderSink::storeSnapshots(const std::vector<SnapshotPtr>& snapshots)
+{
+  std::scoped_lock lk(mutex_);
+  bool all_stored = true;
+  for (const auto& snapshot : snapshots)
+  {
+    all_stored = appendRecord(*snapshot) && all_stored;
+  }
+  return all_stored;
+}
+
+bool FlightRecorderSink::appendRecord(const Snapshot& snapshot)
+{
+  const size_t mask_size = snapshot.active_mask.size();
+  const size_t payload_size = snapshot.payload.size();
+  const size_t message_size = kFrameSizes + mask_size + payload_size;
+  const size_t record_size = sizeof(RecordHeader) + message_size;
+
+  if (record_size > ring_.size())
+  {
+    return false;
+  }
+  while (ring_.size() - used_bytes_ < record_size)
+  {
+    if (!dropOldestRecord())
+    {
+      // the following delta frames of the channel can't be decoded without this one
+      requestKeyframe();
+      return false;
+    }
+  }
+
+  RecordHeader header;
+  header.schema_hash = snapshot.schema_hash;
+  header.timestamp = snapshot.timestamp.count();
+  header.mask_size = uint32_t(mask_size);
+  header.payload_size = uint32_t(payload_size);
+
+  writeRing(&header, sizeof(RecordHeader));
+  size_t framed_size = 0;
+  if (const uint8_t* message = GetFramedMessage(snapshot, framed_size))
+  {
+    writeRing(message, framed_size);
+  }
+  else
+  {
+    writeRing(&header.mask_size, sizeof(uint32_t));
+    writeRing(snapshot.active_mask.data(), mask_size);
+    writeRing(&header.payload_size, sizeof(uint32_t));
+    writeRing(snapshot.payload.data(), payload_size);
+  }
+  used_bytes_ += record_size;
+  records_count_++;
+
+  if (triggered_ && !window_complete_ && snapshot.timestamp >= dump_end_time_)
+  {
+    window_complete_ = true;
+    window_cv_.notify_all();
+  }
+  return true;
+}
+
+bool FlightRecorderSink::trigger(std::string const& filepath, bool do_compression,
+                                 std::chrono::nanoseconds trigger_time)
+{
+  std::scoped_lock trigger_lk(trigger_mutex_);
+  {
+    std::scoped_lock lk(mutex_);
+    if (triggered_)
+    {
+      return false;
+    }
+    triggered_ = true;
+    window_complete_ = false;
+    dump_end_time_ = trigger_time + post_trigger_window_;
+  }
+  // the previous dump is finished, since triggered_ was false
+  if (dump_thread_.joinable())
+  {
+    dump_thread_.join();
+  }
+  dump_thread_ = std::thread([this, filepath, do_compression]() {
+    dumpToFile(filepath, do_compression);
+  });
+  return true;
+}
+
+bool FlightRecorderSink::trigger(std::string const& filepath, bool do_compression)
+{
+  return trigger(filepath, do_compression, clock_->now());
+}
+
+bool FlightRecorderSink::isDumping()
+{
+  std::scoped_lock lk(mutex_);
+  return triggered_;
+}
+
+void FlightRecorderSink::waitDump()
+{
+  std::scoped_lock trigger_lk(trigger_mutex_);
+  if (dump_thread_.joinable())
+  {
+    dump_thread_.join();
+  }
+}
+
+size_t FlightRecorderSink::bufferedSnapshots()
+{
+  std::scoped_lock lk(mutex_);
+  return records_count_;
+}
+
+size_t FlightRecorderSink::bufferedBytes()
+{
+  std::scoped_lock lk(mutex_);
+  return used_bytes_;
+}
+
+void FlightRecorderSink::writeRing(const void* src, size_t size)
+{
+  const auto* bytes = static_cast<const uint8_t*>(src);
+  const size_t first_part = std::min(size, ring_.size() - tail_);
+  std::memcpy(ring_.data() + tail_, bytes, first_part);
+  std::memcpy(ring_.data(), bytes + first_part, size - first_part);
+  tail_ = (tail_ + size) % ring_.size();
+}
+
+void FlightRecorderSink::readRing(size_t offset, void* dst, size_t size) const
+{
+  auto* bytes = static_cast<uint8_t*>(dst);
+  const size_t first_part = std::min(size, ring_.size() - offset);
+  std::memcpy(bytes, ring_.data() + offset, first_part);
+  std::memcpy(bytes + first_part, ring_.data(), size - first_part);
+}
+
+bool FlightRecorderSink::dropOldestRecord()
+{
+  // still to be written into the file by dumpToFile
+  if (dumping_ && dump_dropped_ < dump_size_ && dump_dropped_ >= dump_read_)
+  {
+    return false;
+  }
+  RecordHeader header;
+  readRing(head_, &header, sizeof(RecordHeader));
+  const size_t record_size =
+      sizeof(RecordHeader) + kFrameSizes + header.mask_size + header.payload_size;
+
+  // without this keyframe, the following delta frames of the channel can't be
+  // decoded (dumpToFile skips them): ask for a new one
+  const auto schema_it = schemas_.find(header.schema_hash);
+  if (schema_it != schemas_.end() &&
+      schema_it->second.second.encoding == PayloadEncoding::DELTA &&
+      header.payload_size > 0)
+  {
+    uint8_t frame_type = kDeltaFrame;
+    readRing((head_ + sizeof(RecordHeader) + kFrameSizes + header.mask_size) % ring_.size(),
+             &frame_type, 1);
+    if (frame_type == kKeyframe)
+    {
+      requestKeyframe();
+    }
+  }
+  if (dumping_)
+  {
+    dump_dropped_ += record_size;
+  }
+  head_ = (head_ + record_size) % ring_.size();
+  used_bytes_ -= record_size;
+  records_count_--;
+  return true;
+}
+
+void FlightRecorderSink::dumpToFile(std::string const& filepath, bool do_compression)
+{
+  size_t offset = 0;
+  size_t records_count = 0;
+  std::chrono::nanoseconds end_time;
+  std::unordered_map<uint64_t, std::pair<std::string, Schema>> schemas;
+  {
+    std::unique_lock lk(mutex_);
+    // wait the end of the post-trigger window. The timestamps may not come from
+    // the system_clock: the remaining time is measured with clock_
+    while (!window_complete_)
+    {
+      const auto remaining = dump_end_time_ - clock_->now();
+      if (remaining <= std::chrono::nanoseconds(0))
+      {
+        break;
+      }
+      window_cv_.wait_for(lk, std::min<std::chrono::nanoseconds>(remaining, kClockPollPeriod));
+    }
+
+    // the records are read from ring_ without the lock: dropOldestRecord
+    // doesn't overwrite them until dump_read_ says so
+    dumping_ = true;
+    dump_size_ = used_bytes_;
+    dump_read_ = 0;
+    dump_dropped_ = 0;
+    offset = head_;
+    records_count = records_count_;
+    end_time = dump_end_time_;
+    schemas = schemas_;
+  }
+
+  try
+  {
+    auto writer = OpenMCAPWriter(filepath, do_compression);
+    std::unordered_map<uint64_t, uint16_t> channel_ids;
+    // the oldest delta frames may refer to keyframes that were discarded already
+    std::unordered_set<uint64_t> awaiting_keyframe;
+    for (auto const& [hash, channel] : schemas)
+    {
+      channel_ids[hash] = AddMCAPChannel(*writer, channel.first, channel.second);
+      if (channel.second.encoding == PayloadEncoding::DELTA)
+      {
+        awaiting_keyframe.insert(hash);
+      }
+    }
+
+    // a message split by the end of the ring is copied here
+    std::vector<uint8_t> wrapped;
+    size_t read_bytes = 0;
+    for (size_t i = 0; i < records_count; i++)
+    {
+      RecordHeader header;
+      readRing(offset, &header, sizeof(RecordHeader));
+      const size_t message_size = kFrameSizes + header.mask_size + header.payload_size;
+      const size_t message_offset = (offset + sizeof(RecordHeader)) % ring_.size();
+      const uint8_t* message = ring_.data() + message_offset;
+      if (message_offset + message_size > ring_.size())
+      {
+        wrapped.resize(message_size);
+        readRing(message_offset, wrapped.data(), message_size);
+        message = wrapped.data();
+      }
+      const uint8_t* payload = message + kFrameSizes + header.mask_size;
+
+      const auto id_it = channel_ids.find(header.schema_hash);
+      bool keep = header.timestamp <= end_time.count() && id_it != channel_ids.end();
+      if (keep && awaiting_keyframe.count(header.schema_hash) > 0)
+      {
+        keep = header.payload_size > 0 && payload[0] == kKeyframe;
+        if (keep)
+        {
+          awaiting_keyframe.erase(header.schema_hash);
+        }
+      }
+      if (keep)
+      {
+        mcap::Message msg;
+        msg.channelId = id_it->second;
+        msg.sequence = 1;
+        msg.logTime = mcap::Timestamp(header.timestamp);
+        msg.publishTime = msg.logTime;
+        msg.data = reinterpret_cast<std::byte const*>(message);   // NOLINT
+        msg.dataSize = message_size;
+        writer->write(msg);
+      }
+
+      offset = (offset + sizeof(RecordHeader) + message_size) % ring_.size();
+      read_bytes += sizeof(RecordHeader) + message_size;
+      if (read_bytes >= kDumpReleaseBytes)
+      {
+        std::scoped_lock lk(mutex_);
+        dump_read_ += read_bytes;
+        read_bytes = 0;
+      }
+    }
+    writer->close();
+  }
+  catch (std::exception& err)
+  {
+    std::cerr << "FlightRecorderSink: failed to save [" << filepath << "]: " << err.what()
+              << std::endl;
+  }
+
+  std::scoped_lock lk(mutex_);
+  dumping_ = false;
+  triggered_ = false;
+}
+
+}   // namespace DataTamer
@@ -1,6 +1,8 @@
 #include "data_tamer/sinks/mcap_sink.hpp"
 #include "data_tamer/contrib/SerializeMe.hpp"
 
+#include <algorithm>
+#include <cstdio>
 #include <sstream>
 #include <mutex>
 
@@ -32,32 +34,96 @@ namespace DataTamer
 {
 
 static constexpr char const* kDataTamer = "data_tamer";
+static constexpr char const* kDroppedMetadata = "data_tamer_dropped";
+// replaced by the number of the file, in RotationOptions::file_pattern
+static const std::string kIndexKey = "{index}";
+
+std::unique_ptr<mcap::McapWriter> OpenMCAPWriter(std::string const& filepath,
+                                                 bool do_compression)
+{
+  auto writer = std::make_unique<mcap::McapWriter>();
+  mcap::McapWriterOptions options(kDataTamer);
+  options.compression = do_compression ? mcap::Compression::Zstd : mcap::Compression::None;
+  auto status = writer->open(filepath, options);
+  if (!status.ok())
+  {
+    throw std::runtime_error("Failed to open MCAP file for writing");
+  }
+  return writer;
+}
+
+uint16_t AddMCAPChannel(mcap::McapWriter& writer, std::string const& channel_name,
+                        Schema const& schema)
+{
+  std::stringstream ss;
+  ss << schema;
+  std::string schema_str = ss.str();
+
+  auto const schema_name = channel_name + "::" + std::to_string(schema.hash);
+
+  // Register a Schema
+  mcap::Schema mcap_schema(schema_name, kDataTamer, schema_str);
+  writer.addSchema(mcap_schema);
+
+  // Register a Channel
+  mcap::Channel publisher(channel_name, kDataTamer, mcap_schema.id);
+  writer.addChannel(publisher);
+  return publisher.id;
+}
 
 MCAPSink::MCAPSink(const std::string& filepath, bool do_compression) : filepath_(filepath), compression_(do_compression)
 {
   openFile(filepath_);
+  trackFile(filepath_);
 }
 
 void DataTamer::MCAPSink::openFile(std::string const& filepath)
 {
   std::scoped_lock lk(mutex_);
-  writer_ = std::make_unique<mcap::McapWriter>();
-  mcap::McapWriterOptions options(kDataTamer);
-  options.compression = compression_ ? mcap::Compression::Zstd : mcap::Compression::None;
-  auto status = writer_->open(filepath, options);
-  if (!status.ok())
-  {
-    throw std::runtime_error("Failed to open MCAP file for writing");
-  }
+  writer_ = OpenMCAPWriter(filepath, compression_);
   start_time_ = std::chrono::system_clock::now();
+  file_size_ = 0;
+  file_bytes_ = 0;
   // clean up, in case this was opened a second time
   hash_to_channel_id_.clear();
 }
 
+void MCAPSink::trackFile(std::string const& filepath)
+{
+  if (std::find(files_.begin(), files_.end(), filepath) == files_.end())
+  {
+    files_.push_back(filepath);
+  }
+  while (rotation_.max_files > 0 && files_.size() > rotation_.max_files)
+  {
+    // deleted after the pending writers, including the one of this file
+    addPendingFile({nullptr, files_.front(), {}});
+    files_.pop_front();
+  }
+}
+
 MCAPSink::~MCAPSink()
 {
   stopThread();
-  std::scoped_lock lk(mutex_);
+  {
+    std::scoped_lock lk(mutex_);
+    if (writer_)
+    {
+      writeDropCounters();
+    }
+  }
+  stopFinalizer();
+}
+
+void MCAPSink::writeDropCounters()
+{
+  const auto counters = dropCounters();
+  mcap::Metadata metadata;
+  metadata.name = kDroppedMetadata;
+  metadata.metadata["rejected"] = std::to_string(counters.rejected);
+  metadata.metadata["evicted"] = std::to_string(counters.evicted);
+  metadata.metadata["decimated"] = std::to_string(counters.decimated);
+  writer_->write(metadata);
 }
 
 void MCAPSink::addChannel(std::string const& channel_name, Schema const& schema)
@@ -69,21 +135,7 @@ void MCAPSink::addChannel(std::string const& channel_name, Schema const& schema)
   {
     return;
   }
-
-  std::stringstream ss;
-  ss << schema;
-  std::string schema_str = ss.str();
-
-  auto const schema_name = channel_name + "::" + std::to_string(schema.hash);
-
-  // Register a Schema
-  mcap::Schema mcap_schema(schema_name, kDataTamer, schema_str);
-  writer_->addSchema(mcap_schema);
-
-  // Register a Channel
-  mcap::Channel publisher(channel_name, kDataTamer, mcap_schema.id);
-  writer_->addChannel(publisher);
-  hash_to_channel_id_[schema.hash] = publisher.id;
+  hash_to_channel_id_[schema.hash] = AddMCAPChannel(*writer_, channel_name, schema);
 }
 
 bool MCAPSink::storeSnapshot(const Snapshot& snapshot)
@@ -93,15 +145,56 @@ bool MCAPSink::storeSnapshot(const Snapshot& snapshot)
   {
     return false;
   }
-  // the payload must contain both the ActiveMask and the other data
-  thread_local std::vector<uint8_t> merged_payload;
-  const auto size_mask = snapshot.active_mask.size();
-  const auto size_data = snapshot.payload.size();
+  writeSnapshot(snapshot);
+  checkRotation();
+  return true;
+}
+
+bool MCAPSink::storeSnapshots(const std::vector<SnapshotPtr>& snapshots)
+{
+  std::scoped_lock lk(mutex_);
+  if(forced_stop_recording_)
+  {
+    return false;
+  }
+  for (const auto& snapshot : snapshots)
+  {
+    writeSnapshot(*snapshot);
+  }
+  checkRotation();
+  return true;
+}
+
+void MCAPSink::writeSnapshot(const Snapshot& snapshot)
+{
+  if (!awaiting_keyframe_.empty() && awaiting_keyframe_.count(snapshot.schema_hash) > 0)
+  {
+    // a delta frame can't be decoded without the previous ones, in the previous file
+    if (snapshot.payload.empty() || snapshot.payload[0] != kKeyframe)
+    {
+      skipped_frames_++;
+      return;
+    }
+    awaiting_keyframe_.erase(snapshot.schema_hash);
+  }
 
-  merged_payload.resize(size_mask + size_data + sizeof(uint32_t) * 2);
-  SerializeMe::SpanBytes buffer(merged_payload);
-  SerializeMe::SerializeIntoBuffer(buffer, snapshot.active_mask);
-  SerializeMe::SerializeIntoBuffer(buffer, snapshot.payload);
+  // the message must contain both the ActiveMask and the payload.
+  // Usually, LogChannel prepared it already (see WriteMessageHeader)
+  size_t message_size = 0;
+  const uint8_t* message = GetFramedMessage(snapshot, message_size);
+  thread_local std::vector<uint8_t> merged_payload;
+  if (!message)
+  {
+    const auto size_mask = snapshot.active_mask.size();
+    const auto size_data = snapshot.payload.size();
+    merged_payload.resize(size_mask + size_data + sizeof(uint32_t) * 2);
+    SerializeMe::SpanBytes buffer(merged_payload);
+    SerializeMe::SerializeIntoBuffer(buffer, snapshot.active_mask);
+    SerializeMe::SerializeIntoBuffer(buffer, uint32_t(size_data));
+    std::memcpy(buffer.data(), snapshot.payload.data(), size_data);
+    message = merged_payload.data();
+    message_size = merged_payload.size();
+  }
 
   // Write our message
   mcap::Message msg;
@@ -110,44 +203,217 @@ bool MCAPSink::storeSnapshot(const Snapshot& snapshot)
   // Timestamp requires nanosecond
   msg.logTime = mcap::Timestamp(snapshot.timestamp.count());
   msg.publishTime = msg.logTime;
-  msg.data = reinterpret_cast<std::byte const*>(merged_payload.data());   // NOLINT
-  msg.dataSize = merged_payload.size();
+  msg.data = reinterpret_cast<std::byte const*>(message);   // NOLINT
+  msg.dataSize = message_size;
+  file_bytes_ += message_size;
+  const auto start = std::chrono::steady_clock::now();
   auto status = writer_->write(msg);
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+
+  write_time_ns_ += std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+  messages_++;
+  if (auto* data_sink = writer_->dataSink())
+  {
+    file_size_ = data_sink->size();
+  }
+}
 
-  // If reset_time_ is exceeded, we want to overwrite the current file.
-  // Better than filling the disk, if you forgot to stop the application.
+void MCAPSink::checkRotation()
+{
+  // If max_duration is exceeded, we want to overwrite the current file (or start
+  // a new one). Better than filling the disk, if you forgot to stop the application.
   auto const now = std::chrono::system_clock::now();
-  if (now - start_time_ > reset_time_)
+  const bool expired =
+      rotation_.max_duration.count() > 0 && now - start_time_ > rotation_.max_duration;
+  const bool too_large =
+      rotation_.max_file_size > 0 && file_bytes_ >= rotation_.max_file_size;
+  if (!expired && !too_large)
   {
-    restartRecording(filepath_, compression_);
+    return;
   }
-  return true;
+  if (rotation_.file_pattern.empty())
+  {
+    overwriteFile();
+    return;
+  }
+  const std::string index = std::to_string(++file_index_);
+  std::string filepath = rotation_.file_pattern;
+  for (auto pos = filepath.find(kIndexKey); pos != std::string::npos;
+       pos = filepath.find(kIndexKey, pos + index.size()))
+  {
+    filepath.replace(pos, kIndexKey.size(), index);
+  }
+  restartRecording(filepath, compression_);
+}
+
+void MCAPSink::addPendingFile(PendingFile&& file)
+{
+  std::scoped_lock lk(finalizer_mutex_);
+  pending_files_.push_back(std::move(file));
+  if (!finalizer_thread_.joinable())
+  {
+    finalizer_thread_ = std::thread([this]() {
+      std::unique_lock lock(finalizer_mutex_);
+      while (true)
+      {
+        finalizer_cv_.wait(lock,
+                           [this] { return stop_finalizer_ || !pending_files_.empty(); });
+        if (pending_files_.empty())
+        {
+          return;
+        }
+        // kept in the queue until done: see waitPendingFiles
+        auto& pending = pending_files_.front();
+        lock.unlock();
+        if (pending.writer)
+        {
+          pending.writer->close();
+          pending.writer.reset();
+        }
+        else if (!pending.rename_to.empty())
+        {
+          std::rename(pending.filepath.c_str(), pending.rename_to.c_str());
+        }
+        else
+        {
+          std::remove(pending.filepath.c_str());
+        }
+        lock.lock();
+        pending_files_.pop_front();
+        finalizer_cv_.notify_all();
+      }
+    });
+  }
+  finalizer_cv_.notify_all();
+}
+
+void MCAPSink::waitPendingFiles()
+{
+  std::unique_lock lk(finalizer_mutex_);
+  finalizer_cv_.wait(lk, [this] { return pending_files_.empty(); });
+}
+
+void MCAPSink::waitPendingFile(std::string const& filepath)
+{
+  std::unique_lock lk(finalizer_mutex_);
+  finalizer_cv_.wait(lk, [&] {
+    return std::none_of(pending_files_.begin(), pending_files_.end(),
+                        [&](const PendingFile& file) {
+                          return file.filepath == filepath || file.rename_to == filepath;
+                        });
+  });
+}
+
+void MCAPSink::stopFinalizer()
+{
+  {
+    std::scoped_lock lk(finalizer_mutex_);
+    stop_finalizer_ = true;
+  }
+  finalizer_cv_.notify_all();
+  if (finalizer_thread_.joinable())
+  {
+    finalizer_thread_.join();
+  }
+}
+
+MCAPSink::WriterStatistics MCAPSink::writerStatistics() const
+{
+  WriterStatistics stats;
+  stats.write_time = std::chrono::nanoseconds(write_time_ns_.load());
+  stats.messages = messages_.load();
+  stats.file_size = file_size_.load();
+  stats.skipped_frames = skipped_frames_.load();
+  return stats;
 }
 
 void MCAPSink::setMaxTimeBeforeReset(std::chrono::seconds reset_time)
 {
-  reset_time_ = reset_time;
+  std::scoped_lock lk(mutex_);
+  rotation_.max_duration = reset_time;
+}
+
+void MCAPSink::setRotation(const RotationOptions& options)
+{
+  // otherwise, each rotation would silently overwrite the previous file
+  if (!options.file_pattern.empty() &&
+      options.file_pattern.find(kIndexKey) == std::string::npos)
+  {
+    throw std::runtime_error("MCAPSink::setRotation: the file_pattern [" +
+                             options.file_pattern + "] doesn't contain " + kIndexKey);
+  }
+  std::scoped_lock lk(mutex_);
+  rotation_ = options;
 }
 
 void MCAPSink::stopRecording()
 {
   std::scoped_lock lk(mutex_);
   forced_stop_recording_ = true;
+  writeDropCounters();
   writer_->close();
   writer_.reset();
+  waitPendingFiles();
 }
 
 void MCAPSink::restartRecording(const std::string &filepath, bool do_compression)
 {
   std::scoped_lock lk(mutex_);
+  if (writer_)
+  {
+    writeDropCounters();
+    if (filepath == filepath_)
+    {
+      // the same file can not be finalized while we write it again
+      writer_->close();
+      writer_.reset();
+    }
+    else
+    {
+      addPendingFile({std::move(writer_), filepath_, {}});
+    }
+  }
+  // still to be closed or deleted by the finalizer
+  waitPendingFile(filepath);
   filepath_ = filepath;
   compression_ = do_compression;
   openFile(filepath_);
+  trackFile(filepath_);
+  rebuildChannels();
+}
 
-  // rebuild the channels
+void MCAPSink::overwriteFile()
+{
+#ifdef _WIN32
+  // an open file can't be renamed
+  restartRecording(filepath_, compression_);
+#else
+  writeDropCounters();
+  addPendingFile({std::move(writer_), filepath_, {}});
+
+  // renamed to filepath_ (while we write it) after the previous file is closed
+  const std::string part_path = filepath_ + ".part";
+  waitPendingFile(part_path);
+  openFile(part_path);
+  addPendingFile({nullptr, part_path, filepath_});
+  rebuildChannels();
+#endif
+}
+
+void MCAPSink::rebuildChannels()
+{
+  awaiting_keyframe_.clear();
   for (auto const& [name, schema] : schemas_)
   {
     addChannel(name, schema);
+    if (schema.encoding == PayloadEncoding::DELTA)
+    {
+      awaiting_keyframe_.insert(schema.hash);
+    }
+  }
+  if (!awaiting_keyframe_.empty())
+  {
+    requestKeyframe();
   }
 }
 
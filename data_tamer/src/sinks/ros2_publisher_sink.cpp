@@ -51,7 +51,7 @@ bool ROS2PublisherSink::storeSnapshot(const Snapshot& snapshot)
   data_msg_.timestamp_nsec = uint64_t(snapshot.timestamp.count());
   data_msg_.schema_hash = snapshot.schema_hash;
   data_msg_.active_mask = snapshot.active_mask;
-  data_msg_.payload = snapshot.payload;
+  data_msg_.payload.assign(snapshot.payload.begin(), snapshot.payload.end());
   data_publisher_->publish(data_msg_);
 
   return true;
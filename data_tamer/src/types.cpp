@@ -1,4 +1,5 @@
 #include "data_tamer/types.hpp"
+#include "data_tamer/details/float16.hpp"
 #include <array>
 #include <cstring>
 #include <iostream>
@@ -18,7 +19,8 @@ static const std::array<std::string, TypesCount> kNames = {
     "int32", "uint32",
     "int64", "uint64",
     "float32", "float64",
-    "other"
+    "other",
+    "float16", "bfloat16"
 };
 // clang-format on
 
@@ -50,7 +52,8 @@ size_t SizeOf(const BasicType& type)
       { 1, 1,
         1, 1,
         2, 2, 4, 4, 8, 8,
-        4, 8, 0 };
+        4, 8, 0,
+        2, 2 };
   // clang-format on
   return kSizes[static_cast<size_t>(type)];
 }
@@ -86,6 +89,9 @@ VarNumber DeserializeAsVarType(const BasicType& type, const void* data)
     case BasicType::FLOAT32: return DeserializeImpl<float>(data);
     case BasicType::FLOAT64: return DeserializeImpl<double>(data);
 
+    case BasicType::FLOAT16: return HalfToFloat(DeserializeImpl<uint16_t>(data));
+    case BasicType::BFLOAT16: return BFloat16ToFloat(DeserializeImpl<uint16_t>(data));
+
     case BasicType::OTHER:
       return double(std::numeric_limits<double>::quiet_NaN());
   }
@@ -100,6 +106,7 @@ uint64_t AddFieldToHash(const TypeField& field, uint64_t hash)
   const std::hash<BasicType> type_hasher;
   const std::hash<bool> bool_hasher;
   const std::hash<uint32_t> uint_hasher;
+  const std::hash<double> double_hasher;
 
   auto combine = [&hash](const auto& hasher, const auto& val) {
     hash ^= hasher(val) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
@@ -113,6 +120,11 @@ uint64_t AddFieldToHash(const TypeField& field, uint64_t hash)
   }
   combine(bool_hasher, field.is_vector);
   combine(uint_hasher, field.array_size);
+  if (field.quantization)
+  {
+    combine(double_hasher, field.quantization->scale);
+    combine(double_hasher, field.quantization->offset);
+  }
   return hash;
 }
 
@@ -136,6 +148,14 @@ std::ostream& operator<<(std::ostream& os, const TypeField& field)
     os << "[]";
   }
   os << ' ' << field.field_name;
+  if (field.quantization)
+  {
+    // enough digits to read back exactly the same value
+    const auto precision = os.precision(std::numeric_limits<double>::max_digits10);
+    os << " scale=" << field.quantization->scale
+       << " offset=" << field.quantization->offset;
+    os.precision(precision);
+  }
   return os;
 }
 
@@ -143,7 +163,16 @@ std::ostream& operator<<(std::ostream& os, const Schema& schema)
 {
   os << "### version: " << SCHEMA_VERSION << "\n";
   os << "### hash: " << schema.hash << "\n";
-  os << "### channel_name: " << schema.channel_name << "\n\n";
+  os << "### channel_name: " << schema.channel_name << "\n";
+  if (schema.encoding == PayloadEncoding::DELTA)
+  {
+    os << "### encoding: delta\n";
+  }
+  if (schema.clock != kDefaultClock)
+  {
+    os << "### clock: " << schema.clock << "\n";
+  }
+  os << "\n";
 
   //  std::map<std::string, CustomSerializer::Ptr> custom_types;
   for (const auto& field : schema.fields)
@@ -175,7 +204,10 @@ bool TypeField::operator==(const TypeField& other) const
 {
   return is_vector == other.is_vector && type == other.type &&
          array_size == other.array_size && field_name == other.field_name &&
-         type_name == other.type_name;
+         type_name == other.type_name &&
+         quantization.has_value() == other.quantization.has_value() &&
+         (!quantization || (quantization->scale == other.quantization->scale &&
+                            quantization->offset == other.quantization->offset));
 }
 
 bool TypeField::operator!=(const TypeField& other) const
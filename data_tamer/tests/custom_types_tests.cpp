@@ -36,6 +36,57 @@ struct TypeDefinition<TestType>
 };
 } // namespace DataTamer
 
+// has padding between its fields
+struct PaddedType
+{
+  uint8_t flag;
+  double value;
+  int16_t count;
+  std::array<float, 2> data;
+  Point3D point;
+};
+
+namespace DataTamer
+{
+template <>
+struct TypeDefinition<PaddedType>
+{
+  std::string typeName() const { return "PaddedType"; }
+
+  template <class Function> void typeDef(Function& addField)
+  {
+    addField("flag", &PaddedType::flag);
+    addField("value", &PaddedType::value);
+    addField("count", &PaddedType::count);
+    addField("data", &PaddedType::data);
+    addField("point", &PaddedType::point);
+  }
+};
+} // namespace DataTamer
+
+// not a standard-layout type: serialized field by field
+struct VirtualPoint
+{
+  virtual ~VirtualPoint() = default;
+  double x = 0;
+  double y = 0;
+};
+
+namespace DataTamer
+{
+template <>
+struct TypeDefinition<VirtualPoint>
+{
+  std::string typeName() const { return "VirtualPoint"; }
+
+  template <class Function> void typeDef(Function& addField)
+  {
+    addField("x", &VirtualPoint::x);
+    addField("y", &VirtualPoint::y);
+  }
+};
+} // namespace DataTamer
+
 TEST(DataTamerCustom, CustomType1)
 {
   auto channel = LogChannel::create("chan");
@@ -259,3 +310,106 @@ TEST(DataTamerCustom, CustomType3)
   ASSERT_TRUE(std::string::npos != posB);
   ASSERT_LT(posA, posB);
 }
+
+TEST(DataTamerCustom, MemoryRuns)
+{
+  std::vector<MemoryRun> runs;
+  ASSERT_TRUE(GetMemoryRuns<Pose>(0, runs));
+  ASSERT_EQ(runs.size(), 1);
+  ASSERT_EQ(runs[0].offset, 0);
+  ASSERT_EQ(runs[0].size, sizeof(Pose));
+
+  runs.clear();
+  ASSERT_TRUE(GetMemoryRuns<PaddedType>(0, runs));
+  // "value" and "count" are adjacent
+  ASSERT_EQ(runs.size(), 4);
+  ASSERT_EQ(runs[0].offset, offsetof(PaddedType, flag));
+  ASSERT_EQ(runs[0].size, sizeof(uint8_t));
+  ASSERT_EQ(runs[1].offset, offsetof(PaddedType, value));
+  ASSERT_EQ(runs[1].size, sizeof(double) + sizeof(int16_t));
+  ASSERT_EQ(runs[2].offset, offsetof(PaddedType, data));
+  ASSERT_EQ(runs[2].size, sizeof(float) * 2);
+  ASSERT_EQ(runs[3].offset, offsetof(PaddedType, point));
+  ASSERT_EQ(runs[3].size, sizeof(Point3D));
+
+  // vectors can not be copied with memcpy
+  runs.clear();
+  ASSERT_FALSE(GetMemoryRuns<TestType>(0, runs));
+
+  runs.clear();
+  ASSERT_FALSE(GetMemoryRuns<VirtualPoint>(0, runs));
+  VirtualPoint point;
+  point.x = 1;
+  point.y = 2;
+  CustomSerializerT<VirtualPoint> point_serializer;
+  std::vector<uint8_t> point_buffer(point_serializer.serializedSize(&point));
+  ASSERT_EQ(point_buffer.size(), sizeof(double) * 2);
+  SerializeMe::SpanBytes point_span(point_buffer);
+  point_serializer.serialize(&point, point_span);
+  double point_values[2];
+  std::memcpy(point_values, point_buffer.data(), sizeof(point_values));
+  ASSERT_EQ(point_values[0], 1.0);
+  ASSERT_EQ(point_values[1], 2.0);
+
+  // same result of the serialization field by field
+  PaddedType obj = {1, 2.0, 3, {4.0f, 5.0f}, {6.0, 7.0, 8.0}};
+  CustomSerializerT<PaddedType> serializer;
+  std::vector<uint8_t> buffer_A(serializer.serializedSize(&obj));
+  std::vector<uint8_t> buffer_B(SerializeMe::BufferSize(obj));
+  ASSERT_EQ(buffer_A.size(), buffer_B.size());
+
+  SerializeMe::SpanBytes span_A(buffer_A);
+  serializer.serialize(&obj, span_A);
+  SerializeMe::SpanBytes span_B(buffer_B);
+  SerializeMe::SerializeIntoBuffer(span_B, obj);
+  ASSERT_EQ(buffer_A, buffer_B);
+}
+
+TEST(DataTamerCustom, SerializeArray)
+{
+  // Point3D is copied with a single memcpy, PaddedType one object at the time.
+  // In both cases, the result must be the same of SerializeMe
+  std::vector<Point3D> points(100);
+  std::vector<PaddedType> padded(100);
+  for (size_t i = 0; i < points.size(); i++)
+  {
+    const auto val = double(i);
+    points[i] = {val, val + 0.1, val + 0.2};
+    padded[i] = {uint8_t(i), val, int16_t(i), {float(i), 1.0f}, points[i]};
+  }
+
+  auto check = [](const auto& vect) {
+    using Type = typename std::decay_t<decltype(vect)>::value_type;
+    CustomSerializerT<Type> serializer;
+    std::vector<uint8_t> buffer_A(vect.size() * serializer.serializedSize(&vect.front()));
+    std::vector<uint8_t> buffer_B(buffer_A.size());
+
+    SerializeMe::SpanBytes span_A(buffer_A);
+    serializer.serializeArray(vect.data(), vect.size(), sizeof(Type), span_A);
+    ASSERT_EQ(span_A.size(), 0);
+
+    SerializeMe::SpanBytes span_B(buffer_B);
+    for (const auto& obj : vect)
+    {
+      SerializeMe::SerializeIntoBuffer(span_B, obj);
+    }
+    ASSERT_EQ(buffer_A, buffer_B);
+
+    // buffer too small
+    SerializeMe::SpanBytes span_C(buffer_A.data(), buffer_A.size() - 1);
+    ASSERT_ANY_THROW(
+        serializer.serializeArray(vect.data(), vect.size(), sizeof(Type), span_C););
+  };
+  check(points);
+  check(padded);
+
+  // an empty array of custom types contributes nothing to the payload
+  using details::CustomArrayOps;
+  std::array<Point3D, 0> empty_array;
+  CustomSerializerT<Point3D> point_serializer;
+  ASSERT_EQ((CustomArrayOps<Point3D, 0>::size(&empty_array, &point_serializer)), 0);
+  std::vector<uint8_t> buffer(1);
+  SerializeMe::SpanBytes span(buffer);
+  CustomArrayOps<Point3D, 0>::serialize(&empty_array, &point_serializer, span);
+  ASSERT_EQ(span.size(), 1);
+}
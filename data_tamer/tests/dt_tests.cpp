@@ -1,16 +1,123 @@
 #include "data_tamer/data_tamer.hpp"
+#include "data_tamer/sink_executor.hpp"
 #include "data_tamer/sinks/dummy_sink.hpp"
+#include "data_tamer/sinks/flight_recorder_sink.hpp"
+#include "data_tamer/sinks/mcap_sink.hpp"
+#include "data_tamer_parser/data_tamer_parser.hpp"
 
 #include "../examples/geometry_types.hpp"
 
 #include <gtest/gtest.h>
+#include <mcap/reader.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <new>
 #include <variant>
 #include <string>
 #include <thread>
 
 using namespace DataTamer;
 
+// count the allocations done in the current thread, while count_allocations is true
+static thread_local bool count_allocations = false;
+static thread_local size_t allocations_count = 0;
+
+#if defined(__GNUC__) && !defined(__clang__)
+// false positive, when the replaced operator delete is inlined
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void* operator new(std::size_t size)
+{
+  if (count_allocations)
+  {
+    allocations_count++;
+  }
+  if (void* ptr = std::malloc(size))
+  {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept
+{
+  std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+  std::free(ptr);
+}
+
+// wait until the sink stored `count` snapshots, for at most one second
+static void WaitStored(const DataSinkBase& sink, uint64_t count)
+{
+  for (int i = 0; i < 1000 && sink.statistics().stored < count; i++)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
+
+struct MCAPMessage
+{
+  std::string channel;
+  int64_t timestamp = 0;
+  // false if ParseSnapshot failed
+  bool parsed = false;
+  std::map<std::string, double> values;
+};
+
+// all the messages of an MCAP file written by MCAPSink, parsed in order
+static std::vector<MCAPMessage> ReadMCAP(const std::string& filepath)
+{
+  std::vector<MCAPMessage> messages;
+  mcap::McapReader reader;
+  if (!reader.open(filepath).ok())
+  {
+    return messages;
+  }
+  std::unordered_map<mcap::SchemaId, DataTamerParser::Schema> schemas;
+  reader.readSummary(mcap::ReadSummaryMethod::NoFallbackScan);
+  for (const auto& [schema_id, mcap_schema] : reader.schemas())
+  {
+    const std::string schema_text(reinterpret_cast<const char*>(mcap_schema->data.data()),
+                                  mcap_schema->data.size());
+    schemas[schema_id] = DataTamerParser::BuilSchemaFromText(schema_text);
+  }
+  for (const auto& msg : reader.readMessages())
+  {
+    const auto& schema = schemas.at(msg.schema->id);
+    DataTamerParser::BufferSpan buffer = {
+        reinterpret_cast<const uint8_t*>(msg.message.data), msg.message.dataSize};
+    DataTamerParser::SnapshotView snapshot;
+    snapshot.schema_hash = schema.hash;
+    snapshot.timestamp = msg.message.logTime;
+    const auto mask_size = DataTamerParser::Deserialize<uint32_t>(buffer);
+    snapshot.active_mask = {buffer.data, mask_size};
+    buffer.trimFront(mask_size);
+    const auto payload_size = DataTamerParser::Deserialize<uint32_t>(buffer);
+    snapshot.payload = {buffer.data, payload_size};
+
+    MCAPMessage message;
+    message.channel = msg.channel->topic;
+    message.timestamp = int64_t(msg.message.logTime);
+    auto callback = [&](const std::string& name, const DataTamerParser::VarNumber& number) {
+      message.values[name] = std::visit([](const auto& var) { return double(var); }, number);
+    };
+    message.parsed = DataTamerParser::ParseSnapshot(schema, snapshot, callback);
+    messages.push_back(std::move(message));
+  }
+  reader.close();
+  return messages;
+}
+
 TEST(DataTamerBasic, BasicTypes)
 {
   for(size_t i=0; i<TypesCount; i++)
@@ -232,3 +339,1215 @@ TEST(DataTamerBasic, Disable)
   checkSize(id_v7, 4 * sizeof(float) + sizeof(uint32_t));
   ASSERT_EQ(sink->latest_snapshot.active_mask[0], 0b10111111);
 }
+
+TEST(DataTamerBasic, SnapshotPlan)
+{
+  auto channel = LogChannel::create("chan");
+  auto sink = std::make_shared<DummySink>();
+  channel->addDataSink(sink);
+
+  // contiguous in memory: will be merged in a single memcpy
+  std::array<double, 4> values = {1, 2, 3, 4};
+  std::vector<int32_t> vect = {5, 6};
+  Point3D point = {7, 8, 9};
+
+  auto id_v0 = channel->registerValue("v0", &values[0]);
+  channel->registerValue("v1", &values[1]);
+  auto id_v2 = channel->registerValue("v2", &values[2]);
+  channel->registerValue("v3", &values[3]);
+  channel->registerValue("vect", &vect);
+  channel->registerValue("point", &point);
+
+  auto payloadAs = [&](size_t offset, auto value) {
+    std::memcpy(&value, sink->latest_snapshot.payload.data() + offset, sizeof(value));
+    return value;
+  };
+
+  channel->takeSnapshot();
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+  ASSERT_EQ(sink->latest_snapshot.payload.size(),
+            4 * sizeof(double) + sizeof(uint32_t) + 2 * sizeof(int32_t) + sizeof(Point3D));
+  ASSERT_EQ(payloadAs(0, double()), 1);
+  ASSERT_EQ(payloadAs(24, double()), 4);
+  ASSERT_EQ(payloadAs(32, uint32_t()), 2);
+  ASSERT_EQ(payloadAs(40, int32_t()), 6);
+  ASSERT_EQ(payloadAs(44, double()), 7);
+
+  // values are read at every snapshot, even if the plan didn't change
+  values[3] = 40;
+  vect.push_back(60);
+  point.z = 90;
+
+  channel->takeSnapshot();
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+  ASSERT_EQ(sink->latest_snapshot.payload.size(),
+            4 * sizeof(double) + sizeof(uint32_t) + 3 * sizeof(int32_t) + sizeof(Point3D));
+  ASSERT_EQ(payloadAs(24, double()), 40);
+  ASSERT_EQ(payloadAs(32, uint32_t()), 3);
+  ASSERT_EQ(payloadAs(44, int32_t()), 60);
+  ASSERT_EQ(payloadAs(64, double()), 90);
+
+  // disabling a value in the middle of a contiguous block splits it
+  channel->setEnabled(id_v2, false);
+  channel->unregister(id_v0);
+
+  channel->takeSnapshot();
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+  ASSERT_EQ(sink->latest_snapshot.active_mask[0], 0b11111010);
+  ASSERT_EQ(sink->latest_snapshot.payload.size(),
+            2 * sizeof(double) + sizeof(uint32_t) + 3 * sizeof(int32_t) + sizeof(Point3D));
+  ASSERT_EQ(payloadAs(0, double()), 2);
+  ASSERT_EQ(payloadAs(8, double()), 40);
+
+  // registering again with a different pointer
+  double other = 100;
+  channel->registerValue("v0", &other);
+
+  channel->takeSnapshot();
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  ASSERT_EQ(payloadAs(0, double()), 100);
+  ASSERT_EQ(payloadAs(8, double()), 2);
+  ASSERT_EQ(payloadAs(16, double()), 40);
+}
+
+// remember the address of the buffers received
+class AddressSink : public DataSinkBase
+{
+public:
+  std::vector<const uint8_t*> payload_addresses;
+  Mutex mutex;
+
+  ~AddressSink() override
+  {
+    stopThread();
+  }
+
+  void addChannel(std::string const&, Schema const&) override
+  {}
+
+  bool storeSnapshot(const Snapshot& snapshot) override
+  {
+    std::scoped_lock lk(mutex);
+    payload_addresses.push_back(snapshot.payload.data());
+    return true;
+  }
+};
+
+TEST(DataTamerBasic, SharedSnapshot)
+{
+  auto channel = LogChannel::create("chan");
+  auto sink_A = std::make_shared<AddressSink>();
+  auto sink_B = std::make_shared<AddressSink>();
+  channel->addDataSink(sink_A);
+  channel->addDataSink(sink_B);
+
+  std::vector<double> values(1000, 42);
+  channel->registerValue("values", &values);
+
+  const size_t shapshot_count = 5;
+  for(size_t i=0; i<shapshot_count; i++)
+  {
+    channel->takeSnapshot();
+    // give time to the sinks to release the buffer
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+
+  ASSERT_EQ(sink_A->payload_addresses.size(), shapshot_count);
+  ASSERT_EQ(sink_B->payload_addresses.size(), shapshot_count);
+
+  for(size_t i=0; i<shapshot_count; i++)
+  {
+    // same buffer shared by both sinks
+    ASSERT_EQ(sink_A->payload_addresses[i], sink_B->payload_addresses[i]);
+    // and recycled by the following snapshots
+    ASSERT_EQ(sink_A->payload_addresses[i], sink_A->payload_addresses[0]);
+  }
+}
+
+TEST(DataTamerBasic, NoAllocationsInSteadyState)
+{
+  auto channel = LogChannel::create("chan");
+  auto sink_A = std::make_shared<DummySink>();
+  auto sink_B = std::make_shared<DummySink>();
+  channel->addDataSink(sink_A);
+  channel->addDataSink(sink_B);
+
+  double v1 = 1;
+  int32_t v2 = 2;
+  std::array<float, 3> v3 = {1, 2, 3};
+  std::vector<double> v4(100, 4);
+  Pose pose;
+  std::vector<Point3D> points(10);
+
+  channel->registerValue("v1", &v1);
+  channel->registerValue("v2", &v2);
+  channel->registerValue("v3", &v3);
+  channel->registerValue("v4", &v4);
+  channel->registerValue("pose", &pose);
+  channel->registerValue("points", &points);
+
+  // warm up: first snapshot, creation of the producer in the sink queues, etc.
+  // Each snapshot is stored, i.e. its buffer is back in the pool, before the next one
+  uint64_t snapshots_count = 0;
+  for(int i=0; i<10; i++)
+  {
+    channel->takeSnapshot();
+    snapshots_count++;
+    WaitStored(*sink_A, snapshots_count);
+    WaitStored(*sink_B, snapshots_count);
+  }
+
+  allocations_count = 0;
+  for(int i=0; i<100; i++)
+  {
+    v1 += 1.0;
+    count_allocations = true;
+    channel->takeSnapshot();
+    count_allocations = false;
+    snapshots_count++;
+    WaitStored(*sink_A, snapshots_count);
+    WaitStored(*sink_B, snapshots_count);
+  }
+  ASSERT_EQ(allocations_count, 0);
+}
+
+TEST(DataTamerBasic, SeqLockLoggedValue)
+{
+  auto channel = LogChannel::create("chan");
+  auto sink = std::make_shared<DummySink>();
+  channel->addDataSink(sink);
+
+  auto value = channel->createLoggedValue<int32_t>("value", 42, LoggedValueLock::SEQLOCK);
+  auto pose = channel->createLoggedValue<Pose>("pose", {}, LoggedValueLock::SEQLOCK);
+
+  ASSERT_EQ(value->get(), 42);
+  ASSERT_ANY_THROW(auto ref = value->getLockedReference(););
+
+  // the writer never locks writeMutex(); each snapshot must be consistent
+  std::atomic_bool run = true;
+  std::thread writer([&]() {
+    double count = 0;
+    while (run)
+    {
+      count += 1;
+      pose->set({{count, count, count}, {count, count, count, count}});
+    }
+  });
+
+  // the writer is stopped before checking the payloads: a failed ASSERT
+  // must not destroy a joinable thread
+  const int snapshots_count = 20;
+  std::vector<std::vector<uint8_t>> payloads;
+  for(int i=0; i<snapshots_count; i++)
+  {
+    value->set(i);
+    channel->takeSnapshot();
+    WaitStored(*sink, uint64_t(i + 1));
+
+    std::scoped_lock lk(sink->schema_mutex_);
+    const auto& payload = sink->latest_snapshot.payload;
+    payloads.emplace_back(payload.begin(), payload.end());
+  }
+  run = false;
+  writer.join();
+
+  for(int i=0; i<snapshots_count; i++)
+  {
+    const auto& payload = payloads[size_t(i)];
+    ASSERT_EQ(payload.size(), sizeof(int32_t) + sizeof(Pose));
+
+    int32_t stored_value = 0;
+    std::memcpy(&stored_value, payload.data(), sizeof(int32_t));
+    ASSERT_EQ(stored_value, i);
+
+    std::array<double, 7> fields;
+    std::memcpy(fields.data(), payload.data() + sizeof(int32_t), sizeof(Pose));
+    for(const auto& field: fields)
+    {
+      ASSERT_EQ(field, fields[0]);
+    }
+  }
+}
+
+TEST(DataTamerBasic, DeferredSerialization)
+{
+  auto channel = LogChannel::create("chan");
+  auto deferred_channel = LogChannel::create("deferred");
+  auto sink = std::make_shared<DummySink>();
+  auto deferred_sink = std::make_shared<DummySink>();
+  channel->addDataSink(sink);
+  deferred_channel->addDataSink(deferred_sink);
+  deferred_channel->setDeferredSerialization(true);
+
+  uint8_t flag = 1;
+  double value = 0;
+  Pose pose = {};
+  std::array<Point3D, 2> points = {};
+  std::array<int16_t, 3> numbers = {};
+
+  for (auto& chan : {channel, deferred_channel})
+  {
+    chan->registerValue("flag", &flag);
+    chan->registerValue("value", &value);
+    chan->registerValue("pose", &pose);
+    chan->registerValue("points", &points);
+    chan->registerValue("numbers", &numbers);
+  }
+
+  // vectors can not be captured
+  std::vector<double> vect(10);
+  ASSERT_ANY_THROW(deferred_channel->registerValue("vect", &vect););
+
+  for (int i = 0; i < 10; i++)
+  {
+    const double x = double(i);
+    flag = uint8_t(i);
+    value = x;
+    pose = {{x, x, x}, {x, x, x, x}};
+    points = {Point3D{x, x, x}, Point3D{x, x, x}};
+    numbers = {int16_t(i), int16_t(i), int16_t(i)};
+
+    channel->takeSnapshot();
+    deferred_channel->takeSnapshot();
+    // the snapshot must contain the values at the time takeSnapshot was called
+    value = -1;
+    pose.pos.x = -1;
+    points[1].z = -1;
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+    std::scoped_lock lk(sink->schema_mutex_, deferred_sink->schema_mutex_);
+    ASSERT_EQ(sink->latest_snapshot.payload.size(),
+              sizeof(uint8_t) + sizeof(double) + sizeof(Pose) + sizeof(points) +
+                  sizeof(numbers));
+    ASSERT_EQ(sink->latest_snapshot.payload, deferred_sink->latest_snapshot.payload);
+    ASSERT_EQ(sink->latest_snapshot.active_mask, deferred_sink->latest_snapshot.active_mask);
+  }
+
+  // can't be changed once logging started
+  ASSERT_ANY_THROW(deferred_channel->setDeferredSerialization(false););
+}
+
+class TimestampSink : public DataSinkBase
+{
+public:
+  std::map<std::string, std::vector<std::chrono::nanoseconds>> timestamps;
+  Mutex mutex;
+
+  ~TimestampSink() override
+  {
+    stopThread();
+  }
+
+  void addChannel(std::string const&, Schema const&) override
+  {}
+
+  bool storeSnapshot(const Snapshot& snapshot) override
+  {
+    std::scoped_lock lk(mutex);
+    timestamps[std::string(snapshot.channel_name)].push_back(snapshot.timestamp);
+    return true;
+  }
+};
+
+TEST(DataTamerBasic, TakeSnapshotAll)
+{
+  ChannelsRegistry registry;
+  auto sink = std::make_shared<TimestampSink>();
+  registry.addDefaultSink(sink);
+  registry.setSnapshotThreads(2);
+
+  const size_t channels_count = 10;
+  std::vector<double> values(channels_count, 0);
+  for (size_t i = 0; i < channels_count; i++)
+  {
+    auto channel = registry.getChannel("chan_" + std::to_string(i));
+    channel->registerValue("value", &values[i]);
+  }
+  // deferred channels are supported too
+  registry.getChannel("chan_0")->setDeferredSerialization(true);
+
+  const std::chrono::nanoseconds time_A(1000);
+  const std::chrono::nanoseconds time_B(2000);
+  const std::chrono::nanoseconds time_single(1500);
+  ASSERT_TRUE(registry.takeSnapshotAll(time_A));
+  // a channel can be snapshotted alone too, without reordering its snapshots
+  ASSERT_TRUE(registry.getChannel("chan_1")->takeSnapshot(time_single));
+  ASSERT_TRUE(registry.takeSnapshotAll(time_B));
+
+  // wait for the sink thread (and the thread of the deferred channel)
+  for (int i = 0; i < 100; i++)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    std::scoped_lock lk(sink->mutex);
+    size_t received = 0;
+    for (const auto& [name, timestamps] : sink->timestamps)
+    {
+      received += timestamps.size();
+    }
+    if (received == 2 * channels_count + 1)
+    {
+      break;
+    }
+  }
+
+  std::scoped_lock lk(sink->mutex);
+  ASSERT_EQ(sink->timestamps.size(), channels_count);
+  for (const auto& [name, timestamps] : sink->timestamps)
+  {
+    if (name == "chan_1")
+    {
+      const std::vector<std::chrono::nanoseconds> expected = {time_A, time_single, time_B};
+      ASSERT_EQ(timestamps, expected);
+      continue;
+    }
+    ASSERT_EQ(timestamps.size(), 2);
+    ASSERT_EQ(timestamps[0], time_A);
+    ASSERT_EQ(timestamps[1], time_B);
+  }
+}
+
+TEST(DataTamerBasic, RegistrySetClock)
+{
+  ChannelsRegistry registry;
+  auto sink = std::make_shared<TimestampSink>();
+  registry.addDefaultSink(sink);
+
+  double value = 0;
+  auto chan_A = registry.getChannel("chan_A");
+  auto chan_B = registry.getChannel("chan_B");
+  chan_A->registerValue("value", &value);
+  chan_B->registerValue("value", &value);
+  chan_B->takeSnapshot();
+
+  // chan_B started recording: no channel changes clock
+  auto clock = std::make_shared<SimulatedClock>(std::chrono::seconds(10));
+  ASSERT_ANY_THROW(registry.setClock(clock););
+  ASSERT_EQ(chan_A->getSchema().clock, kDefaultClock);
+
+  // but the clock can be changed if no channel started recording
+  registry.clear();
+  auto chan_C = registry.getChannel("chan_C");
+  registry.setClock(clock);
+  ASSERT_EQ(chan_C->getSchema().clock, "simulated");
+  ASSERT_EQ(registry.getChannel("chan_D")->getSchema().clock, "simulated");
+}
+
+TEST(DataTamerBasic, SinkDecimation)
+{
+  auto channel = LogChannel::create("chan");
+  auto sink_all = std::make_shared<TimestampSink>();
+  auto sink_nth = std::make_shared<TimestampSink>();
+  auto sink_period = std::make_shared<TimestampSink>();
+
+  channel->addDataSink(sink_all);
+  channel->addDataSink(sink_nth, {3, {}});
+  channel->addDataSink(sink_period, {1, std::chrono::nanoseconds(10)});
+
+  ASSERT_ANY_THROW(channel->addDataSink(sink_all, {0, {}}););
+  ASSERT_ANY_THROW(channel->setDeltaEncoding(10););
+
+  double value = 0;
+  channel->registerValue("value", &value);
+
+  for (int i = 0; i < 10; i++)
+  {
+    channel->takeSnapshot(std::chrono::nanoseconds(i * 4));
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+  using std::chrono::nanoseconds;
+  using Timestamps = std::vector<nanoseconds>;
+  {
+    std::scoped_lock lk(sink_all->mutex);
+    ASSERT_EQ(sink_all->timestamps["chan"].size(), 10);
+  }
+  {
+    std::scoped_lock lk(sink_nth->mutex);
+    const Timestamps expected = {nanoseconds(0), nanoseconds(12), nanoseconds(24),
+                                 nanoseconds(36)};
+    ASSERT_EQ(sink_nth->timestamps["chan"], expected);
+  }
+  {
+    std::scoped_lock lk(sink_period->mutex);
+    const Timestamps expected = {nanoseconds(0), nanoseconds(12), nanoseconds(24),
+                                 nanoseconds(36)};
+    ASSERT_EQ(sink_period->timestamps["chan"], expected);
+  }
+}
+
+// storeSnapshot waits until the gate is open
+class GatedSink : public TimestampSink
+{
+public:
+  std::atomic_bool open = false;
+  std::atomic_bool waiting = false;
+
+  ~GatedSink() override
+  {
+    open = true;
+    stopThread();
+  }
+
+  bool storeSnapshot(const Snapshot& snapshot) override
+  {
+    waiting = true;
+    while (!open)
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return TimestampSink::storeSnapshot(snapshot);
+  }
+};
+
+TEST(DataTamerBasic, QueueLimits)
+{
+  using std::chrono::nanoseconds;
+  using Timestamps = std::vector<nanoseconds>;
+
+  auto run = [](OverflowPolicy policy) {
+    auto sink = std::make_shared<GatedSink>();
+    QueueLimits limits;
+    limits.max_snapshots = 3;
+    limits.policy = policy;
+    sink->setQueueLimits(limits);
+
+    Snapshot snapshot;
+    snapshot.channel_name = "chan";
+    snapshot.timestamp = nanoseconds(0);
+    // the first one is blocked in storeSnapshot, the queue is empty
+    EXPECT_TRUE(sink->pushSnapshot(snapshot));
+    while (!sink->waiting)
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    for (int i = 1; i <= 5; i++)
+    {
+      snapshot.timestamp = nanoseconds(i);
+      sink->pushSnapshot(snapshot);
+    }
+    sink->open = true;
+    for (int i = 0; i < 100; i++)
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      std::scoped_lock lk(sink->mutex);
+      if (sink->timestamps["chan"].size() == 4)
+      {
+        break;
+      }
+    }
+    std::scoped_lock lk(sink->mutex);
+    return std::make_pair(sink->timestamps["chan"], sink->dropCounters());
+  };
+
+  {
+    const auto [timestamps, dropped] = run(OverflowPolicy::DROP_NEWEST);
+    const Timestamps expected = {nanoseconds(0), nanoseconds(1), nanoseconds(2),
+                                 nanoseconds(3)};
+    ASSERT_EQ(timestamps, expected);
+    ASSERT_EQ(dropped.rejected, 2);
+    ASSERT_EQ(dropped.total(), 2);
+  }
+  {
+    const auto [timestamps, dropped] = run(OverflowPolicy::DROP_OLDEST);
+    const Timestamps expected = {nanoseconds(0), nanoseconds(3), nanoseconds(4),
+                                 nanoseconds(5)};
+    ASSERT_EQ(timestamps, expected);
+    ASSERT_EQ(dropped.evicted, 2);
+    ASSERT_EQ(dropped.total(), 2);
+  }
+  {
+    // the sink is blocked for longer than the timeout
+    const auto [timestamps, dropped] = run(OverflowPolicy::BLOCK);
+    ASSERT_EQ(timestamps.size(), 4);
+    ASSERT_EQ(dropped.rejected, 2);
+  }
+  {
+    const auto [timestamps, dropped] = run(OverflowPolicy::DECIMATE);
+    ASSERT_EQ(timestamps.size(), 4);
+    ASSERT_EQ(dropped.total(), 2);
+  }
+}
+
+class SlowSink : public DataSinkBase
+{
+public:
+  using DataSinkBase::stopThread;
+
+  ~SlowSink() override
+  {
+    stopThread();
+  }
+
+  void addChannel(std::string const&, Schema const&) override
+  {}
+
+  bool storeSnapshot(const Snapshot&) override
+  {
+    std::this_thread::sleep_for(std::chrono::microseconds(50));
+    return true;
+  }
+};
+
+TEST(DataTamerBasic, QueueLimitsEvictWhileStopping)
+{
+  // the producers evicting snapshots must not prevent the thread from stopping
+  for (int i = 0; i < 20; i++)
+  {
+    auto sink = std::make_shared<SlowSink>();
+    QueueLimits limits;
+    limits.max_snapshots = 1;
+    limits.policy = OverflowPolicy::DROP_OLDEST;
+    sink->setQueueLimits(limits);
+
+    std::atomic_bool pushing = true;
+    std::thread producer([&]() {
+      Snapshot snapshot = {};
+      snapshot.channel_name = "chan";
+      const auto shared_snapshot = std::make_shared<const Snapshot>(snapshot);
+      while (pushing)
+      {
+        sink->pushSnapshot(shared_snapshot);
+      }
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    sink->stopThread();
+    pushing = false;
+    producer.join();
+  }
+}
+
+TEST(DataTamerBasic, QueueLimitsBlock)
+{
+  auto sink = std::make_shared<GatedSink>();
+  QueueLimits limits;
+  limits.max_bytes = 100;
+  limits.policy = OverflowPolicy::BLOCK;
+  limits.block_timeout = std::chrono::seconds(10);
+  sink->setQueueLimits(limits);
+
+  Snapshot snapshot;
+  snapshot.channel_name = "chan";
+  snapshot.payload.resize(60);
+  ASSERT_TRUE(sink->pushSnapshot(snapshot));
+  while (!sink->waiting)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  ASSERT_TRUE(sink->pushSnapshot(snapshot));
+
+  // the producer waits until the sink has space
+  std::thread opener([sink]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    sink->open = true;
+  });
+  const auto start = std::chrono::steady_clock::now();
+  ASSERT_TRUE(sink->pushSnapshot(snapshot));
+  ASSERT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(10));
+  opener.join();
+  ASSERT_EQ(sink->dropCounters().total(), 0);
+}
+
+TEST(DataTamerBasic, SinkStatistics)
+{
+  auto sink = std::make_shared<GatedSink>();
+  Snapshot snapshot;
+  snapshot.channel_name = "chan";
+  snapshot.payload.resize(10);
+  snapshot.active_mask.resize(1);
+  ASSERT_TRUE(sink->pushSnapshot(snapshot));
+  while (!sink->waiting)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  for (int i = 0; i < 3; i++)
+  {
+    ASSERT_TRUE(sink->pushSnapshot(snapshot));
+  }
+  auto stats = sink->statistics();
+  ASSERT_EQ(stats.queue_depth, 3);
+  ASSERT_EQ(stats.queue_high_water, 3);
+  ASSERT_EQ(stats.enqueued, 4);
+  ASSERT_EQ(stats.bytes_in, 4 * 11);
+  ASSERT_EQ(stats.stored, 0);
+
+  sink->open = true;
+  for (int i = 0; i < 100 && sink->statistics().stored < 4; i++)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  stats = sink->statistics();
+  ASSERT_EQ(stats.queue_depth, 0);
+  ASSERT_EQ(stats.queue_high_water, 3);
+  ASSERT_EQ(stats.stored, 4);
+  ASSERT_EQ(stats.bytes_out, 4 * 11);
+  ASSERT_EQ(stats.dropped.total(), 0);
+  ASSERT_EQ(stats.channels["chan"], 4);
+  // two batches: the first snapshot, then the other three
+  uint64_t calls = 0;
+  for (auto count : stats.store_latency)
+  {
+    calls += count;
+  }
+  ASSERT_EQ(calls, 2);
+  // the first call waited (at least 1 ms) for the gate to open
+  uint64_t slow_calls = 0;
+  for (size_t i = 10; i < stats.store_latency.size(); i++)
+  {
+    slow_calls += stats.store_latency[i];
+  }
+  ASSERT_GE(slow_calls, 1);
+}
+
+class BatchSink : public GatedSink
+{
+public:
+  std::vector<size_t> batch_sizes;
+
+  bool storeSnapshots(const std::vector<SnapshotPtr>& snapshots) override
+  {
+    {
+      std::scoped_lock lk(mutex);
+      batch_sizes.push_back(snapshots.size());
+    }
+    return DataSinkBase::storeSnapshots(snapshots);
+  }
+};
+
+TEST(DataTamerBasic, StoreSnapshotsBatch)
+{
+  auto sink = std::make_shared<BatchSink>();
+  Snapshot snapshot;
+  snapshot.channel_name = "chan";
+  ASSERT_TRUE(sink->pushSnapshot(snapshot));
+  while (!sink->waiting)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  // queued while the sink is busy: stored with a single call
+  for (int i = 0; i < 10; i++)
+  {
+    ASSERT_TRUE(sink->pushSnapshot(snapshot));
+  }
+  sink->open = true;
+  for (int i = 0; i < 100; i++)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    std::scoped_lock lk(sink->mutex);
+    if (sink->timestamps["chan"].size() == 11)
+    {
+      break;
+    }
+  }
+  std::scoped_lock lk(sink->mutex);
+  ASSERT_EQ(sink->timestamps["chan"].size(), 11);
+  const std::vector<size_t> expected = {1, 10};
+  ASSERT_EQ(sink->batch_sizes, expected);
+}
+
+// checks that storeSnapshot is never called by two threads at the same time
+class ExclusiveSink : public TimestampSink
+{
+public:
+  std::atomic_int inside = 0;
+  std::atomic_bool overlapped = false;
+
+  bool storeSnapshot(const Snapshot& snapshot) override
+  {
+    if (inside++ > 0)
+    {
+      overlapped = true;
+    }
+    const bool res = TimestampSink::storeSnapshot(snapshot);
+    inside--;
+    return res;
+  }
+};
+
+TEST(DataTamerBasic, SinkExecutor)
+{
+  SinkExecutorOptions options;
+  options.threads_count = 2;
+  options.cpu_affinity = {0};
+  auto executor = std::make_shared<SinkExecutor>(options);
+
+  const size_t sinks_count = 5;
+  std::vector<std::shared_ptr<ExclusiveSink>> sinks;
+  auto channel = LogChannel::create("chan");
+  for (size_t i = 0; i < sinks_count; i++)
+  {
+    sinks.push_back(std::make_shared<ExclusiveSink>());
+    sinks.back()->setExecutor(executor);
+    channel->addDataSink(sinks.back());
+  }
+  double value = 0;
+  channel->registerValue("value", &value);
+
+  const int snapshots_count = 1000;
+  for (int i = 0; i < snapshots_count; i++)
+  {
+    channel->takeSnapshot(std::chrono::nanoseconds(i));
+  }
+  for (int i = 0; i < 100; i++)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    std::scoped_lock lk(sinks.back()->mutex);
+    if (sinks.back()->timestamps["chan"].size() == snapshots_count)
+    {
+      break;
+    }
+  }
+  for (auto& sink : sinks)
+  {
+    std::scoped_lock lk(sink->mutex);
+    const auto& timestamps = sink->timestamps["chan"];
+    ASSERT_EQ(timestamps.size(), snapshots_count);
+    ASSERT_TRUE(std::is_sorted(timestamps.begin(), timestamps.end()));
+    ASSERT_FALSE(sink->overlapped);
+  }
+
+  // back to a dedicated thread
+  sinks[0]->setExecutor(nullptr);
+  channel->takeSnapshot(std::chrono::nanoseconds(snapshots_count));
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  {
+    std::scoped_lock lk(sinks[0]->mutex);
+    ASSERT_EQ(sinks[0]->timestamps["chan"].size(), snapshots_count + 1);
+  }
+
+  options.threads_count = 0;
+  ASSERT_ANY_THROW(SinkExecutor{ options });
+  options.threads_count = 1;
+  options.cpu_affinity = {-1};
+  ASSERT_ANY_THROW(SinkExecutor{ options });
+}
+
+// saves the messages prepared by LogChannel for MCAPSink
+class FramedSink : public DataSinkBase
+{
+public:
+  std::mutex mutex;
+  std::vector<std::vector<uint8_t>> messages;
+
+  ~FramedSink() override
+  {
+    stopThread();
+  }
+  void addChannel(const std::string&, const Schema&) override
+  {}
+
+  bool storeSnapshot(const Snapshot& snapshot) override
+  {
+    size_t size = 0;
+    const uint8_t* message = GetFramedMessage(snapshot, size);
+    std::scoped_lock lk(mutex);
+    messages.emplace_back();
+    if (message)
+    {
+      messages.back().assign(message, message + size);
+    }
+    return true;
+  }
+};
+
+TEST(DataTamerBasic, FramedMessage)
+{
+  auto channel = LogChannel::create("chan");
+  auto sink = std::make_shared<FramedSink>();
+  auto dummy = std::make_shared<DummySink>();
+  channel->addDataSink(sink);
+  channel->addDataSink(dummy);
+
+  double value = 42;
+  std::vector<int32_t> vect = {1, 2, 3};
+  channel->registerValue("value", &value);
+  channel->registerValue("vect", &vect);
+  ASSERT_TRUE(channel->takeSnapshot());
+
+  for (int i = 0; i < 100; i++)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    std::scoped_lock lk(sink->mutex);
+    if (!sink->messages.empty())
+    {
+      break;
+    }
+  }
+  // the copy done by DummySink has no header
+  const Snapshot& copy = dummy->latest_snapshot;
+  size_t size = 0;
+  ASSERT_EQ(GetFramedMessage(copy, size), nullptr);
+
+  std::vector<uint8_t> expected(copy.active_mask.size() + copy.payload.size() + 8);
+  SerializeMe::SpanBytes buffer(expected);
+  SerializeMe::SerializeIntoBuffer(buffer, copy.active_mask);
+  SerializeMe::SerializeIntoBuffer(buffer, uint32_t(copy.payload.size()));
+  std::memcpy(buffer.data(), copy.payload.data(), copy.payload.size());
+
+  std::scoped_lock lk(sink->mutex);
+  ASSERT_EQ(sink->messages.size(), 1);
+  ASSERT_EQ(sink->messages.front(), expected);
+}
+
+TEST(DataTamerBasic, FlightRecorderRing)
+{
+  auto channel = LogChannel::create("chan");
+  auto sink = std::make_shared<FlightRecorderSink>(1000);
+  channel->addDataSink(sink);
+
+  double value = 0;
+  channel->registerValue("value", &value);
+
+  for (int i = 0; i < 100; i++)
+  {
+    value = i;
+    channel->takeSnapshot(std::chrono::nanoseconds(i));
+  }
+  WaitStored(*sink, 100);
+
+  // header (24 bytes), then the message: mask (4 + 1 bytes) and payload (4 + 8 bytes)
+  const size_t record_size = 41;
+  const size_t buffered = 1000 / record_size;
+  ASSERT_EQ(sink->bufferedSnapshots(), buffered);
+  ASSERT_EQ(sink->bufferedBytes(), buffered * record_size);
+
+  const auto filepath = ::testing::TempDir() + "flight_recorder.mcap";
+  ASSERT_TRUE(sink->trigger(filepath, false, std::chrono::nanoseconds(100)));
+  sink->waitDump();
+  ASSERT_FALSE(sink->isDumping());
+
+  // the most recent snapshots, in order
+  const auto messages = ReadMCAP(filepath);
+  ASSERT_EQ(messages.size(), buffered);
+  for (size_t i = 0; i < messages.size(); i++)
+  {
+    const int64_t expected_time = int64_t(100 - buffered + i);
+    ASSERT_TRUE(messages[i].parsed);
+    ASSERT_EQ(messages[i].channel, "chan");
+    ASSERT_EQ(messages[i].timestamp, expected_time);
+    ASSERT_EQ(messages[i].values.at("value"), double(expected_time));
+  }
+  std::remove(filepath.c_str());
+}
+
+TEST(DataTamerBasic, FlightRecorderDelta)
+{
+  // a single keyframe, unless the sink asks for more
+  auto channel = LogChannel::create("chan");
+  channel->setDeltaEncoding(10000);
+  auto sink = std::make_shared<FlightRecorderSink>(1000);
+  channel->addDataSink(sink);
+
+  double value = 0;
+  double other = 0;
+  channel->registerValue("value", &value);
+  channel->registerValue("other", &other);
+
+  // the first keyframe is discarded soon
+  const int snapshots_count = 200;
+  for (int i = 0; i < snapshots_count; i++)
+  {
+    value = i;
+    other = double(i / 10);
+    channel->takeSnapshot(std::chrono::nanoseconds(i));
+    WaitStored(*sink, uint64_t(i + 1));
+  }
+
+  const auto filepath = ::testing::TempDir() + "flight_recorder_delta.mcap";
+  ASSERT_TRUE(sink->trigger(filepath, false, std::chrono::nanoseconds(snapshots_count)));
+  sink->waitDump();
+
+  // the file starts with a keyframe: all the messages can be decoded
+  const auto messages = ReadMCAP(filepath);
+  ASSERT_FALSE(messages.empty());
+  ASSERT_EQ(messages.back().timestamp, snapshots_count - 1);
+  for (size_t i = 0; i < messages.size(); i++)
+  {
+    const auto& msg = messages[i];
+    ASSERT_TRUE(msg.parsed) << msg.timestamp;
+    ASSERT_EQ(msg.values.at("value"), double(msg.timestamp));
+    ASSERT_EQ(msg.values.at("other"), double(msg.timestamp / 10));
+    if (i > 0)
+    {
+      ASSERT_EQ(msg.timestamp, messages[i - 1].timestamp + 1);
+    }
+  }
+  std::remove(filepath.c_str());
+}
+
+TEST(DataTamerBasic, FlightRecorderClock)
+{
+  // the timestamps are far from the system time
+  auto clock = std::make_shared<SimulatedClock>(std::chrono::nanoseconds(1000));
+  auto channel = LogChannel::create("chan");
+  channel->setClock(clock);
+  auto sink = std::make_shared<FlightRecorderSink>(
+      10000, std::chrono::nanoseconds(50), clock);
+  channel->addDataSink(sink);
+
+  double value = 0;
+  channel->registerValue("value", &value);
+
+  const auto take_snapshots = [&](int count) {
+    for (int i = 0; i < count; i++)
+    {
+      value = double(clock->now().count());
+      channel->takeSnapshot();
+      clock->advance(std::chrono::nanoseconds(10));
+    }
+  };
+  // before the trigger: 1000 ... 1090
+  take_snapshots(10);
+
+  const auto filepath = ::testing::TempDir() + "flight_recorder_clock.mcap";
+  ASSERT_TRUE(sink->trigger(filepath));
+
+  // the post-trigger window (1100 ... 1150) is not over yet
+  take_snapshots(3);
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  ASSERT_TRUE(sink->isDumping());
+
+  // moving the clock is enough, without new snapshots
+  clock->setTime(std::chrono::nanoseconds(1200));
+  sink->waitDump();
+
+  const auto messages = ReadMCAP(filepath);
+  ASSERT_EQ(messages.size(), 13);
+  for (size_t i = 0; i < messages.size(); i++)
+  {
+    const int64_t expected_time = 1000 + int64_t(i) * 10;
+    ASSERT_TRUE(messages[i].parsed);
+    ASSERT_EQ(messages[i].timestamp, expected_time);
+    ASSERT_EQ(messages[i].values.at("value"), double(expected_time));
+  }
+  std::remove(filepath.c_str());
+}
+
+TEST(DataTamerBasic, MCAPRotation)
+{
+  auto channel = LogChannel::create("chan");
+  double value = 0;
+  channel->registerValue("value", &value);
+  const auto schema = channel->getSchema();
+
+  const auto filepath = [](const std::string& suffix) {
+    return ::testing::TempDir() + "rotation" + suffix + ".mcap";
+  };
+  MCAPSink sink(filepath(""));
+  MCAPSink::RotationOptions options;
+  options.max_file_size = 100;
+  // every file would have the same path
+  options.file_pattern = filepath("_fixed");
+  ASSERT_ANY_THROW(sink.setRotation(options));
+
+  options.file_pattern = filepath("_{index}");
+  options.max_files = 2;
+  sink.setRotation(options);
+  sink.addChannel("chan", schema);
+
+  Snapshot snapshot;
+  snapshot.channel_name = "chan";
+  snapshot.schema_hash = schema.hash;
+  snapshot.active_mask.resize(1, 0xFF);
+  snapshot.payload.resize(sizeof(double));
+
+  // each message is 17 bytes: a new file every 6 snapshots
+  for (int i = 0; i < 30; i++)
+  {
+    snapshot.timestamp = std::chrono::nanoseconds(i);
+    ASSERT_TRUE(sink.storeSnapshot(snapshot));
+  }
+  sink.stopRecording();
+
+  const auto exists = [](const std::string& path) { return std::ifstream(path).good(); };
+  ASSERT_FALSE(exists(filepath("")));
+  for (int i = 1; i <= 3; i++)
+  {
+    ASSERT_FALSE(exists(filepath("_" + std::to_string(i))));
+  }
+  for (int i = 4; i <= 5; i++)
+  {
+    ASSERT_TRUE(exists(filepath("_" + std::to_string(i))));
+    std::remove(filepath("_" + std::to_string(i)).c_str());
+  }
+}
+
+TEST(DataTamerBasic, MCAPRotationDelta)
+{
+  const auto filepath = [](const std::string& suffix) {
+    return ::testing::TempDir() + "rotation_delta" + suffix + ".mcap";
+  };
+  const auto exists = [](const std::string& path) { return std::ifstream(path).good(); };
+
+  // empty pattern: the file is overwritten. Otherwise, the last 3 files are kept
+  for (const std::string pattern : {"", "_{index}"})
+  {
+    auto channel = LogChannel::create("chan");
+    channel->setDeltaEncoding(1000);
+    double value = 0;
+    double other = 0;
+    channel->registerValue("value", &value);
+    channel->registerValue("other", &other);
+
+    auto sink = std::make_shared<MCAPSink>(filepath(""));
+    MCAPSink::RotationOptions options;
+    options.max_duration = {};
+    options.max_file_size = 300;
+    options.file_pattern = pattern.empty() ? "" : filepath(pattern);
+    options.max_files = 3;
+    sink->setRotation(options);
+    channel->addDataSink(sink);
+
+    // value is the timestamp, other changes rarely: the delta frames skip it.
+    // The last snapshots are not rotated, not to end with an empty file
+    const int snapshots_count = 300;
+    for (int i = 0; i < snapshots_count; i++)
+    {
+      if (i == snapshots_count - 5)
+      {
+        WaitStored(*sink, uint64_t(i));
+        sink->setRotation({std::chrono::seconds(0), 0, "", 0});
+      }
+      value = i;
+      other = double(i / 10);
+      channel->takeSnapshot(std::chrono::nanoseconds(i));
+      if (i % 5 == 0)
+      {
+        WaitStored(*sink, uint64_t(i + 1));
+      }
+    }
+    WaitStored(*sink, snapshots_count);
+    sink->stopRecording();
+    const auto stats = sink->writerStatistics();
+    ASSERT_EQ(stats.messages + stats.skipped_frames, snapshots_count);
+
+    std::vector<std::string> files;
+    if (pattern.empty())
+    {
+      ASSERT_FALSE(exists(filepath("") + ".part"));
+      files.push_back(filepath(""));
+    }
+    else
+    {
+      for (int i = 1; i <= snapshots_count; i++)
+      {
+        if (exists(filepath("_" + std::to_string(i))))
+        {
+          files.push_back(filepath("_" + std::to_string(i)));
+        }
+      }
+      ASSERT_EQ(files.size(), options.max_files);
+    }
+
+    // each file can be parsed on its own, starting from its first message
+    for (const auto& file : files)
+    {
+      const auto messages = ReadMCAP(file);
+      ASSERT_FALSE(messages.empty()) << file;
+      for (const auto& msg : messages)
+      {
+        ASSERT_TRUE(msg.parsed) << file << " at " << msg.timestamp;
+        ASSERT_EQ(msg.values.at("value"), double(msg.timestamp));
+        ASSERT_EQ(msg.values.at("other"), double(msg.timestamp / 10));
+      }
+      std::remove(file.c_str());
+    }
+  }
+}
+
+TEST(DataTamerBasic, Clocks)
+{
+  const auto system_time = SystemClock().now();
+
+  // the coarse clock has a resolution of few milliseconds
+  const auto coarse_time = CoarseMonotonicClock().now();
+  ASSERT_LT(std::chrono::abs(coarse_time - system_time), std::chrono::milliseconds(100));
+
+#if defined(__x86_64__) || defined(__i386__)
+  TscClock tsc_clock(std::chrono::milliseconds(10));
+  ASSERT_GT(tsc_clock.nsecPerTick(), 0.0);
+  const auto tsc_time = tsc_clock.now();
+  ASSERT_LT(std::chrono::abs(tsc_time - SystemClock().now()), std::chrono::milliseconds(10));
+
+  // recalibrated every 5 milliseconds, without going backward
+  TscClock recalibrated_clock(std::chrono::milliseconds(10), std::chrono::milliseconds(5));
+  auto prev_time = recalibrated_clock.now();
+  for (int i = 0; i < 50; i++)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    const auto time = recalibrated_clock.now();
+    ASSERT_GE(time, prev_time);
+    prev_time = time;
+  }
+  ASSERT_GT(recalibrated_clock.nsecPerTick(), 0.0);
+  ASSERT_LT(std::chrono::abs(prev_time - SystemClock().now()), std::chrono::milliseconds(1));
+#endif
+}
+
+TEST(DataTamerBasic, Float16Conversions)
+{
+  ASSERT_EQ(FloatToHalf(1.0f), 0x3C00);
+  ASSERT_EQ(FloatToHalf(-2.0f), 0xC000);
+  ASSERT_EQ(FloatToHalf(65504.0f), 0x7BFF);
+  // too large, infinity and NaN
+  ASSERT_EQ(FloatToHalf(65520.0f), 0x7C00);
+  ASSERT_EQ(FloatToHalf(std::numeric_limits<float>::infinity()), 0x7C00);
+  ASSERT_EQ(FloatToHalf(std::numeric_limits<float>::quiet_NaN()), 0x7E00);
+  // smallest subnormal and round to nearest even
+  ASSERT_EQ(FloatToHalf(5.9604645e-08f), 0x0001);
+  ASSERT_EQ(FloatToHalf(1e-8f), 0x0000);
+  ASSERT_EQ(FloatToHalf(1.0f + 1.0f / 2048.0f), 0x3C00);
+  ASSERT_EQ(FloatToHalf(1.0f + 3.0f / 2048.0f), 0x3C02);
+
+  ASSERT_EQ(FloatToBFloat16(1.0f), 0x3F80);
+  ASSERT_EQ(FloatToBFloat16(-2.0f), 0xC000);
+  ASSERT_TRUE(std::isnan(BFloat16ToFloat(FloatToBFloat16(std::nanf("")))));
+
+  // all the 16 bits values survive the round trip
+  for (uint32_t i = 0; i <= 0xFFFF; i++)
+  {
+    const auto value = uint16_t(i);
+    const float half = HalfToFloat(value);
+    if (std::isnan(half))
+    {
+      ASSERT_EQ(value & 0x7C00, 0x7C00);
+      continue;
+    }
+    ASSERT_EQ(FloatToHalf(half), value);
+
+    const float bfloat = BFloat16ToFloat(value);
+    if (!std::isnan(bfloat))
+    {
+      ASSERT_EQ(FloatToBFloat16(bfloat), value);
+    }
+  }
+
+  // the vectorized version gives the same result
+  std::vector<float> floats;
+  for (uint32_t i = 0; i <= 0xFFFF; i += 7)
+  {
+    floats.push_back(HalfToFloat(uint16_t(i)) * 1.001f);
+  }
+  std::vector<double> doubles(floats.begin(), floats.end());
+  std::vector<uint8_t> halves_A(floats.size() * 2);
+  std::vector<uint8_t> halves_B(floats.size() * 2);
+  FloatToHalfArray(floats.data(), floats.size(), halves_A.data());
+  FloatToHalfArray(doubles.data(), doubles.size(), halves_B.data());
+  for (size_t i = 0; i < floats.size(); i++)
+  {
+    uint16_t half_A = 0;
+    uint16_t half_B = 0;
+    std::memcpy(&half_A, &halves_A[i * 2], 2);
+    std::memcpy(&half_B, &halves_B[i * 2], 2);
+    if (std::isnan(floats[i]))
+    {
+      ASSERT_TRUE(std::isnan(HalfToFloat(half_A)));
+      ASSERT_TRUE(std::isnan(HalfToFloat(half_B)));
+      continue;
+    }
+    ASSERT_EQ(half_A, FloatToHalf(floats[i]));
+    ASSERT_EQ(half_B, FloatToHalf(floats[i]));
+  }
+}
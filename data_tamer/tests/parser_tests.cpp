@@ -1,9 +1,14 @@
 #include "data_tamer_parser/data_tamer_parser.hpp"
+#include "data_tamer_parser/columnar_reader.hpp"
 #include "data_tamer/data_tamer.hpp"
+#include "data_tamer/sinks/columnar_sink.hpp"
 #include "data_tamer/sinks/dummy_sink.hpp"
 #include "../examples/geometry_types.hpp"
 
 #include <gtest/gtest.h>
+#include <condition_variable>
+#include <cstring>
+#include <map>
 #include <thread>
 #include <variant>
 #include <string>
@@ -27,25 +32,25 @@ uint16  my/short
 
   ASSERT_EQ(schema.fields.size(), 7);
 
-  TypeField field0 = {"v1", BasicType::INT8, "int8", false, 0};
+  TypeField field0 = {"v1", BasicType::INT8, "int8", false, 0, {}};
   ASSERT_EQ(schema.fields[0], field0);
 
-  TypeField field1 = {"v2", BasicType::FLOAT64, "float64", false, 0};
+  TypeField field1 = {"v2", BasicType::FLOAT64, "float64", false, 0, {}};
   ASSERT_EQ(schema.fields[1], field1);
 
-  TypeField field2 = {"array", BasicType::FLOAT32, "float32", true, 5};
+  TypeField field2 = {"array", BasicType::FLOAT32, "float32", true, 5, {}};
   ASSERT_EQ(schema.fields[2], field2);
 
-  TypeField field3 = {"vect", BasicType::INT32, "int32", true, 0};
+  TypeField field3 = {"vect", BasicType::INT32, "int32", true, 0, {}};
   ASSERT_EQ(schema.fields[3], field3);
 
-  TypeField field4 = {"is_true", BasicType::BOOL, "bool", false, 0};
+  TypeField field4 = {"is_true", BasicType::BOOL, "bool", false, 0, {}};
   ASSERT_EQ(schema.fields[4], field4);
 
-  TypeField field5 = {"blob", BasicType::CHAR, "char", true, 256};
+  TypeField field5 = {"blob", BasicType::CHAR, "char", true, 256, {}};
   ASSERT_EQ(schema.fields[5], field5);
 
-  TypeField field6 = {"my/short", BasicType::UINT16, "uint16", false, 0};
+  TypeField field6 = {"my/short", BasicType::UINT16, "uint16", false, 0, {}};
   ASSERT_EQ(schema.fields[6], field6);
 }
 
@@ -291,3 +296,869 @@ TEST(DataTamerParser, VectorParsing)
   ASSERT_EQ(parsed_values.at("quats[1]/y"), 32);
   ASSERT_EQ(parsed_values.at("quats[1]/z"), 33);
 }
+
+// keep all the snapshots received
+class CollectorSink : public DataTamer::DataSinkBase
+{
+public:
+  std::vector<DataTamer::Snapshot> snapshots;
+  std::mutex mutex;
+
+  ~CollectorSink() override
+  {
+    stopThread();
+  }
+
+  void addChannel(std::string const&, DataTamer::Schema const&) override
+  {}
+
+  bool storeSnapshot(const DataTamer::Snapshot& snapshot) override
+  {
+    std::scoped_lock lk(mutex);
+    snapshots.push_back(snapshot);
+    return true;
+  }
+};
+
+TEST(DataTamerParser, DeltaEncoding)
+{
+  auto channel = DataTamer::LogChannel::create("channel");
+  auto sink = std::make_shared<CollectorSink>();
+  channel->addDataSink(sink);
+  channel->setDeltaEncoding(10);
+
+  std::vector<double> values(100, 0.0);
+  std::vector<int> vect = {1, 2, 3};
+  Pose pose = {{1, 2, 3}, {4, 5, 6, 7}};
+  uint16_t counter = 0;
+
+  for(size_t j=0; j<values.size(); j++)
+  {
+    channel->registerValue("v" + std::to_string(j), &values[j]);
+  }
+  channel->registerValue("vect", &vect);
+  channel->registerValue("pose", &pose);
+  auto id_counter = channel->registerValue("counter", &counter);
+
+  const int snapshots_count = 25;
+  std::vector<std::map<std::string, double>> expected_values;
+
+  for(int i=0; i<snapshots_count; i++)
+  {
+    // only few values change
+    counter++;
+    values[size_t(i) % 100] = i;
+    if(i == 5)
+    {
+      vect.push_back(4);
+    }
+    if(i == 15)
+    {
+      pose.pos.x = 42;
+    }
+    if(i == 17)
+    {
+      // this will force a keyframe
+      channel->setEnabled(id_counter, false);
+    }
+    channel->takeSnapshot();
+
+    std::map<std::string, double> expected;
+    for(size_t j=0; j<values.size(); j++)
+    {
+      expected["v" + std::to_string(j)] = values[j];
+    }
+    for(size_t j=0; j<vect.size(); j++)
+    {
+      expected["vect[" + std::to_string(j) + "]"] = vect[j];
+    }
+    expected["pose/position/x"] = pose.pos.x;
+    if(i < 17)
+    {
+      expected["counter"] = counter;
+    }
+    expected_values.push_back(expected);
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+  const auto schema_txt = ToStr(channel->getSchema());
+  ASSERT_NE(schema_txt.find("### encoding: delta\n"), std::string::npos);
+  const auto schema = DataTamerParser::BuilSchemaFromText(schema_txt);
+  ASSERT_EQ(schema.encoding, DataTamerParser::PayloadEncoding::DELTA);
+
+  std::scoped_lock lk(sink->mutex);
+  ASSERT_EQ(sink->snapshots.size(), snapshots_count);
+
+  // keyframes: first snapshot, every 10 snapshots and when the active mask changes
+  for(size_t i=0; i<sink->snapshots.size(); i++)
+  {
+    const auto& payload = sink->snapshots[i].payload;
+    const bool is_keyframe = (i == 0 || i == 10 || i == 17);
+    ASSERT_EQ(payload[0], is_keyframe ? kKeyframe : kDeltaFrame);
+    if(!is_keyframe)
+    {
+      ASSERT_LT(payload.size(), 100);
+    }
+  }
+
+  for(size_t i=0; i<sink->snapshots.size(); i++)
+  {
+    std::map<std::string, double> parsed_values;
+    auto callback = [&](const std::string& field_name, const VarNumber& number)
+    {
+      parsed_values[field_name] = std::visit([](const auto& var) { return double(var); }, number);
+    };
+    ASSERT_TRUE(ParseSnapshot(schema, ConvertSnapshot(sink->snapshots[i]), callback));
+
+    ASSERT_EQ(parsed_values.count("counter"), i < 17 ? 1 : 0);
+    for(const auto& [name, value]: expected_values[i])
+    {
+      ASSERT_EQ(parsed_values.at(name), value) << name << " in snapshot " << i;
+    }
+  }
+
+  // a delta frame can't be parsed without the previous snapshots
+  const auto fresh_schema = DataTamerParser::BuilSchemaFromText(schema_txt);
+  auto null_callback = [](const std::string&, const VarNumber&) {};
+  ASSERT_FALSE(ParseSnapshot(fresh_schema, ConvertSnapshot(sink->snapshots[1]), null_callback));
+
+  // nor if a frame is missing: the parser waits for the next keyframe
+  const auto gap_schema = DataTamerParser::BuilSchemaFromText(schema_txt);
+  ASSERT_TRUE(ParseSnapshot(gap_schema, ConvertSnapshot(sink->snapshots[0]), null_callback));
+  ASSERT_FALSE(ParseSnapshot(gap_schema, ConvertSnapshot(sink->snapshots[2]), null_callback));
+  ASSERT_FALSE(ParseSnapshot(gap_schema, ConvertSnapshot(sink->snapshots[3]), null_callback));
+  ASSERT_TRUE(ParseSnapshot(gap_schema, ConvertSnapshot(sink->snapshots[10]), null_callback));
+  ASSERT_TRUE(ParseSnapshot(gap_schema, ConvertSnapshot(sink->snapshots[11]), null_callback));
+}
+
+TEST(DataTamerParser, DeltaKeyframeRequests)
+{
+  for (const bool deferred : {false, true})
+  {
+    auto channel = DataTamer::LogChannel::create("channel");
+    auto sink_A = std::make_shared<CollectorSink>();
+    auto sink_B = std::make_shared<CollectorSink>();
+    channel->addDataSink(sink_A);
+    channel->setDeltaEncoding(100);
+    channel->setDeferredSerialization(deferred);
+
+    double value = 0;
+    channel->registerValue("value", &value);
+
+    auto wait_snapshots = [](CollectorSink& sink, size_t count) {
+      for (int i = 0; i < 1000; i++)
+      {
+        {
+          std::scoped_lock lk(sink.mutex);
+          if (sink.snapshots.size() >= count)
+          {
+            return;
+          }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+    };
+    auto frame_type = [](CollectorSink& sink, size_t index) {
+      std::scoped_lock lk(sink.mutex);
+      return sink.snapshots.at(index).payload[0];
+    };
+
+    for (int i = 0; i < 3; i++)
+    {
+      value = i;
+      channel->takeSnapshot();
+    }
+    wait_snapshots(*sink_A, 3);
+
+    // a sink added later receives a keyframe first (the other sinks too)
+    channel->addDataSink(sink_B);
+    value = 3;
+    channel->takeSnapshot();
+    wait_snapshots(*sink_A, 4);
+    wait_snapshots(*sink_B, 1);
+    ASSERT_EQ(frame_type(*sink_B, 0), kKeyframe) << "deferred: " << deferred;
+    ASSERT_EQ(frame_type(*sink_A, 3), kKeyframe) << "deferred: " << deferred;
+
+    value = 4;
+    channel->takeSnapshot();
+    wait_snapshots(*sink_B, 2);
+    ASSERT_EQ(frame_type(*sink_B, 1), kDeltaFrame) << "deferred: " << deferred;
+
+    // requested by the sink, for instance when it starts a new file
+    sink_B->requestKeyframe();
+    value = 5;
+    channel->takeSnapshot();
+    value = 6;
+    channel->takeSnapshot();
+    wait_snapshots(*sink_B, 4);
+    ASSERT_EQ(frame_type(*sink_B, 2), kKeyframe) << "deferred: " << deferred;
+    ASSERT_EQ(frame_type(*sink_B, 3), kDeltaFrame) << "deferred: " << deferred;
+
+    // sink_B can be parsed from its first snapshot
+    const auto schema = DataTamerParser::BuilSchemaFromText(ToStr(channel->getSchema()));
+    std::scoped_lock lk(sink_B->mutex);
+    for (size_t i = 0; i < sink_B->snapshots.size(); i++)
+    {
+      double parsed = -1;
+      auto callback = [&](const std::string&, const VarNumber& number) {
+        parsed = std::get<double>(number);
+      };
+      ASSERT_TRUE(ParseSnapshot(schema, ConvertSnapshot(sink_B->snapshots[i]), callback));
+      ASSERT_EQ(parsed, double(i + 3));
+    }
+  }
+}
+
+// CollectorSink that doesn't store the snapshots while the gate is closed
+class GatedCollectorSink : public CollectorSink
+{
+public:
+  ~GatedCollectorSink() override
+  {
+    setOpen(true);
+    stopThread();
+  }
+
+  void setOpen(bool open)
+  {
+    {
+      std::scoped_lock lk(gate_mutex_);
+      open_ = open;
+    }
+    gate_cv_.notify_all();
+  }
+
+  bool storeSnapshot(const DataTamer::Snapshot& snapshot) override
+  {
+    {
+      std::unique_lock lk(gate_mutex_);
+      gate_cv_.wait(lk, [this]() { return open_; });
+    }
+    return CollectorSink::storeSnapshot(snapshot);
+  }
+
+private:
+  std::mutex gate_mutex_;
+  std::condition_variable gate_cv_;
+  bool open_ = true;
+};
+
+TEST(DataTamerParser, DeltaWithBoundedQueue)
+{
+  using DataTamer::OverflowPolicy;
+  for (const auto policy : {OverflowPolicy::DROP_NEWEST, OverflowPolicy::DROP_OLDEST,
+                            OverflowPolicy::BLOCK, OverflowPolicy::DECIMATE})
+  {
+    auto channel = DataTamer::LogChannel::create("channel");
+    auto sink = std::make_shared<GatedCollectorSink>();
+    DataTamer::QueueLimits limits;
+    limits.max_snapshots = 4;
+    limits.policy = policy;
+    limits.block_timeout = std::chrono::microseconds(100);
+    sink->setQueueLimits(limits);
+    channel->addDataSink(sink);
+    channel->setDeltaEncoding(1000);
+
+    double value = 0;
+    double other = 0;
+    channel->registerValue("value", &value);
+    channel->registerValue("other", &other);
+
+    // wait until all the snapshots pushed were either stored or dropped
+    auto wait_queue = [&sink](int pushed) {
+      for (int i = 0; i < 1000; i++)
+      {
+        const auto stats = sink->statistics();
+        if (stats.stored + stats.dropped.total() >= uint64_t(pushed))
+        {
+          return;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+    };
+
+    // the value is the timestamp; other changes rarely, to be skipped by the delta frames.
+    // The queue overflows while the gate is closed
+    const int snapshots_count = 60;
+    for (int i = 0; i < snapshots_count; i++)
+    {
+      if (i == 10)
+      {
+        sink->setOpen(false);
+      }
+      if (i == 40)
+      {
+        sink->setOpen(true);
+        wait_queue(i);
+      }
+      value = i;
+      other = double(i / 7);
+      channel->takeSnapshot(std::chrono::nanoseconds(i));
+      if (i < 10 || i >= 40)
+      {
+        wait_queue(i + 1);
+      }
+    }
+    const uint64_t dropped = sink->dropCounters().total();
+    ASSERT_GT(dropped, 0);
+    ASSERT_EQ(sink->statistics().channels_dropped.at("channel"), dropped);
+
+    const auto schema = DataTamerParser::BuilSchemaFromText(ToStr(channel->getSchema()));
+    std::scoped_lock lk(sink->mutex);
+    ASSERT_EQ(sink->snapshots.size() + dropped, snapshots_count);
+
+    size_t parsed_count = 0;
+    for (const auto& snapshot : sink->snapshots)
+    {
+      std::map<std::string, double> parsed;
+      auto callback = [&](const std::string& name, const VarNumber& number) {
+        parsed[name] = std::get<double>(number);
+      };
+      if (!ParseSnapshot(schema, ConvertSnapshot(snapshot), callback))
+      {
+        continue;
+      }
+      parsed_count++;
+      const auto timestamp = double(snapshot.timestamp.count());
+      ASSERT_EQ(parsed.at("value"), timestamp);
+      ASSERT_EQ(parsed.at("other"), double(int(timestamp) / 7));
+    }
+    if (policy == OverflowPolicy::DROP_OLDEST)
+    {
+      // the delta frames in the queue after an evicted one are lost too,
+      // until the keyframe requested by the eviction
+      ASSERT_GT(parsed_count, 20);
+    }
+    else
+    {
+      // the snapshot following a discarded one is a keyframe
+      ASSERT_EQ(parsed_count, sink->snapshots.size());
+    }
+    ASSERT_EQ(sink->snapshots.back().timestamp.count(), snapshots_count - 1);
+  }
+}
+
+TEST(DataTamerParser, Clock)
+{
+  auto channel = DataTamer::LogChannel::create("channel");
+  auto sink = std::make_shared<CollectorSink>();
+  channel->addDataSink(sink);
+
+  auto clock = std::make_shared<DataTamer::SimulatedClock>(std::chrono::seconds(10));
+  channel->setClock(clock);
+
+  double value = 0;
+  channel->registerValue("value", &value);
+
+  channel->takeSnapshot();
+  clock->advance(std::chrono::milliseconds(1));
+  channel->takeSnapshot();
+  // can't be changed once logging started
+  ASSERT_ANY_THROW(channel->setClock(std::make_shared<DataTamer::SystemClock>()););
+
+  const auto schema = DataTamerParser::BuilSchemaFromText(ToStr(channel->getSchema()));
+  ASSERT_EQ(schema.clock, "simulated");
+
+  // default clock is not written in the schema
+  auto other_channel = DataTamer::LogChannel::create("other");
+  const auto default_schema =
+      DataTamerParser::BuilSchemaFromText(ToStr(other_channel->getSchema()));
+  ASSERT_EQ(default_schema.clock, "system_clock");
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  std::scoped_lock lk(sink->mutex);
+  ASSERT_EQ(sink->snapshots.size(), 2);
+  ASSERT_EQ(sink->snapshots[0].timestamp, std::chrono::seconds(10));
+  ASSERT_EQ(sink->snapshots[1].timestamp,
+            std::chrono::seconds(10) + std::chrono::milliseconds(1));
+}
+
+TEST(DataTamerParser, Quantization)
+{
+  using DataTamer::Quantized;
+  auto channel = DataTamer::LogChannel::create("channel");
+  auto dummy_sink = std::make_shared<DataTamer::DummySink>();
+  channel->addDataSink(dummy_sink);
+
+  double temperature = 21.4567;
+  float voltage = 12.02f;
+  std::vector<double> ranges = {0.5, 1.25, -3.0, 1e9, std::nan("")};
+  std::array<double, 2> angles = {0.1, -0.2};
+
+  channel->registerValue("temperature", &temperature, Quantized<int16_t>{0.01, 20.0});
+  channel->registerValue("voltage", &voltage, Quantized<uint8_t>{0.1});
+  channel->registerValue("ranges", &ranges, Quantized<int32_t>{1e-4});
+  channel->registerValue("angles", &angles, Quantized<int16_t>{1e-3});
+  ASSERT_ANY_THROW(channel->registerValue("wrong", &temperature, Quantized<int16_t>{0.0}););
+
+  channel->takeSnapshot();
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+  const auto& schema_in = channel->getSchema();
+  ASSERT_EQ(schema_in.fields[0].type, DataTamer::BasicType::INT16);
+  ASSERT_EQ(schema_in.fields[2].type, DataTamer::BasicType::INT32);
+
+  // the hash is verified by BuilSchemaFromText
+  const auto schema_out = DataTamerParser::BuilSchemaFromText(ToStr(schema_in));
+  ASSERT_EQ(schema_out.fields.size(), 4);
+  ASSERT_EQ(schema_out.fields[0].field_name, "temperature");
+  ASSERT_EQ(schema_out.fields[0].quantization->scale, 0.01);
+  ASSERT_EQ(schema_out.fields[0].quantization->offset, 20.0);
+  ASSERT_EQ(schema_out.fields[2].quantization->scale, 1e-4);
+  ASSERT_EQ(schema_out.hash, schema_in.hash);
+
+  // 2 + 1 + (4 + 5*4) + 2*2 bytes
+  ASSERT_EQ(dummy_sink->latest_snapshot.payload.size(), 31);
+
+  std::map<std::string, double> parsed_values;
+  auto callback = [&](const std::string& field_name, const DataTamerParser::VarNumber& number) {
+    ASSERT_TRUE(std::holds_alternative<double>(number));
+    parsed_values[field_name] = std::get<double>(number);
+  };
+  const auto snapshot_view = ConvertSnapshot(dummy_sink->latest_snapshot);
+  ASSERT_TRUE(DataTamerParser::ParseSnapshot(schema_out, snapshot_view, callback));
+
+  ASSERT_NEAR(parsed_values.at("temperature"), 21.46, 1e-9);
+  ASSERT_NEAR(parsed_values.at("voltage"), 12.0, 1e-9);
+  ASSERT_NEAR(parsed_values.at("ranges[0]"), 0.5, 1e-9);
+  ASSERT_NEAR(parsed_values.at("ranges[1]"), 1.25, 1e-9);
+  ASSERT_NEAR(parsed_values.at("ranges[2]"), -3.0, 1e-9);
+  // saturated
+  ASSERT_NEAR(parsed_values.at("ranges[3]"), std::numeric_limits<int32_t>::max() * 1e-4,
+              1e-9);
+  // NaN is saved as zero
+  ASSERT_EQ(parsed_values.at("ranges[4]"), 0.0);
+  ASSERT_NEAR(parsed_values.at("angles[0]"), 0.1, 1e-9);
+  ASSERT_NEAR(parsed_values.at("angles[1]"), -0.2, 1e-9);
+}
+
+TEST(DataTamerParser, HalfFloat)
+{
+  auto channel = DataTamer::LogChannel::create("channel");
+  auto dummy_sink = std::make_shared<DataTamer::DummySink>();
+  channel->addDataSink(dummy_sink);
+
+  std::vector<double> currents = {0.5, -1.25, 1000.0};
+  float speed = 3.14159f;
+  int wrong = 0;
+
+  channel->registerValue("currents", &currents, DataTamer::BasicType::FLOAT16);
+  channel->registerValue("speed", &speed, DataTamer::BasicType::BFLOAT16);
+  ASSERT_ANY_THROW(channel->registerValue("speed2", &speed, DataTamer::BasicType::INT16););
+
+  channel->takeSnapshot();
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+  const auto schema_text = ToStr(channel->getSchema());
+  ASSERT_NE(schema_text.find("float16[] currents"), std::string::npos);
+  ASSERT_NE(schema_text.find("bfloat16 speed"), std::string::npos);
+  const auto schema = DataTamerParser::BuilSchemaFromText(schema_text);
+  ASSERT_EQ(schema.fields[0].type, BasicType::FLOAT16);
+  ASSERT_EQ(schema.fields[1].type, BasicType::BFLOAT16);
+
+  // (4 + 3*2) + 2 bytes
+  ASSERT_EQ(dummy_sink->latest_snapshot.payload.size(), 12);
+
+  std::map<std::string, float> parsed_values;
+  auto callback = [&](const std::string& field_name, const DataTamerParser::VarNumber& number) {
+    ASSERT_TRUE(std::holds_alternative<float>(number));
+    parsed_values[field_name] = std::get<float>(number);
+  };
+  const auto snapshot_view = ConvertSnapshot(dummy_sink->latest_snapshot);
+  ASSERT_TRUE(DataTamerParser::ParseSnapshot(schema, snapshot_view, callback));
+
+  // these are exact in FLOAT16
+  ASSERT_EQ(parsed_values.at("currents[0]"), 0.5f);
+  ASSERT_EQ(parsed_values.at("currents[1]"), -1.25f);
+  ASSERT_EQ(parsed_values.at("currents[2]"), 1000.0f);
+  // BFLOAT16 has 8 bits of mantissa
+  ASSERT_NEAR(parsed_values.at("speed"), 3.14159f, 0.01f);
+}
+
+TEST(DataTamerParser, PackedBools)
+{
+  enum Mode { PLAIN, DELTA, DEFERRED };
+  for (const Mode mode : {PLAIN, DELTA, DEFERRED})
+  {
+    auto channel = DataTamer::LogChannel::create("channel");
+    auto sink = std::make_shared<CollectorSink>();
+    channel->addDataSink(sink);
+    if (mode == DELTA)
+    {
+      channel->setDeltaEncoding(3);
+    }
+
+    std::array<bool, 10> flags = {};
+    double value = 0;
+    std::array<bool, 11> array = {};
+    std::vector<bool> vect(13, false);
+
+    std::vector<DataTamer::RegistrationID> ids;
+    for (size_t i = 0; i < flags.size(); i++)
+    {
+      ids.push_back(channel->registerValue("flag_" + std::to_string(i), &flags[i]));
+    }
+    channel->registerValue("value", &value);
+    channel->registerValue("array", &array);
+    if (mode != DEFERRED)
+    {
+      channel->registerValue("vect", &vect);
+    }
+    else
+    {
+      channel->setDeferredSerialization(true);
+    }
+
+    const int snapshots_count = 5;
+    for (int s = 0; s < snapshots_count; s++)
+    {
+      for (size_t i = 0; i < flags.size(); i++)
+      {
+        flags[i] = ((i + size_t(s)) % 3 == 0);
+      }
+      for (size_t i = 0; i < array.size(); i++)
+      {
+        array[i] = ((i + size_t(s)) % 2 == 0);
+      }
+      for (size_t i = 0; i < vect.size(); i++)
+      {
+        vect[i] = ((i * size_t(s)) % 5 == 1);
+      }
+      value = s;
+      // a disabled bool does not use a bit
+      channel->setEnabled(ids[4], s != 3);
+      channel->takeSnapshot(std::chrono::nanoseconds(s));
+    }
+
+    const auto schema = BuilSchemaFromText(ToStr(channel->getSchema()));
+    ASSERT_EQ(schema.version, DataTamer::SCHEMA_VERSION);
+
+    // wait for the deferred thread and the sink
+    for (int i = 0; i < 100; i++)
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+      std::scoped_lock lk(sink->mutex);
+      if (sink->snapshots.size() == snapshots_count)
+      {
+        break;
+      }
+    }
+    std::scoped_lock lk(sink->mutex);
+    ASSERT_EQ(sink->snapshots.size(), snapshots_count);
+
+    if (mode == PLAIN)
+    {
+      // 10 bools in 2 bytes, then 8 + 2 + (4 + 2) bytes
+      ASSERT_EQ(sink->snapshots[0].payload.size(), 18);
+    }
+
+    for (int s = 0; s < snapshots_count; s++)
+    {
+      std::map<std::string, bool> parsed_values;
+      auto callback = [&](const std::string& field_name,
+                          const DataTamerParser::VarNumber& number) {
+        if (std::holds_alternative<bool>(number))
+        {
+          parsed_values[field_name] = std::get<bool>(number);
+        }
+      };
+      const auto snapshot_view = ConvertSnapshot(sink->snapshots[size_t(s)]);
+      ASSERT_TRUE(ParseSnapshot(schema, snapshot_view, callback));
+
+      for (size_t i = 0; i < flags.size(); i++)
+      {
+        const auto name = "flag_" + std::to_string(i);
+        if (i == 4 && s == 3)
+        {
+          ASSERT_EQ(parsed_values.count(name), 0);
+          continue;
+        }
+        ASSERT_EQ(parsed_values.at(name), (i + size_t(s)) % 3 == 0);
+      }
+      for (size_t i = 0; i < array.size(); i++)
+      {
+        const auto name = "array[" + std::to_string(i) + "]";
+        ASSERT_EQ(parsed_values.at(name), (i + size_t(s)) % 2 == 0);
+      }
+      if (mode != DEFERRED)
+      {
+        for (size_t i = 0; i < vect.size(); i++)
+        {
+          const auto name = "vect[" + std::to_string(i) + "]";
+          ASSERT_EQ(parsed_values.at(name), (i * size_t(s)) % 5 == 1);
+        }
+      }
+    }
+  }
+}
+
+TEST(DataTamerParser, OlderSchemaVersion)
+{
+  // schemas written by older versions of DataTamer can still be read
+  const char* text = R"(
+### version: 4
+### channel_name: channel
+
+float64 value
+  )";
+  const auto schema = BuilSchemaFromText(text);
+  ASSERT_EQ(schema.fields.size(), 1);
+
+  const char* newer_text = R"(
+### version: 999
+### channel_name: channel
+
+float64 value
+  )";
+  ASSERT_ANY_THROW(BuilSchemaFromText(newer_text););
+
+  // no version line: written before the bools were bit-packed (version 6)
+  const char* unversioned_text = R"(
+### channel_name: channel
+
+bool flag
+float64 value
+  )";
+  const auto unversioned = BuilSchemaFromText(unversioned_text);
+  ASSERT_EQ(unversioned.version, 5);
+
+  std::vector<uint8_t> payload(1 + sizeof(double));
+  payload[0] = 1;
+  const double value = 3.5;
+  std::memcpy(payload.data() + 1, &value, sizeof(double));
+  const uint8_t mask = 0xFF;
+
+  SnapshotView snapshot;
+  snapshot.schema_hash = unversioned.hash;
+  snapshot.timestamp = 0;
+  snapshot.active_mask = {&mask, 1};
+  snapshot.payload = {payload.data(), payload.size()};
+
+  std::map<std::string, double> parsed_values;
+  auto callback = [&](const std::string& field_name, const VarNumber& number) {
+    parsed_values[field_name] = std::visit([](const auto& var) { return double(var); }, number);
+  };
+  ASSERT_TRUE(ParseSnapshot(unversioned, snapshot, callback));
+  ASSERT_EQ(parsed_values.at("flag"), 1);
+  ASSERT_EQ(parsed_values.at("value"), value);
+}
+
+TEST(DataTamerParser, ColumnarSink)
+{
+  using DataTamer::Quantized;
+  const auto filepath = ::testing::TempDir() + "columnar.dtc";
+  // small blocks, to test more than one block per series
+  auto sink = std::make_shared<DataTamer::ColumnarSink>(filepath, 300);
+  auto channel = DataTamer::LogChannel::create("channel");
+  channel->addDataSink(sink);
+
+  double position = 0;
+  float velocity = 0;
+  int32_t counter = 0;
+  uint64_t big = std::numeric_limits<uint64_t>::max() - 1000;
+  int8_t negative = 0;
+  bool toggle = false;
+  double temperature = 20;
+  std::vector<float> ranges;
+
+  channel->registerValue("position", &position);
+  channel->registerValue("velocity", &velocity);
+  channel->registerValue("counter", &counter);
+  channel->registerValue("big", &big);
+  channel->registerValue("negative", &negative);
+  auto toggle_id = channel->registerValue("toggle", &toggle);
+  channel->registerValue("temperature", &temperature, Quantized<int16_t>{0.01});
+  channel->registerValue("ranges", &ranges);
+
+  size_t raw_size = 0;
+  const int count = 1000;
+  int64_t timestamp = 1700000000000000000;
+  for (int i = 0; i < count; i++)
+  {
+    position = std::sin(i * 0.01);
+    velocity = (i < 500) ? 1.5f : -2.0f;
+    counter = i;
+    big = std::numeric_limits<uint64_t>::max() - 1000 + uint64_t(i);
+    negative = int8_t(-(i % 100));
+    toggle = (i % 7 == 0);
+    temperature = 20 + 0.01 * (i / 10);
+    ranges.assign(size_t(i % 3), float(i));
+    // disabled half of the time
+    channel->setEnabled(toggle_id, (i / 100) % 2 == 0);
+    // 1 KHz, with some jitter
+    timestamp += 1000000 + (i % 5) * 1000;
+    channel->takeSnapshot(std::chrono::nanoseconds(timestamp));
+
+    // timestamp, active mask and payload
+    raw_size += 8 + 1 + sizeof(double) + sizeof(float) + 4 + 8 + 1 + 1 + 2 + 4 +
+                ranges.size() * sizeof(float);
+    std::this_thread::sleep_for(std::chrono::microseconds(20));
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  sink->stopRecording();
+
+  const auto file_size =
+      size_t(std::ifstream(filepath, std::ios::binary | std::ios::ate).tellg());
+  ColumnarReader reader(filepath);
+  std::remove(filepath.c_str());
+
+  ASSERT_EQ(reader.channelNames(), std::vector<std::string>{"channel"});
+  ASSERT_EQ(reader.droppedSnapshots(), 0);
+  ASSERT_EQ(reader.schema("channel").fields.size(), 8);
+
+  const auto position_series = reader.readSeries("channel", "position");
+  ASSERT_EQ(position_series.type, BasicType::FLOAT64);
+  ASSERT_EQ(position_series.values.size(), count);
+  timestamp = 1700000000000000000;
+  for (int i = 0; i < count; i++)
+  {
+    timestamp += 1000000 + (i % 5) * 1000;
+    ASSERT_EQ(position_series.timestamps[size_t(i)], timestamp);
+    ASSERT_EQ(position_series.values[size_t(i)], std::sin(i * 0.01));
+  }
+
+  const auto velocity_series = reader.readSeries("channel", "velocity");
+  const auto counter_series = reader.readSeries("channel", "counter");
+  const auto big_series = reader.readSeries("channel", "big");
+  const auto negative_series = reader.readSeries("channel", "negative");
+  const auto temperature_series = reader.readSeries("channel", "temperature");
+  ASSERT_EQ(temperature_series.type, BasicType::INT16);
+  for (int i = 0; i < count; i++)
+  {
+    const auto k = size_t(i);
+    ASSERT_EQ(velocity_series.values[k], (i < 500) ? 1.5 : -2.0);
+    ASSERT_EQ(counter_series.values[k], i);
+    ASSERT_EQ(big_series.values[k],
+              double(std::numeric_limits<uint64_t>::max() - 1000 + uint64_t(i)));
+    ASSERT_EQ(negative_series.values[k], -(i % 100));
+    ASSERT_NEAR(temperature_series.values[k], 20 + 0.01 * (i / 10), 1e-9);
+  }
+
+  // series not present in all the snapshots
+  const auto toggle_series = reader.readSeries("channel", "toggle");
+  ASSERT_EQ(toggle_series.values.size(), count / 2);
+  for (size_t k = 0; k < toggle_series.values.size(); k++)
+  {
+    const size_t i = (k / 100) * 200 + (k % 100);
+    ASSERT_EQ(toggle_series.timestamps[k], position_series.timestamps[i]);
+    ASSERT_EQ(toggle_series.values[k], (i % 7 == 0) ? 1.0 : 0.0);
+  }
+  const auto range_series = reader.readSeries("channel", "ranges[1]");
+  ASSERT_EQ(range_series.values.size(), count / 3);
+  ASSERT_EQ(range_series.values.back(), 998.0);
+  ASSERT_ANY_THROW(auto missing = reader.readSeries("channel", "ranges[2]"););
+
+  // most of the file is used by "position", that changes at each snapshot
+  ASSERT_LT(file_size * 2, raw_size);
+}
+
+// serialized with its own encoding: ColumnarSink can't split it
+class OpaquePointSerializer : public DataTamer::CustomSerializer
+{
+public:
+  const std::string& typeName() const override
+  {
+    static std::string name = "OpaquePoint";
+    return name;
+  }
+
+  std::optional<DataTamer::CustomSchema> typeSchema() const override
+  {
+    return DataTamer::CustomSchema{"ros1", "float64 x\nfloat64 y\nfloat64 z"};
+  }
+
+  size_t serializedSize(const void*) const override
+  {
+    return sizeof(Point3D);
+  }
+
+  bool isFixedSize() const override
+  {
+    return true;
+  }
+
+  void serialize(const void* src, SerializeMe::SpanBytes& buffer) const override
+  {
+    const auto* point = static_cast<const Point3D*>(src);
+    SerializeMe::SerializeIntoBuffer(buffer, point->x);
+    SerializeMe::SerializeIntoBuffer(buffer, point->y);
+    SerializeMe::SerializeIntoBuffer(buffer, point->z);
+  }
+};
+
+TEST(DataTamerParser, ColumnarSinkCustomTypes)
+{
+  const auto filepath = ::testing::TempDir() + "columnar_custom.dtc";
+  auto sink = std::make_shared<DataTamer::ColumnarSink>(filepath, 64);
+
+  auto channel = DataTamer::LogChannel::create("custom");
+  channel->setDeltaEncoding(50);
+  channel->addDataSink(sink);
+  Pose pose = {};
+  std::vector<Point3D> points;
+  std::array<bool, 3> flags = {};
+  channel->registerValue("pose", &pose);
+  channel->registerValue("points", &points);
+  channel->registerValue("flags", &flags);
+
+  // rejected in addChannel, the other channels are saved
+  auto opaque_channel = DataTamer::LogChannel::create("opaque");
+  opaque_channel->addDataSink(sink);
+  Point3D opaque_point = {};
+  opaque_channel->registerCustomValue("point", &opaque_point,
+                                      std::make_shared<OpaquePointSerializer>());
+
+  const int count = 200;
+  for (int i = 0; i < count; i++)
+  {
+    pose.pos.x = i;
+    pose.rot.w = double(i / 10);
+    points.resize(size_t(i % 4));
+    for (size_t k = 0; k < points.size(); k++)
+    {
+      points[k] = {double(i), double(k), 0};
+    }
+    flags[size_t(i % 3)] = !flags[size_t(i % 3)];
+    channel->takeSnapshot(std::chrono::nanoseconds(i));
+    opaque_channel->takeSnapshot(std::chrono::nanoseconds(i));
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  sink->stopRecording();
+
+  ColumnarReader reader(filepath);
+  std::remove(filepath.c_str());
+  ASSERT_EQ(reader.channelNames(), std::vector<std::string>{"custom"});
+
+  const auto pos_x = reader.readSeries("custom", "pose/position/x");
+  const auto rot_w = reader.readSeries("custom", "pose/rotation/w");
+  ASSERT_EQ(pos_x.type, BasicType::FLOAT64);
+  ASSERT_EQ(pos_x.values.size(), count);
+  ASSERT_EQ(rot_w.values.size(), count);
+  for (int i = 0; i < count; i++)
+  {
+    ASSERT_EQ(pos_x.timestamps[size_t(i)], i);
+    ASSERT_EQ(pos_x.values[size_t(i)], i);
+    ASSERT_EQ(rot_w.values[size_t(i)], double(i / 10));
+  }
+
+  // present when the vector has at least 3 elements
+  const auto point_x = reader.readSeries("custom", "points[2]/x");
+  const auto point_y = reader.readSeries("custom", "points[2]/y");
+  ASSERT_EQ(point_x.values.size(), count / 4);
+  for (size_t k = 0; k < point_x.values.size(); k++)
+  {
+    ASSERT_EQ(point_x.timestamps[k] % 4, 3);
+    ASSERT_EQ(point_x.values[k], double(point_x.timestamps[k]));
+    ASSERT_EQ(point_y.values[k], 2.0);
+  }
+
+  // bit-packed array of bools
+  const auto flag = reader.readSeries("custom", "flags[1]");
+  ASSERT_EQ(flag.type, BasicType::BOOL);
+  ASSERT_EQ(flag.values.size(), count);
+  for (int i = 0; i < count; i++)
+  {
+    // toggled at i = 1, 4, 7 ...
+    ASSERT_EQ(flag.values[size_t(i)], double(((i + 2) / 3) % 2));
+  }
+}